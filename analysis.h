@@ -0,0 +1,450 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+
+// static analysis of the compiled bytecode (see compiler.h)
+// each user function is run through an abstract interpreter that tracks the stack depth, the names
+// and functions on the stack, and the class of the objects held in local names. From that it
+// works out the function's stack effect (how many values it consumes and how many it leaves in
+// their place, the same on every return) and whether it is pure: it touches no global or object
+// names, only creates objects of classes whose constructors are pure, and only calls functions
+// it can resolve statically that are pure themselves (no O, I or V).
+// calls to functions analyzed later are retried in further rounds, a function calling itself
+// uses the effect of its returns seen so far and is checked against its final effect.
+// devirtualize_env, run by compile_env, works out which names can only ever hold an object of one
+// standard class and turns (o)f.? on them into a direct call of the standard function (see below)
+
+#define AV_ANY  0 // anything, including every value the function got from its caller
+#define AV_NAME 1 // a name, a is the name index
+#define AV_OBJT 2 // an object of class a
+#define AV_FUNC 3 // function b of class a, bound to some object
+
+#define LOCAL_UNSET -2 // local name not assigned an object (yet)
+#define LOCAL_MIXED -1 // local name holds values of more than one kind
+
+#define NAME_USED -3    // name_store_class: the name is only read or used as an operand
+#define NAME_ESCAPES -4 // name_store_class: the name could be stored into some other way
+
+typedef struct absval absval;
+
+struct absval {
+	int kind;
+	int a;
+	int b;
+};
+
+struct func_info {
+	int known;     // the stack effect is known
+	int n_args;    // values consumed from the caller's stack
+	int n_results; // values left in their place
+	int pure;
+};
+
+void analysis_error(char* error_text);
+
+int std_effect(int class_i, int func_i, int* n_args, int* n_results);
+int any_ctor(glass_env* env);
+int analyze_function(glass_env* env, int class_i, int func_i, int* local_class);
+void analyze_env(glass_env* env);
+int name_store_class(glass_env* env, instr_t* ins);
+void merge_class(int* known, int c);
+void devirtualize_function(glass_env* env, int start, int* local_class, int* global_class, char* escaped);
+void devirtualize_env(glass_env* env);
+
+void analysis_error(char* error_text) {
+	trap_error("Error in analysis.h: ", error_text);
+	fprintf(stderr, "Error in analysis.h: %s\n", error_text);
+	exit(1);
+}
+
+int std_effect(int class_i, int func_i, int* n_args, int* n_results) {
+	// stack effect of a standard function, returns whether it is pure (A and S are, V O and I aren't)
+	// orders as in init_env: A {a s m d mod f e ne lt le gt ge}, S {l i si a d e ns sn}
+	static const int a_args[] = {2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2};
+	static const int s_args[] = {1, 2, 3, 2, 2, 2, 1, 1};
+	static const int s_results[] = {1, 1, 1, 1, 2, 1, 1, 1};
+	*n_args = 0;
+	*n_results = 0;
+	if ((class_i == 0) && (func_i < 12)) {
+		*n_args = a_args[func_i];
+		*n_results = 1;
+		return 1;
+	}
+	if ((class_i == 1) && (func_i < 8)) {
+		*n_args = s_args[func_i];
+		*n_results = s_results[func_i];
+		return 1;
+	}
+	return 0;
+}
+
+int any_ctor(glass_env* env) {
+	// some user class has a constructor, so a ! of a class not known here may run one
+	for (int c = STD_LIBS; c < env->n_classes; c++) if (env->c_ctor[c] >= 0) return 1;
+	return 0;
+}
+
+int analyze_function(glass_env* env, int class_i, int func_i, int* local_class) {
+	// one abstract run over function func_i of class class_i, filling out env->f_info[start]
+	// local_class[n] is the class of the objects local name n holds, refined by each run
+	// returns 1 when done, 0 when a callee's effect isn't known yet
+	int start = env->f_code[class_i][func_i];
+	func_info* fi = env->f_info + start;
+	instr_t* code = env->code;
+	int end = start;
+	while (code[end].op != OP_END) end++;
+
+	// the abstract stack, indexed by depth relative to the function's entry, which goes
+	// negative once caller values are consumed
+	int room = end - start + 4;
+	absval* mem = (absval*) calloc(3 * room, sizeof (absval));
+	if (!mem) analysis_error("could not malloc abstract stack in analyze_function");
+	absval* st = mem + room;
+	int depth = 0;
+	int low = 0;
+	int ret_depth = 0;
+	int n_rets = 0;
+	int self_args = -1; // effect assumed for calls to itself, -1 if there were none
+	int self_results = -1;
+	int pure = 1;
+	int ok = 1; // the effect can be worked out
+	int pending = 0;
+	int dead = 0; // after a ^, until the end of the enclosing loop
+
+	// enclosing loops: depth at the head and the lowest depth inside the body
+	int loop_depth[MAX_LOOP_DEPTH];
+	int loop_low[MAX_LOOP_DEPTH];
+	int loop_dead[MAX_LOOP_DEPTH];
+	int n_loops = 0;
+
+#define AV_PUSH(k, x, y) do { \
+	if (depth + 1 >= 2 * room) { ok = 0; goto analysis_done; } \
+	st[depth++] = (absval) {k, x, y}; } while (0)
+#define AV_POP(v) do { \
+	if (depth - 1 < -room) { ok = 0; goto analysis_done; } \
+	v = st[--depth]; \
+	if (depth < low) low = depth; \
+	for (int l_ = 0; l_ < n_loops; l_++) if (depth < loop_low[l_]) loop_low[l_] = depth; } while (0)
+#define IS_LOCAL(v) (((v).kind == AV_NAME) && (env->scopes[(v).a] == FUNCTION_SCOPE))
+	// a store through a name that isn't known here could hit any local, whose class then isn't known
+#define STORE_TARGET(v) do { \
+	if ((v).kind != AV_NAME) { ok = 0; goto analysis_done; } } while (0)
+#define SET_LOCAL(n, c) do { \
+	if (local_class[n] == LOCAL_UNSET) local_class[n] = (c); \
+	else if (local_class[n] != (c)) local_class[n] = LOCAL_MIXED; } while (0)
+
+	for (int i = start + 1; i <= end; i++) {
+		instr_t* ins = code + i;
+		absval v, w;
+		int callee_c = -1;
+		int callee_f = -1;
+		// code after a ^ is unreachable until its loop ends
+		if (dead && (ins->op != OP_LOOP) && (ins->op != OP_ENDLOOP) && (ins->op != OP_END)) continue;
+		switch (base_op(ins->op)) {
+			case OP_NAME: AV_PUSH(AV_NAME, ins->arg, 0); break;
+			case OP_NUMB: case OP_STNG: AV_PUSH(AV_ANY, 0, 0); break;
+			case OP_DUP:
+			{
+				int at = depth - 1 - ins->arg;
+				if (at < -room) { ok = 0; goto analysis_done; }
+				if (at < low) low = at;
+				v = st[at];
+				AV_PUSH(v.kind, v.a, v.b);
+			}
+			break;
+			case OP_POP: AV_POP(v); break;
+			case OP_ASSIGN:
+				AV_POP(v);
+				AV_POP(w);
+				STORE_TARGET(w);
+				if (!IS_LOCAL(w)) pure = 0;
+				else SET_LOCAL(w.a, (v.kind == AV_OBJT) ? v.a : LOCAL_MIXED);
+			break;
+			case OP_SELF:
+				AV_POP(w);
+				STORE_TARGET(w);
+				if (!IS_LOCAL(w)) pure = 0;
+				else SET_LOCAL(w.a, class_i);
+			break;
+			case OP_LOAD:
+				AV_POP(w);
+				if (!IS_LOCAL(w)) {
+					pure = 0;
+					AV_PUSH(AV_ANY, 0, 0);
+				}
+				else if (local_class[w.a] >= 0) AV_PUSH(AV_OBJT, local_class[w.a], 0);
+				else AV_PUSH(AV_ANY, 0, 0);
+			break;
+			case OP_NEW:
+			{
+				AV_POP(v);
+				AV_POP(w);
+				STORE_TARGET(w);
+				int c = (v.kind == AV_NAME) ? get_class_idx(*env, v.a) : -1;
+				if (IS_LOCAL(w)) SET_LOCAL(w.a, (c >= 0) ? c : LOCAL_MIXED);
+				else pure = 0;
+				if (c < 0) {
+					// whatever constructor it runs, its effect isn't known
+					pure = 0;
+					if (any_ctor(env)) {
+						ok = 0;
+						goto analysis_done;
+					}
+					break;
+				}
+				// the constructor runs like a call
+				if ((c >= STD_LIBS) && (env->c_ctor[c] >= 0)) {
+					callee_c = c;
+					callee_f = env->c_ctor[c];
+				}
+			}
+			break;
+			case OP_BIND:
+				AV_POP(v);
+				AV_POP(w);
+				if ((v.kind == AV_NAME) && IS_LOCAL(w) && (local_class[w.a] >= 0)) {
+					int c = local_class[w.a];
+					int f = get_func_idx(*env, env->c_lookup[c], v.a);
+					if (f >= 0) {
+						AV_PUSH(AV_FUNC, c, f);
+						break;
+					}
+				}
+				pure = 0;
+				AV_PUSH(AV_ANY, 0, 0);
+			break;
+			case OP_CALL:
+				AV_POP(v);
+				if (v.kind != AV_FUNC) {
+					// no telling what runs or what it does to the stack
+					pure = 0;
+					ok = 0;
+					goto analysis_done;
+				}
+				callee_c = v.a;
+				callee_f = v.b;
+			break;
+			case OP_LOOP:
+				if (env->scopes[ins->arg] != FUNCTION_SCOPE) pure = 0;
+				loop_depth[n_loops] = depth;
+				loop_low[n_loops] = depth;
+				loop_dead[n_loops] = dead;
+				n_loops++;
+			break;
+			case OP_ENDLOOP:
+				n_loops--;
+				// every iteration has to leave the stack as deep as it found it
+				if (!dead && (depth != loop_depth[n_loops])) {
+					ok = 0;
+					goto analysis_done;
+				}
+				// leaving through the head: whatever the body replaced is unknown
+				depth = loop_depth[n_loops];
+				for (int d = loop_low[n_loops]; d < depth; d++) st[d] = (absval) {AV_ANY, 0, 0};
+				dead = loop_dead[n_loops];
+			break;
+			case OP_RET:
+			case OP_END:
+				if (!dead) {
+					if (n_rets && (depth != ret_depth)) {
+						ok = 0;
+						goto analysis_done;
+					}
+					ret_depth = depth;
+					n_rets++;
+				}
+				dead = 1;
+			break;
+			default:
+			ok = 0;
+			goto analysis_done;
+		}
+
+		if (callee_c >= 0) {
+			int n_args, n_results;
+			if (callee_c < STD_LIBS) {
+				if (!std_effect(callee_c, callee_f, &n_args, &n_results)) {
+					// V O and I: not pure, and the effect depends on the arguments
+					pure = 0;
+					ok = 0;
+					goto analysis_done;
+				}
+			}
+			else if ((callee_c == class_i) && (callee_f == func_i)) {
+				// recursion: assume the effect of the returns seen so far, checked at the end
+				if (!n_rets) {
+					ok = 0;
+					goto analysis_done;
+				}
+				if (self_args < 0) {
+					self_args = -low;
+					self_results = ret_depth - low;
+				}
+				n_args = self_args;
+				n_results = self_results;
+			}
+			else {
+				func_info* callee = env->f_info + env->f_code[callee_c][callee_f];
+				if (!callee->known) {
+					pending = 1;
+					ok = 0;
+					goto analysis_done;
+				}
+				n_args = callee->n_args;
+				n_results = callee->n_results;
+				if (!callee->pure) pure = 0;
+			}
+			for (int k = 0; k < n_args; k++) AV_POP(v);
+			for (int k = 0; k < n_results; k++) AV_PUSH(AV_ANY, 0, 0);
+		}
+	}
+
+analysis_done:
+#undef AV_PUSH
+#undef AV_POP
+#undef IS_LOCAL
+#undef SET_LOCAL
+#undef STORE_TARGET
+	free(mem);
+	if (pending) return 0;
+	if (ok && n_rets && (self_args >= 0) && ((self_args != -low) || (self_results != ret_depth - low))) ok = 0;
+	fi->known = ok && n_rets;
+	fi->n_args = -low;
+	fi->n_results = ret_depth - low;
+	fi->pure = fi->known && pure;
+	return 1;
+}
+
+void analyze_env(glass_env* env) {
+	// work out env->f_info for every user function, once (verify_env needs it for every program)
+	if (env->f_info) return;
+	env->f_info = (func_info*) calloc(env->n_code + 1, sizeof (func_info));
+	int* local_class = (int*) malloc(env->n_names * sizeof (int));
+	int* prev_class = (int*) malloc(env->n_names * sizeof (int));
+	char* done = (char*) calloc(env->n_code + 1, sizeof (char));
+	if (!env->f_info || !local_class || !prev_class || !done) analysis_error("could not malloc in analyze_env");
+
+	// keep going while some function could be finished in the last round
+	int progress = 1;
+	while (progress) {
+		progress = 0;
+		for (int c = STD_LIBS; c < env->n_classes; c++) {
+			for (int f = 0; f < env->n_funcs[c]; f++) {
+				int start = env->f_code[c][f];
+				if ((start < 0) || done[start]) continue;
+				// rerun until the classes of the local names settle
+				for (int n = 0; n < env->n_names; n++) local_class[n] = LOCAL_UNSET;
+				int status;
+				do {
+					memcpy(prev_class, local_class, env->n_names * sizeof (int));
+					status = analyze_function(env, c, f, local_class);
+				} while (status && memcmp(prev_class, local_class, env->n_names * sizeof (int)));
+				if (status) {
+					done[start] = 1;
+					progress = 1;
+				}
+			}
+		}
+	}
+	// whatever is left calls into a cycle that never resolved, known stays 0
+
+	free(local_class);
+	free(prev_class);
+	free(done);
+}
+
+int name_store_class(glass_env* env, instr_t* ins) {
+	// what the name pushed by ins (an OP_NAME) is used for, going by the instructions right after:
+	// NAME_USED if it's read or the operand of ! or ., the class of the object if it's the target
+	// of a ! (LOCAL_MIXED if that isn't a class), NAME_ESCAPES if it could end up anywhere
+	// (assigned with = or $, passed on, duplicated...)
+	// a pattern is never cut by a jump target: loops are entered and left at their / and \ and
+	// calls return right after their ?
+	switch (ins[1].op) {
+		case OP_LOAD: case OP_NEW: case OP_BIND:
+			return NAME_USED;
+		default:
+		break;
+	}
+	if (base_op(ins[1].op) != OP_NAME) return NAME_ESCAPES;
+	if (ins[2].op == OP_BIND) return NAME_USED;
+	if (ins[2].op != OP_NEW) return NAME_ESCAPES;
+	int c = get_class_idx(*env, ins[1].arg);
+	return (c >= 0) ? c : LOCAL_MIXED;
+}
+
+void merge_class(int* known, int c) {
+	// add class c to what is known about a name
+	if (*known == LOCAL_UNSET) *known = c;
+	else if (*known != c) *known = LOCAL_MIXED;
+}
+
+void devirtualize_function(glass_env* env, int start, int* local_class, int* global_class, char* escaped) {
+	// rewrite the (o)f.? sites of the function at start whose o is settled
+	instr_t* code = env->code;
+	int end = start;
+	while (code[end].op != OP_END) end++;
+
+	// classes given to local names by the function's own !s
+	for (int i = start; i < end; i++) {
+		if ((base_op(code[i].op) == OP_NAME) && (env->scopes[code[i].arg] == FUNCTION_SCOPE)) {
+			local_class[code[i].arg] = LOCAL_UNSET;
+		}
+	}
+	for (int i = start; i < end; i++) {
+		if (base_op(code[i].op) != OP_NAME) continue;
+		int n = code[i].arg;
+		int c = name_store_class(env, code + i);
+		if ((c >= LOCAL_MIXED) && (env->scopes[n] == FUNCTION_SCOPE)) merge_class(local_class + n, c);
+	}
+
+	for (int i = start; i < end; i++) {
+		// only plain names (not heads fused by peephole.h) right before f.?
+		if ((code[i].op != OP_NAME) || (code[i + 1].op != OP_NAME)) continue;
+		if ((code[i + 2].op != OP_BIND) || (code[i + 3].op != OP_CALL)) continue;
+		int n = code[i].arg;
+		if (escaped[n]) continue;
+		int c = (env->scopes[n] == FUNCTION_SCOPE) ? local_class[n] : global_class[n];
+		if ((c < 0) || (c >= STD_LIBS)) continue;
+		int f = get_func_idx(*env, env->c_lookup[c], code[i + 1].arg);
+		if (f < 0) continue;
+		code[i].op = OP_CALL_STD;
+		code[i].jump = STD_CALL_JUMP(c, f);
+	}
+}
+
+void devirtualize_env(glass_env* env) {
+	// a name o can only hold an object of standard class c if every ! storing into it makes a c
+	// and the name never goes anywhere it could be stored into some other way: every push of it is
+	// read by * or used by ! or . right away (name_store_class). Object and global names take the
+	// !s of the whole program, local names those of their function. Such a name can still be unset
+	// when a call on it runs, which OP_CALL_STD checks before skipping the . and ?
+	char* escaped = (char*) calloc(env->n_names + 1, sizeof (char));
+	int* global_class = (int*) malloc((env->n_names + 1) * sizeof (int));
+	int* local_class = (int*) malloc((env->n_names + 1) * sizeof (int));
+	if (!escaped || !global_class || !local_class) analysis_error("could not malloc in devirtualize_env");
+	for (int n = 0; n < env->n_names; n++) global_class[n] = LOCAL_UNSET;
+
+	for (int i = 0; i < env->n_code; i++) {
+		if (base_op(env->code[i].op) != OP_NAME) continue;
+		int n = env->code[i].arg;
+		int c = name_store_class(env, env->code + i);
+		if (c == NAME_ESCAPES) escaped[n] = 1;
+		else if ((c >= LOCAL_MIXED) && (env->scopes[n] != FUNCTION_SCOPE)) merge_class(global_class + n, c);
+	}
+
+	for (int c = STD_LIBS; c < env->n_classes; c++) {
+		for (int f = 0; f < env->n_funcs[c]; f++) {
+			if (env->f_code[c][f] >= 0) devirtualize_function(env, env->f_code[c][f], local_class, global_class, escaped);
+		}
+	}
+
+	free(escaped);
+	free(global_class);
+	free(local_class);
+}
+
+#endif
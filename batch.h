@@ -0,0 +1,207 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "glassdefs.h"
+#include "runtime.h"
+
+// runs of one compiled program on many inputs at once (glass --batch, glass_run_batch)
+// every worker thread gets its own env (batch_env): a copy of the compiled one sharing all of its
+// tables read-only (names, scopes, lookups, tokens, code, literals, shapes, f_info), with its own
+// global_vars, inline caches (the only tables the runtime writes), frame stack, JIT and memo
+// table. Each run gets a fresh heap, globals and input and a trap (see glassdefs.h), so a runtime
+// error ends just that run. Workers take the next job under a lock and never touch each other's
+// state otherwise, so runs scale with the cores. Jobs finish in any order, batch_wait lets the
+// caller take the results in job order
+
+typedef struct batch_job batch_job;
+typedef struct batch_state batch_state;
+
+struct batch_job {
+	int    fd;     // input of the run, -1 to use read (and an empty input if that's NULL too)
+	long (*read)(void* user, char* buff, size_t len);
+	void*  read_user;
+	void (*write)(void* user, const char* s, size_t len); // output of the run, NULL for stdout
+	void*  write_user;
+	int    failed;
+	char   message[TRAP_MESSAGE_SIZE]; // the error that ended the run, if it failed
+	int    done;
+};
+
+struct batch_state {
+	glass_env* shared;  // the compiled program
+	batch_job* jobs;
+	int        n_jobs;
+	int        next;    // next job to hand out
+	size_t     gc_heap; // see gc_init
+	pthread_t* threads;
+	int        n_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t  done; // a job finished
+};
+
+void batch_error(char* error_text);
+
+void batch_env(glass_env* env, glass_env* shared);
+void batch_env_free(glass_env* env);
+int batch_run(glass_env* env, batch_job* job, size_t gc_heap);
+void* batch_worker(void* arg);
+void batch_start(batch_state* b, glass_env* shared, batch_job* jobs, int n_jobs, int n_threads, size_t gc_heap);
+void batch_wait(batch_state* b, int i);
+void batch_finish(batch_state* b);
+
+void batch_error(char* error_text) {
+	trap_error("Error in batch.h: ", error_text);
+	fprintf(stderr, "Error in batch.h: %s\n", error_text);
+	exit(1);
+}
+
+void batch_env(glass_env* env, glass_env* shared) {
+	// a worker's env for running shared's program, with a JIT and memo table if shared has them
+	*env = *shared;
+	env->global_vars = (val*) calloc(shared->n_names + 1, sizeof (val)); // all NO_VAL
+	env->ics = (ic_t*) malloc((shared->n_ics + 1) * sizeof (ic_t));
+	if (!env->global_vars || !env->ics) batch_error("could not malloc worker state in batch_env");
+	memcpy(env->ics, shared->ics, shared->n_ics * sizeof (ic_t));
+	env->frame_top = NULL;
+	env->frame_spare = NULL;
+	env->frame = NULL;
+	env->gc = NULL;
+	env->prof = NULL;
+	env->trace = NULL;
+	env->out = NULL;
+	env->in = NULL;
+	env->vars = NULL;
+	env->jit = NULL;
+	env->memo = NULL;
+	if (shared->jit) jit_init(env);
+	if (shared->memo) memo_init(env);
+}
+
+void batch_env_free(glass_env* env) {
+	// what batch_env made, the shared tables stay
+	free(env->global_vars);
+	free(env->ics);
+	while (env->frame_top) {
+		frame_chunk* prev = env->frame_top->prev;
+		free(env->frame_top);
+		env->frame_top = prev;
+	}
+	free(env->frame_spare);
+	env->frame_spare = NULL;
+	jit_free(env);
+	memo_free(env);
+}
+
+int batch_run(glass_env* env, batch_job* job, size_t gc_heap) {
+	// run M.m once on job's input, returns 0 and fills out job->message if it fails
+	// env's per-run state is set up here and released before returning, whichever way the run ends
+	// the stack is only reached through stack_p, which a longjmp leaves alone (it's volatile)
+	v_list stack = {-1, 0, NULL};
+	v_list* volatile stack_p = &stack;
+	glass_trap trap;
+	glass_trap* prev_trap = trap_live;
+	int ok = !setjmp(trap.jump);
+	if (ok) {
+		trap_live = &trap;
+		for (int i = 0; i < env->n_names; i++) env->global_vars[i] = no_val();
+		gc_init(env, gc_heap);
+		if (job->write) out_init_callback(env, job->write, job->write_user);
+		else env->out = out_new(STDOUT_FILENO, 0);
+		if (job->fd >= 0) in_init(env, job->fd);
+		else in_init_callback(env, job->read, job->read_user);
+		*stack_p = init_stack();
+		env->gc->stack = stack_p;
+
+		int main_idx = get_class_idx(*env, find_name(env, "M"));
+		int m_idx = get_func_idx(*env, find_name(env, "M"), find_name(env, "m"));
+		if (m_idx < 0) runtime_error("cannot find M.m");
+		object_t* main_obj = init_object(env, main_idx, stack_p);
+		execute_function(env, (func_t) {main_idx, m_idx, main_obj}, stack_p);
+	}
+	else {
+		memcpy(job->message, trap.message, TRAP_MESSAGE_SIZE);
+		// the frames of the failed run are still there, and maybe a memoized call without its result
+		while (env->frame_top) {
+			frame_chunk* prev = env->frame_top->prev;
+			free(env->frame_top);
+			env->frame_top = prev;
+		}
+		env->frame = NULL;
+		if (env->memo) {
+			memo_free(env);
+			memo_init(env);
+		}
+	}
+	trap_live = prev_trap;
+
+	out_free(env);
+	in_free(env);
+	vars_free(env);
+	gc_free(env);
+	free(stack_p->vs);
+	job->failed = !ok;
+	return ok;
+}
+
+void* batch_worker(void* arg) {
+	batch_state* b = (batch_state*) arg;
+	glass_env env;
+	batch_env(&env, b->shared);
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		int i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->n_jobs) break;
+
+		batch_run(&env, b->jobs + i, b->gc_heap);
+		pthread_mutex_lock(&b->lock);
+		b->jobs[i].done = 1;
+		pthread_cond_broadcast(&b->done);
+		pthread_mutex_unlock(&b->lock);
+	}
+	batch_env_free(&env);
+	return NULL;
+}
+
+void batch_start(batch_state* b, glass_env* shared, batch_job* jobs, int n_jobs, int n_threads, size_t gc_heap) {
+	// start running jobs on n_threads threads (no more than there are jobs), returns right away
+	// shared must stay as it is until batch_finish
+	if (n_threads > n_jobs) n_threads = n_jobs;
+	if (n_threads < 1) n_threads = 1;
+	b->shared = shared;
+	b->jobs = jobs;
+	b->n_jobs = n_jobs;
+	b->next = 0;
+	b->gc_heap = gc_heap;
+	b->n_threads = 0;
+	for (int i = 0; i < n_jobs; i++) jobs[i].done = 0;
+	b->threads = (pthread_t*) malloc(n_threads * sizeof (pthread_t));
+	if (!b->threads) batch_error("could not malloc threads in batch_start");
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->done, NULL);
+	for (int i = 0; i < n_threads; i++) {
+		if (pthread_create(b->threads + i, NULL, batch_worker, b)) break;
+		b->n_threads++;
+	}
+	if (!b->n_threads) batch_error("could not start any worker threads");
+}
+
+void batch_wait(batch_state* b, int i) {
+	// wait for job i to finish
+	pthread_mutex_lock(&b->lock);
+	while (!b->jobs[i].done) pthread_cond_wait(&b->done, &b->lock);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void batch_finish(batch_state* b) {
+	// wait for all the jobs
+	for (int i = 0; i < b->n_threads; i++) pthread_join(b->threads[i], NULL);
+	free(b->threads);
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->done);
+}
+
+#endif
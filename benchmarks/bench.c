@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// benchmark harness behind make bench
+// usage: bench [-n runs] glass prog.gl ...
+// each program is run once under glass --profile to count the tokens it executes, then timed over
+// runs runs with its output thrown away. One JSON object per program goes to stdout:
+// {"workload": "arith", "runs": 3, "wall_s": 0.4123, "tokens": 22003024, "tokens_per_s": 53365570,
+//  "peak_rss_kb": 1736, "ok": true}
+// wall_s is the fastest run, peak_rss_kb the largest. ok is false if a run died on a signal or
+// the profile never got written (glass stopped on an error)
+
+#define BENCH_RUNS 3
+
+typedef struct run_t run_t;
+
+struct run_t {
+	double wall_s;
+	long   peak_rss_kb;
+	int    ok;
+};
+
+void bench_error(char* error_text) {
+	fprintf(stderr, "Error in bench.c: %s\n", error_text);
+	exit(1);
+}
+
+double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+run_t run_glass(char** args) {
+	// run args[0] with args, stdout to /dev/null, and measure it
+	run_t res = {0, 0, 0};
+	double t0 = now_s();
+	pid_t pid = fork();
+	if (pid < 0) bench_error("could not fork");
+	if (!pid) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+		execv(args[0], args);
+		_exit(127);
+	}
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0) bench_error("wait4 failed");
+	res.wall_s = now_s() - t0;
+	res.peak_rss_kb = usage.ru_maxrss; // kilobytes on linux
+	// glass exits with 1 after a normal run and 0 after some errors, so only signals tell
+	res.ok = WIFEXITED(status) && (WEXITSTATUS(status) != 127);
+	return res;
+}
+
+long count_tokens(char* glass, char* prog) {
+	// tokens executed by prog, from the first line of its profile, -1 if there is none
+	char path[] = "/tmp/glass_bench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) bench_error("could not make a temporary file");
+	close(fd);
+	char* args[] = {glass, "--profile", path, prog, NULL};
+	run_glass(args);
+
+	long tokens = -1;
+	FILE* f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "glass profile: %ld tokens executed", &tokens) != 1) tokens = -1;
+		fclose(f);
+	}
+	char folded[sizeof path + 8];
+	snprintf(folded, sizeof folded, "%s.folded", path);
+	remove(path);
+	remove(folded);
+	return tokens;
+}
+
+void workload_name(char* prog, char* buf, size_t size) {
+	// file name of prog without directories or .gl
+	char* base = strrchr(prog, '/');
+	base = base ? base + 1 : prog;
+	snprintf(buf, size, "%s", base);
+	size_t len = strlen(buf);
+	if ((len > 3) && !strcmp(buf + len - 3, ".gl")) buf[len - 3] = '\0';
+}
+
+int main(int argc, char* argv[]) {
+	int runs = BENCH_RUNS;
+	int i = 1;
+	if ((i + 1 < argc) && !strcmp(argv[i], "-n")) {
+		runs = atoi(argv[i + 1]);
+		i += 2;
+	}
+	if ((runs < 1) || (i + 1 >= argc)) bench_error("usage: bench [-n runs] glass prog.gl ...");
+	char* glass = argv[i++];
+
+	for (; i < argc; i++) {
+		char name[256];
+		workload_name(argv[i], name, sizeof name);
+		long tokens = count_tokens(glass, argv[i]);
+
+		char* args[] = {glass, argv[i], NULL};
+		run_t best = {0, 0, tokens >= 0};
+		for (int r = 0; r < runs; r++) {
+			run_t res = run_glass(args);
+			if (!r || (res.wall_s < best.wall_s)) best.wall_s = res.wall_s;
+			if (res.peak_rss_kb > best.peak_rss_kb) best.peak_rss_kb = res.peak_rss_kb;
+			if (!res.ok) best.ok = 0;
+		}
+
+		printf("{\"workload\": \"%s\", \"runs\": %d, \"wall_s\": %.4f, \"tokens\": %ld, \"tokens_per_s\": %.0f, \"peak_rss_kb\": %ld, \"ok\": %s}\n",
+			name, runs, best.wall_s, tokens, (tokens > 0) ? tokens / best.wall_s : 0.0,
+			best.peak_rss_kb, best.ok ? "true" : "false");
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// writes a synthetic Glass program to stdout, for measuring how parsing and loading scale
+// usage: gen_large n_classes n_funcs > large.gl
+// class (Cc) gets the functions (f0) .. (fk), function f of class c adds (c * n_funcs + f) % 1000
+// to the global (Tot). M.m makes an object of every class, calls each of its functions once and
+// prints (Tot), so most of the run is spent getting the program ready
+
+void gen_error(char* error_text) {
+	fprintf(stderr, "Error in gen_large.c: %s\n", error_text);
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 3) gen_error("usage: gen_large n_classes n_funcs");
+	long n_classes = strtol(argv[1], NULL, 10);
+	long n_funcs = strtol(argv[2], NULL, 10);
+	if ((n_classes < 1) || (n_funcs < 1)) gen_error("need at least one class and one function");
+
+	long n = n_classes * n_funcs;
+	long total = 0;
+	for (long i = 0; i < n; i++) total += i % 1000;
+	printf("'synthetic program: %ld classes of %ld functions'\n", n_classes, n_funcs);
+	printf("'prints %ld'\n", total);
+	for (long c = 0; c < n_classes; c++) {
+		printf("{(C%ld)\n", c);
+		for (long f = 0; f < n_funcs; f++) {
+			printf("\t[(f%ld)(_a)A!(Tot)(Tot)*<%ld>(_a)a.?=]\n", f, (c * n_funcs + f) % 1000);
+		}
+		printf("}\n");
+	}
+
+	printf("{M\n\t[m\n\t\t(_o)O!\n\t\t(Tot)<0>=\n");
+	for (long c = 0; c < n_classes; c++) {
+		printf("\t\t(_x)(C%ld)!", c);
+		for (long f = 0; f < n_funcs; f++) printf("(_x)(f%ld).?", f);
+		printf("\n");
+	}
+	printf("\t\t(Tot)*(_o)(on).?\n\t]\n}\n");
+	return 0;
+}
@@ -0,0 +1,215 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+#include "peephole.h"
+#include "analysis.h"
+#include "verify.h"
+
+// lowers the token stream of each user function into bytecode (env->code)
+// operands are decoded once here and loop jumps are resolved to absolute instruction indices,
+// so the interpreter never has to look back at env->tokens or scan forward for a loop end
+// . and ! get the index of their inline cache (env->ics) as operand
+// a ? right before a return is marked as a tail call
+// the finished bytecode goes through the peephole pass (peephole.h) and has calls on standard
+// objects devirtualized (analysis.h), then verify.h marks the runtime checks it can prove redundant
+// the names used in the bodies also give the frame layout of each function and the object
+// layout (env->shapes) of each class
+
+void compile_error(char* error_text);
+
+int count_tokens(token_t* toks);
+void add_sorted(int* names, int* n, int name);
+void add_local(glass_env* env, instr_t* enter, int name);
+void add_field(glass_env* env, shape_t* shape, int name);
+void mark_tail_call(glass_env* env, int c_i);
+int compile_function(glass_env* env, int t_i, int c_i, int ln_i, shape_t* shape);
+void compile_env(glass_env* env);
+
+void compile_error(char* error_text) {
+	trap_error("Error in compiler.h: ", error_text);
+	fprintf(stderr, "Error in compiler.h: %s\n", error_text);
+	exit(1);
+}
+
+int count_tokens(token_t* toks) {
+	// number of tokens before the terminating NO_TOKEN
+	int n = 0;
+	while (toks[n].type != NO_TOKEN) n++;
+	return n;
+}
+
+void add_sorted(int* names, int* n, int name) {
+	// insert name into the sorted array names of length *n unless it is already there
+	int i = *n;
+	while ((i > 0) && (names[i - 1] > name)) i--;
+	if ((i > 0) && (names[i - 1] == name)) return;
+	memmove(names + i + 1, names + i, (*n - i) * sizeof (int));
+	names[i] = name;
+	(*n)++;
+}
+
+void add_local(glass_env* env, instr_t* enter, int name) {
+	// record a function-scope name in the frame layout of the function headed by enter
+	// the layout is the sorted tail of env->local_names, so the slot of a name is its rank
+	if (env->scopes[name] != FUNCTION_SCOPE) return;
+	add_sorted(env->local_names + enter->jump, &enter->arg, name);
+}
+
+void add_field(glass_env* env, shape_t* shape, int name) {
+	// record an object-scope name in the object layout of the class being compiled
+	if (env->scopes[name] != OBJECT_SCOPE) return;
+	add_sorted(shape->names, &shape->n_fields, name);
+}
+
+void mark_tail_call(glass_env* env, int c_i) {
+	// instruction c_i returns from the function. A ? right before it is a tail call (arg 1):
+	// the caller's frame is dead once the callee starts, so the callee can take its place
+	// (a return is never a jump target, loop exits land after an OP_ENDLOOP)
+	if (env->code[c_i - 1].op == OP_CALL) env->code[c_i - 1].arg = 1;
+}
+
+int compile_function(glass_env* env, int t_i, int c_i, int ln_i, shape_t* shape) {
+	// compile the function body starting at token t_i into env->code, starting at instruction c_i
+	// returns the index of the instruction after the function's OP_END
+	// the first instruction is OP_ENTER, its local names go to env->local_names from ln_i on
+	// object names used in the body are added to shape, the layout of the function's class
+	int loop_stack[MAX_LOOP_DEPTH]; // instruction indices of the enclosing OP_LOOPs
+	int depth = 0;
+
+	instr_t* enter = env->code + c_i;
+	*enter = (instr_t) {OP_ENTER, 0, 0, ln_i, t_i};
+	c_i++;
+
+	while (1) {
+		token_t t = env->tokens[t_i];
+		instr_t* ins = env->code + c_i;
+		*ins = (instr_t) {OP_END, 0, 0, -1, t_i};
+
+		switch (t.type) {
+			case NAME_IDX:
+				ins->op = OP_NAME;
+				ins->arg = t.data;
+				add_local(env, enter, t.data);
+				add_field(env, shape, t.data);
+			break;
+			case NUMBER:
+				ins->op = OP_NUMB;
+				ins->arg = t.data;
+			break;
+			case STNG_IDX:
+				ins->op = OP_STNG;
+				ins->arg = t.data;
+			break;
+			case STCK_IDX:
+				ins->op = OP_DUP;
+				ins->arg = t.data;
+			break;
+			case ASCII:
+				switch (t.data) {
+					case ',': ins->op = OP_POP; break;
+					case '^':
+						ins->op = OP_RET;
+						mark_tail_call(env, c_i);
+					break;
+					case '=': ins->op = OP_ASSIGN; break;
+					case '!':
+						ins->op = OP_NEW;
+						ins->arg = env->n_ics++;
+					break;
+					case '.':
+						ins->op = OP_BIND;
+						ins->arg = env->n_ics++;
+					break;
+					case '?': ins->op = OP_CALL; break;
+					case '*': ins->op = OP_LOAD; break;
+					case '$': ins->op = OP_SELF; break;
+					case '/':
+						// the loop condition name is folded into the loop instruction
+						t_i++;
+						if (env->tokens[t_i].type != NAME_IDX) compile_error("/ must be followed by name");
+						if (depth >= MAX_LOOP_DEPTH) compile_error("MAX_LOOP_DEPTH exceeded");
+						ins->op = OP_LOOP;
+						ins->arg = env->tokens[t_i].data;
+						add_local(env, enter, ins->arg);
+						add_field(env, shape, ins->arg);
+						loop_stack[depth++] = c_i;
+					break;
+					case '\\':
+						if (depth <= 0) compile_error("\\ without matching /");
+						depth--;
+						ins->op = OP_ENDLOOP;
+						ins->jump = loop_stack[depth];
+						// a false condition exits to the instruction after this one
+						env->code[loop_stack[depth]].jump = c_i + 1;
+					break;
+					case ']':
+						if (depth) compile_error("unterminated loop in function");
+						mark_tail_call(env, c_i);
+						return c_i + 1;
+					default:
+					compile_error("bad ascii token in function body");
+				}
+			break;
+			default:
+			compile_error("function body runs off the end of the program");
+		}
+		t_i++;
+		c_i++;
+	}
+}
+
+void compile_env(glass_env* env) {
+	// compile every user-defined function, fill out env->f_code
+	// instructions never outnumber tokens (/name is folded, OP_ENTER stands in for [name), so the
+	// token count bounds the code size. The same holds for local and object names, which come from
+	// name tokens
+	int n_toks = count_tokens(env->tokens);
+	env->code = (instr_t*) malloc((n_toks + 1) * sizeof (instr_t));
+	env->local_names = (int*) malloc((n_toks + 1) * sizeof (int));
+	env->field_names = (int*) malloc((n_toks + 1) * sizeof (int));
+	env->shapes = (shape_t*) calloc(env->n_classes + 1, sizeof (shape_t));
+	if (!env->code || !env->local_names || !env->field_names || !env->shapes) {
+		compile_error("could not malloc code in compile_env");
+	}
+
+	int c_i = 0;
+	int ln_i = 0;
+	int fn_i = 0;
+	for (int c = 0; c < env->n_classes; c++) {
+		shape_t* shape = env->shapes + c;
+		shape->names = env->field_names + fn_i;
+		for (int f = 0; f < env->n_funcs[c]; f++) {
+			if (env->f_locs[c][f] < 0) {
+				// standard library function, nothing to compile
+				env->f_code[c][f] = -1;
+				continue;
+			}
+			env->f_code[c][f] = c_i;
+			c_i = compile_function(env, env->f_locs[c][f], c_i, ln_i, shape);
+			ln_i += env->code[env->f_code[c][f]].arg;
+		}
+		fn_i += shape->n_fields;
+	}
+	env->n_code = c_i;
+
+	// every . and ! got an inline cache index above
+	env->ics = (ic_t*) calloc(env->n_ics + 1, sizeof (ic_t));
+	if (!env->ics) compile_error("could not malloc inline caches in compile_env");
+
+	// constructors are looked up once per class instead of on every !
+	int ctor_name = find_name(env, "c__");
+	env->c_ctor = (int*) malloc((env->n_classes + 1) * sizeof (int));
+	if (!env->c_ctor) compile_error("could not malloc c_ctor in compile_env");
+	for (int c = 0; c < env->n_classes; c++) {
+		env->c_ctor[c] = (ctor_name >= 0) ? get_func_idx(*env, env->c_lookup[c], ctor_name) : -1;
+	}
+
+	peephole_env(env);
+	devirtualize_env(env);
+	verify_env(env);
+}
+
+#endif
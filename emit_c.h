@@ -0,0 +1,964 @@
+#ifndef EMIT_C_H
+#define EMIT_C_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+
+// ahead-of-time translation of a parsed program to C (glass --emit-c prog.gl > prog.c)
+// every user function becomes one C function working on a heap frame that holds its locals. Like
+// the interpreter's, Glass calls never nest on the C stack: a call pushes the callee's frame and
+// returns it to the loop in run(), which runs the function of whichever frame is on top, and a
+// return pops the frame, after which the caller picks up where its pc says. A call right before
+// ] or ^ replaces the caller's frame instead (a tail call), so tail recursion runs in constant
+// space. Inside a straight-line stretch of tokens the
+// value stack is tracked symbolically, so literals and intermediate results live in C
+// temporaries and only get pushed to the real stack at calls, loop edges and returns.
+// function-scope names become fields of the function's frame struct, object-scope names fields
+// of a per-class struct and globals a static array. Standard library calls on variables that
+// are only ever assigned a builtin object (e.g. (_a)A!) are emitted inline.
+
+#define EMIT_MAX_SYMS 256
+#define EMIT_EXPR 160 // room for the C expression of one stack entry or name
+
+enum sym_kind {SYM_NAME, SYM_NUMB, SYM_STNG, SYM_TEMP, SYM_BOUND};
+
+typedef struct sym_t sym_t;
+typedef struct emitter emitter;
+
+struct sym_t {
+	enum sym_kind kind;
+	int a; // name index, number, literal index or temp id
+	int b; // SYM_BOUND: class index
+	int c; // SYM_BOUND: function index
+};
+
+struct emitter {
+	glass_env* env;
+	FILE* out;
+	int dry;          // dry run: collect facts about locals, emit nothing
+	int class_i;      // class of the function being emitted
+	int temps;        // temp counter within the function
+	int indent;
+	int n_syms;
+	sym_t syms[EMIT_MAX_SYMS];
+	int* local_class; // local_class[n] = class index if local name n only ever holds that class
+	                  // -1 unknown/never assigned, -2 conflicting assignments
+	char* local_used; // local_used[n] = 1 if local name n appears in the function
+	char* field_used; // field_used[n] = 1 if object name n appears in any function of the class
+	int dynamic;      // function resolves names that are not known at translation time
+	int new_dynamic;  // some function has a ! resolved at run time, so the program needs new_dynamic
+	int func_k;       // number of the function being emitted, see func_base
+	int* func_base;   // func_base[c] + f numbers function f of user class c (fn_0, fn_1...)
+	int* ctor;        // ctor[c] is the number of class c's constructor, -1 if it has none
+	int rets;         // return points in the function so far, where its pc resumes it
+};
+
+void emit_error(char* error_text);
+
+void emit_line(emitter* e, const char* fmt, ...);
+void emit_prelude(glass_env* env, FILE* out);
+int emit_class_has_func(glass_env* env, int c);
+void emit_class_fields(glass_env* env, int c, char* used);
+void emit_sym_expr(sym_t s, char* buff);
+void emit_flush(emitter* e);
+void emit_spush(emitter* e, sym_t s);
+sym_t emit_spop(emitter* e, char* buff);
+int emit_new_temp(emitter* e, const char* expr);
+void emit_name_ref(emitter* e, int name, char* buff);
+void emit_dynamic_ref(emitter* e, const char* name_expr, char* buff);
+void emit_std_call(emitter* e, int c, int f);
+void emit_call(emitter* e, const char* call, const char* args, int tail);
+void emit_function_body(emitter* e, int t_i);
+void emit_c(glass_env* env, FILE* out);
+
+void emit_error(char* error_text) {
+	fprintf(stderr, "Error in emit_c.h: %s\n", error_text);
+	exit(1);
+}
+
+#include <stdarg.h>
+
+void emit_line(emitter* e, const char* fmt, ...) {
+	// print one indented line of output (nothing in a dry run)
+	if (e->dry) return;
+	for (int i = 0; i < e->indent; i++) fputc('\t', e->out);
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(e->out, fmt, args);
+	va_end(args);
+	fputc('\n', e->out);
+}
+
+// runtime support shared by every translated program. Mirrors runtime.h closely enough that
+// error messages and output formatting match the interpreter.
+static const char* emit_runtime_src[] = {
+	"#include <stdio.h>",
+	"#include <stdlib.h>",
+	"#include <string.h>",
+	"#include <stddef.h>",
+	"",
+	"#define MAYBE_UNUSED __attribute__((unused)) // generic helpers not every program calls",
+	"enum val_type {NO_VAL=0, FUNC, OBJT, NUMB, NAME, STNG};",
+	"typedef struct obj_t obj_t;",
+	"typedef struct val val;",
+	"struct val {",
+	"\tenum val_type type;",
+	"\tunion {",
+	"\t\tint numb;",
+	"\t\tint name;",
+	"\t\tconst char* stng;",
+	"\t\tobj_t* objt;",
+	"\t\tstruct {int c, f; obj_t* o;} func;",
+	"\t};",
+	"};",
+	"struct obj_t {",
+	"\tint class_i;",
+	"\tstruct extra* extra; // object names outside the class's struct, see field_ref",
+	"};",
+	"",
+	"static val* g_stack;",
+	"static int g_sp, g_cap;",
+	"",
+	"static void fail(const char* msg) {",
+	"\tfflush(stdout); // the program's output so far comes before the error",
+	"\tfprintf(stderr, \"runtime error:\\n%s\\n\", msg);",
+	"\texit(1);",
+	"}",
+	"static void push(val v) {",
+	"\tif (g_sp == g_cap) {",
+	"\t\tg_cap = g_cap ? 2 * g_cap : 1024;",
+	"\t\tg_stack = (val*) realloc(g_stack, g_cap * sizeof (val));",
+	"\t\tif (!g_stack) fail(\"could not realloc stack memory in push\");",
+	"\t}",
+	"\tg_stack[g_sp++] = v;",
+	"}",
+	"static val pop(void) {",
+	"\tif (g_sp <= 0) fail(\"cannot pop from empty stack\");",
+	"\treturn g_stack[--g_sp];",
+	"}",
+	"MAYBE_UNUSED static val peek(int i) {",
+	"\tif (g_sp <= i) fail(\"duplicate call overshoots stack\");",
+	"\treturn g_stack[g_sp - 1 - i];",
+	"}",
+	"static val mk_numb(int n) { val v; v.type = NUMB; v.numb = n; return v; }",
+	"MAYBE_UNUSED static val mk_name(int n) { val v; v.type = NAME; v.name = n; return v; }",
+	"static val mk_stng(const char* s) { val v; v.type = STNG; v.stng = s; return v; }",
+	"static val mk_objt(obj_t* o) { val v; v.type = OBJT; v.objt = o; return v; }",
+	"static val mk_func(int c, int f, obj_t* o) {",
+	"\tval v; v.type = FUNC; v.func.c = c; v.func.f = f; v.func.o = o; return v;",
+	"}",
+	"static int as_numb(val v, const char* msg) { if (v.type != NUMB) fail(msg); return v.numb; }",
+	"static const char* as_stng(val v, const char* msg) { if (v.type != STNG) fail(msg); return v.stng; }",
+	"MAYBE_UNUSED static int as_name(val v, const char* msg) { if (v.type != NAME) fail(msg); return v.name; }",
+	"static obj_t* as_objt(val v) {",
+	"\tif (v.type != OBJT) fail(\"first . operand must be name of object variable\");",
+	"\treturn v.objt;",
+	"}",
+	"MAYBE_UNUSED static val defined(val v) { if (v.type == NO_VAL) fail(\"variable undefined in the current scope\"); return v; }",
+	"",
+	"// names a frame or object has no slot for, because they only reach its functions at run time",
+	"typedef struct extra extra;",
+	"struct extra {",
+	"\textra* next;",
+	"\tint name;",
+	"\tval v;",
+	"};",
+	"static val* extra_ref(extra** list, int n) {",
+	"\tfor (extra* x = *list; x; x = x->next) if (x->name == n) return &x->v;",
+	"\textra* x = (extra*) calloc(1, sizeof (extra));",
+	"\tif (!x) fail(\"could not malloc extra name\");",
+	"\tx->next = *list;",
+	"\tx->name = n;",
+	"\t*list = x;",
+	"\treturn &x->v;",
+	"}",
+	"static void extra_free(extra** list) {",
+	"\twhile (*list) {",
+	"\t\textra* x = *list;",
+	"\t\t*list = x->next;",
+	"\t\tfree(x);",
+	"\t}",
+	"}",
+	"",
+	"// call frames of user functions, each function's struct adds its locals after hdr",
+	"typedef struct frame frame;",
+	"struct frame {",
+	"\tframe* prev;",
+	"\tobj_t* self;",
+	"\tint k;  // number of the function",
+	"\tint pc; // return point it goes on at, 0 to start",
+	"\tframe** pool; // popped frames of the same function, kept for reuse",
+	"\textra* extra; // local names outside the function's struct",
+	"};",
+	"static frame* frame_push(frame** pool, frame* prev, obj_t* self, size_t size, int k) {",
+	"\tframe* fr = *pool;",
+	"\tif (fr) {",
+	"\t\t*pool = fr->prev;",
+	"\t\tmemset(fr, 0, size);",
+	"\t}",
+	"\telse if (!(fr = (frame*) calloc(1, size))) fail(\"could not malloc frame\");",
+	"\tfr->prev = prev;",
+	"\tfr->self = self;",
+	"\tfr->k = k;",
+	"\tfr->pool = pool;",
+	"\treturn fr;",
+	"}",
+	"static frame* frame_pop(frame* fr) {",
+	"\tframe* prev = fr->prev;",
+	"\textra_free(&fr->extra);",
+	"\tfr->prev = *fr->pool;",
+	"\t*fr->pool = fr;",
+	"\treturn prev;",
+	"}",
+	"static char* new_str(size_t len) {",
+	"\tchar* s = (char*) malloc(len + 1);",
+	"\tif (!s) fail(\"could not malloc string\");",
+	"\ts[len] = '\\0';",
+	"\treturn s;",
+	"}",
+	"",
+	"// S class kernels",
+	"static val s_index(val x, val y) {",
+	"\tconst char* s = as_stng(x, \"string index operands must be string and number\");",
+	"\tint i = as_numb(y, \"string index operands must be string and number\");",
+	"\tchar* r = new_str(1);",
+	"\tr[0] = s[i];",
+	"\treturn mk_stng(r);",
+	"}",
+	"static val s_replace(val x, val y, val z) {",
+	"\tconst char* msg = \"character replace operands must be string, number, string\";",
+	"\tconst char* s = as_stng(x, msg);",
+	"\tint i = as_numb(y, msg);",
+	"\tconst char* c = as_stng(z, msg);",
+	"\tif ((int) strlen(s) <= i) fail(\"character replace index overshoot\");",
+	"\tchar* r = new_str(strlen(s));",
+	"\tstrcpy(r, s);",
+	"\tr[i] = c[0];",
+	"\treturn mk_stng(r);",
+	"}",
+	"static val s_concat(val x, val y) {",
+	"\tconst char* msg = \"string concat operands must be string and string\";",
+	"\tconst char* a = as_stng(x, msg);",
+	"\tconst char* b = as_stng(y, msg);",
+	"\tsize_t la = strlen(a), lb = strlen(b);",
+	"\tchar* r = new_str(la + lb);",
+	"\tmemcpy(r, a, la);",
+	"\tmemcpy(r + la, b, lb);",
+	"\treturn mk_stng(r);",
+	"}",
+	"static void s_split(val x, val y, val* ra, val* rb) {",
+	"\tconst char* s = as_stng(x, \"string split must be string and number\");",
+	"\tint i = as_numb(y, \"string split must be string and number\");",
+	"\tif ((i < 0) || (i > (int) strlen(s))) fail(\"string split index out of range\");",
+	"\tchar* a = new_str(i);",
+	"\tstrncpy(a, s, i);",
+	"\tchar* b = new_str(strlen(s + i));",
+	"\tstrcpy(b, s + i);",
+	"\t*ra = mk_stng(a);",
+	"\t*rb = mk_stng(b);",
+	"}",
+	"static val s_chr(val x) {",
+	"\tint n = as_numb(x, \"number to character operand must be number\");",
+	"\tif ((n < 0) || (n > 255)) fail(\"0 < x < 256 for number to character\");",
+	"\tchar* r = new_str(1);",
+	"\tr[0] = (char) n;",
+	"\treturn mk_stng(r);",
+	"}",
+	"",
+	"// O class kernels",
+	"static const char* NAMES[];",
+	"static void o_out(val x) {",
+	"\tif (x.type == NAME) printf(\"%s\\n\", NAMES[x.name]);",
+	"\telse if (x.type == STNG) printf(\"%s\", x.stng);",
+	"\telse fail(\"output operand must be string or name\");",
+	"}",
+	"static void o_outn(val x) {",
+	"\tprintf(\"%d\\n\", as_numb(x, \"output number operand must be number\"));",
+	"}",
+	"",
+	"// I class kernels, stdio does the buffering",
+	"static val i_line(void) {",
+	"\tstatic char* buff = NULL;",
+	"\tstatic size_t cap = 0;",
+	"\tsize_t len = 0;",
+	"\tint ch;",
+	"\twhile ((ch = getchar()) != EOF) {",
+	"\t\tif (len == cap) {",
+	"\t\t\tcap = cap ? 2 * cap : 256;",
+	"\t\t\tbuff = (char*) realloc(buff, cap);",
+	"\t\t\tif (!buff) fail(\"could not malloc input line\");",
+	"\t\t}",
+	"\t\tbuff[len++] = (char) ch;",
+	"\t\tif (ch == '\\n') break;",
+	"\t}",
+	"\tif (!len) return mk_stng(\"\");",
+	"\tchar* r = new_str(len);",
+	"\tmemcpy(r, buff, len);",
+	"\treturn mk_stng(r);",
+	"}",
+	"static val i_char(void) {",
+	"\tint ch = getchar();",
+	"\tif (ch == EOF) return mk_stng(\"\");",
+	"\tchar* r = new_str(1);",
+	"\tr[0] = (char) ch;",
+	"\treturn mk_stng(r);",
+	"}",
+	"static val i_end(void) {",
+	"\tint ch = getchar();",
+	"\tif (ch == EOF) return mk_numb(1);",
+	"\tungetc(ch, stdin);",
+	"\treturn mk_numb(0);",
+	"}",
+	"",
+	NULL
+};
+
+void emit_prelude(glass_env* env, FILE* out) {
+	// runtime support code plus the name and scope tables of the program
+	for (int i = 0; emit_runtime_src[i]; i++) fprintf(out, "%s\n", emit_runtime_src[i]);
+
+	int n_names = env->n_names;
+
+	fprintf(out, "#define N_NAMES %d\n", n_names);
+	fprintf(out, "static const char* NAMES[] = {");
+	for (int i = 0; i < n_names; i++) {
+		fputc('"', out);
+		for (char* c = env->names[i]; *c; c++) {
+			if ((*c == '"') || (*c == '\\')) fputc('\\', out);
+			fputc(*c, out);
+		}
+		fprintf(out, "\",%s", ((i % 8) == 7) ? "\n\t" : " ");
+	}
+	fprintf(out, "NULL};\n");
+	fprintf(out, "static const char SCOPES[] = {");
+	for (int i = 0; i < n_names; i++) fprintf(out, "%d,", env->scopes[i]);
+	fprintf(out, "0};\n");
+	fprintf(out, "static val G[N_NAMES];\n\n");
+}
+
+int emit_class_has_func(glass_env* env, int c) {
+	// number of functions defined for class c
+	return env->n_funcs[c];
+}
+
+void emit_class_fields(glass_env* env, int c, char* used) {
+	// used[n] = 1 for every object name mentioned in the functions of user class c
+	memset(used, 0, env->n_names);
+	for (int f = 0; f < emit_class_has_func(env, c); f++) {
+		for (int t_i = env->f_locs[c][f]; !((env->tokens[t_i].type == ASCII) && (env->tokens[t_i].data == ']')); t_i++) {
+			token_t t = env->tokens[t_i];
+			if ((t.type == NAME_IDX) && (env->scopes[t.data] == OBJECT_SCOPE)) used[t.data] = 1;
+		}
+	}
+}
+
+void emit_sym_expr(sym_t s, char* buff) {
+	// write a C expression of type val for a symbolic stack entry
+	switch (s.kind) {
+		case SYM_NAME: snprintf(buff, EMIT_EXPR, "mk_name(%d)", s.a); break;
+		case SYM_NUMB: snprintf(buff, EMIT_EXPR, "mk_numb(%d)", s.a); break;
+		case SYM_STNG: snprintf(buff, EMIT_EXPR, "mk_stng(STR_%d)", s.a); break;
+		case SYM_TEMP: snprintf(buff, EMIT_EXPR, "t%d", s.a); break;
+		case SYM_BOUND:
+			// standard functions don't look at their object, so those are bound without one
+			if (s.b < STD_LIBS) snprintf(buff, EMIT_EXPR, "mk_func(%d, %d, NULL)", s.b, s.c);
+			else snprintf(buff, EMIT_EXPR, "mk_func(%d, %d, o%d)", s.b, s.c, s.a);
+		break;
+	}
+}
+
+void emit_flush(emitter* e) {
+	// materialize every symbolic entry on the real stack, bottom first
+	char buff[EMIT_EXPR];
+	for (int i = 0; i < e->n_syms; i++) {
+		emit_sym_expr(e->syms[i], buff);
+		emit_line(e, "push(%s);", buff);
+	}
+	e->n_syms = 0;
+}
+
+void emit_spush(emitter* e, sym_t s) {
+	if (e->n_syms >= EMIT_MAX_SYMS) emit_flush(e);
+	e->syms[e->n_syms++] = s;
+}
+
+int emit_new_temp(emitter* e, const char* expr) {
+	// declare a fresh temporary holding expr, return its id
+	int t = e->temps++;
+	emit_line(e, "val t%d = %s;", t, expr);
+	return t;
+}
+
+sym_t emit_spop(emitter* e, char* buff) {
+	// pop one entry, from the symbolic stack if possible, otherwise from the real one
+	// buff receives a C expression of type val for the entry
+	sym_t s;
+	if (e->n_syms > 0) {
+		s = e->syms[--e->n_syms];
+		if (s.kind == SYM_BOUND) {
+			// a bound function value that escapes into generic code
+			char tmp[EMIT_EXPR];
+			emit_sym_expr(s, tmp);
+			s = (sym_t) {SYM_TEMP, emit_new_temp(e, tmp), 0, 0};
+		}
+	}
+	else {
+		s = (sym_t) {SYM_TEMP, emit_new_temp(e, "pop()"), 0, 0};
+	}
+	emit_sym_expr(s, buff);
+	return s;
+}
+
+void emit_name_ref(emitter* e, int name, char* buff) {
+	// lvalue for a name known at translation time
+	switch (e->env->scopes[name]) {
+		case GLOBAL_SCOPE:
+			snprintf(buff, EMIT_EXPR, "G[%d]", name);
+		break;
+		case OBJECT_SCOPE:
+			if (e->class_i < STD_LIBS) emit_error("object names in a standard class");
+			snprintf(buff, EMIT_EXPR, "((C%d*) fr->self)->f%d", e->class_i, name);
+		break;
+		case FUNCTION_SCOPE:
+			snprintf(buff, EMIT_EXPR, "((F%d*) fr)->l%d", e->func_k, name);
+		break;
+		default:
+		emit_error("name without scope");
+	}
+}
+
+void emit_dynamic_ref(emitter* e, const char* name_expr, char* buff) {
+	// lvalue for a name only known at run time
+	int t = e->temps++;
+	emit_line(e, "val* p%d = ref(fr, as_name(%s, \"name expected\"), LNAMES_%d, LOFFS_%d);", t, name_expr, e->func_k, e->func_k);
+	snprintf(buff, EMIT_EXPR, "(*p%d)", t);
+	e->dynamic = 1;
+}
+
+void emit_call(emitter* e, const char* call, const char* args, int tail) {
+	// call(caller's frame, args) gives the callee's frame (enter) or NULL when it was a standard
+	// function that has already run (call_val). Hand the frame to run() and continue at a new
+	// return point, or for a tail call put it in place of the caller's
+	if (tail) {
+		emit_line(e, "{ frame* next = %s(fr->prev, %s); if (next) { frame_pop(fr); return next; } }", call, args);
+		return;
+	}
+	e->rets++;
+	emit_line(e, "{ frame* next = %s(fr, %s); if (next) { fr->pc = %d; return next; } }", call, args, e->rets);
+	emit_line(e, "ret_%d: ;", e->rets);
+}
+
+void emit_std_call(emitter* e, int c, int f) {
+	// inline kernel for standard function f of standard class c
+	char x[EMIT_EXPR], y[EMIT_EXPR], z[EMIT_EXPR], expr[4 * EMIT_EXPR];
+	if (c == 0) {
+		// A: "a", "s", "m", "d", "mod", "f", "e", "ne", "lt", "le", "gt", "ge"
+		static const char* ops[] = {"+", "-", "*", "/", "%", "", "==", "!=", "<", "<=", ">", ">="};
+		const char* msg = "\"arithmetic operands must be numbers\"";
+		emit_spop(e, y);
+		if (f == 5) {
+			snprintf(expr, sizeof expr, "mk_numb(as_numb(%s, %s))", y, msg);
+		}
+		else {
+			emit_spop(e, x);
+			snprintf(expr, sizeof expr, "mk_numb(as_numb(%s, %s) %s as_numb(%s, %s))", x, msg, ops[f], y, msg);
+		}
+		emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, expr), 0, 0});
+	}
+	else if (c == 1) {
+		// S: "l", "i", "si", "a", "d", "e", "ns", "sn"
+		switch (f) {
+			case 0:
+				emit_spop(e, x);
+				snprintf(expr, sizeof expr, "mk_numb((int) strlen(as_stng(%s, \"string length operand must be string\")))", x);
+			break;
+			case 1:
+				emit_spop(e, y); emit_spop(e, x);
+				snprintf(expr, sizeof expr, "s_index(%s, %s)", x, y);
+			break;
+			case 2:
+				emit_spop(e, z); emit_spop(e, y); emit_spop(e, x);
+				snprintf(expr, sizeof expr, "s_replace(%s, %s, %s)", x, y, z);
+			break;
+			case 3:
+				emit_spop(e, y); emit_spop(e, x);
+				snprintf(expr, sizeof expr, "s_concat(%s, %s)", x, y);
+			break;
+			case 4:
+			{
+				emit_spop(e, y); emit_spop(e, x);
+				int ta = emit_new_temp(e, "mk_numb(0)");
+				int tb = emit_new_temp(e, "mk_numb(0)");
+				emit_line(e, "s_split(%s, %s, &t%d, &t%d);", x, y, ta, tb);
+				emit_spush(e, (sym_t) {SYM_TEMP, ta, 0, 0});
+				emit_spush(e, (sym_t) {SYM_TEMP, tb, 0, 0});
+				return;
+			}
+			case 5:
+				emit_spop(e, y); emit_spop(e, x);
+				snprintf(expr, sizeof expr, "mk_numb(!strcmp(as_stng(%s, \"string equality operands must be string and string\"), "
+					"as_stng(%s, \"string equality operands must be string and string\")))", x, y);
+			break;
+			case 6:
+				emit_spop(e, x);
+				snprintf(expr, sizeof expr, "s_chr(%s)", x);
+			break;
+			case 7:
+				emit_spop(e, x);
+				snprintf(expr, sizeof expr, "mk_numb(as_stng(%s, \"character to number operand must be number\")[0])", x);
+			break;
+			default:
+			emit_error("bad S function");
+		}
+		emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, expr), 0, 0});
+	}
+	else if (c == 3) {
+		// O: "o", "on"
+		emit_spop(e, x);
+		emit_line(e, (f == 0) ? "o_out(%s);" : "o_outn(%s);", x);
+	}
+	else if (c == 4) {
+		// I: "l", "c", "e"
+		static const char* kernels[] = {"i_line()", "i_char()", "i_end()"};
+		if ((f < 0) || (f > 2)) emit_error("bad I function");
+		emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, kernels[f]), 0, 0});
+	}
+	else {
+		// V: emitted programs have no generated names yet, so this falls back to the generic call(),
+		// which fails with "V class not yet supported" when it runs
+		emit_flush(e);
+		emit_line(e, "call(%d, %d);", c, f);
+	}
+}
+
+void emit_function_body(emitter* e, int t_i) {
+	// translate the tokens of one function, starting at t_i and ending at its ]
+	glass_env* env = e->env;
+	char a[EMIT_EXPR], b[EMIT_EXPR], ref[EMIT_EXPR], expr[3 * EMIT_EXPR];
+	e->n_syms = 0;
+
+	for (;; t_i++) {
+		token_t t = env->tokens[t_i];
+		switch (t.type) {
+			case NAME_IDX:
+				if (env->scopes[t.data] == FUNCTION_SCOPE) e->local_used[t.data] = 1;
+				emit_spush(e, (sym_t) {SYM_NAME, t.data, 0, 0});
+			break;
+			case NUMBER:
+				emit_spush(e, (sym_t) {SYM_NUMB, t.data, 0, 0});
+			break;
+			case STNG_IDX:
+				emit_spush(e, (sym_t) {SYM_STNG, t.data, 0, 0});
+			break;
+			case STCK_IDX:
+				if (t.data < e->n_syms) {
+					// duplicating a symbolic entry is free, temps are never reassigned
+					sym_t s = e->syms[e->n_syms - 1 - t.data];
+					if (s.kind == SYM_BOUND) {
+						emit_sym_expr(s, a);
+						s = (sym_t) {SYM_TEMP, emit_new_temp(e, a), 0, 0};
+						e->syms[e->n_syms - 1 - t.data] = s;
+					}
+					emit_spush(e, s);
+				}
+				else {
+					snprintf(a, sizeof a, "peek(%d)", t.data - e->n_syms);
+					emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, a), 0, 0});
+				}
+			break;
+			case ASCII:
+				switch (t.data) {
+					case ',':
+						if (e->n_syms > 0) e->n_syms--;
+						else emit_line(e, "pop();");
+					break;
+					case '=':
+					{
+						emit_spop(e, a);
+						sym_t n = emit_spop(e, b);
+						if (n.kind == SYM_NAME) {
+							if (env->scopes[n.a] == FUNCTION_SCOPE) e->local_class[n.a] = -2;
+							emit_name_ref(e, n.a, ref);
+						}
+						else {
+							// unknown target, nothing can be assumed about any local any more
+							for (int i = 0; i < env->n_names; i++) e->local_class[i] = -2;
+							emit_dynamic_ref(e, b, ref);
+						}
+						emit_line(e, "%s = %s;", ref, a);
+					}
+					break;
+					case '*':
+					{
+						sym_t n = emit_spop(e, a);
+						if (n.kind == SYM_NAME) emit_name_ref(e, n.a, ref);
+						else emit_dynamic_ref(e, a, ref);
+						snprintf(expr, sizeof expr, "defined(%s)", ref);
+						emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, expr), 0, 0});
+					}
+					break;
+					case '$':
+					{
+						sym_t n = emit_spop(e, a);
+						if (n.kind == SYM_NAME) {
+							if (env->scopes[n.a] == FUNCTION_SCOPE) {
+								int* lc = e->local_class + n.a;
+								*lc = ((*lc == -1) || (*lc == e->class_i)) ? e->class_i : -2;
+							}
+							emit_name_ref(e, n.a, ref);
+						}
+						else {
+							for (int i = 0; i < env->n_names; i++) e->local_class[i] = -2;
+							emit_dynamic_ref(e, a, ref);
+						}
+						emit_line(e, "%s = mk_objt(fr->self);", ref);
+					}
+					break;
+					case '!':
+					{
+						sym_t c = emit_spop(e, a);
+						sym_t n = emit_spop(e, b);
+						int class_i = -1;
+						if (c.kind == SYM_NAME) class_i = get_class_idx(*env, c.a);
+						if ((c.kind != SYM_NAME) || (n.kind != SYM_NAME) || (class_i < 0)) {
+							// generic construction, resolved at run time
+							emit_flush(e);
+							int t = e->temps++;
+							emit_line(e, "obj_t* o%d = new_dynamic(fr, LNAMES_%d, LOFFS_%d, %s, %s);", t, e->func_k, e->func_k, b, a);
+							emit_line(e, "if (CTOR[o%d->class_i] >= 0) {", t);
+							e->indent++;
+							snprintf(expr, sizeof expr, "CTOR[o%d->class_i], o%d", t, t);
+							emit_call(e, "enter", expr, 0);
+							e->indent--;
+							emit_line(e, "}");
+							for (int i = 0; i < env->n_names; i++) e->local_class[i] = -2;
+							e->dynamic = 1;
+							e->new_dynamic = 1;
+							break;
+						}
+						if (env->scopes[n.a] == FUNCTION_SCOPE) {
+							int* lc = e->local_class + n.a;
+							*lc = ((*lc == -1) || (*lc == class_i)) ? class_i : -2;
+						}
+						// constructors run on the real stack, once the object is in its variable
+						int ctor = (class_i >= STD_LIBS) ? e->ctor[class_i] : -1;
+						if (ctor >= 0) emit_flush(e);
+						emit_name_ref(e, n.a, ref);
+						int t = e->temps++;
+						emit_line(e, "obj_t* o%d = new_object(%d);", t, class_i);
+						emit_line(e, "%s = mk_objt(o%d);", ref, t);
+						if (ctor >= 0) {
+							snprintf(expr, sizeof expr, "%d, o%d", ctor, t);
+							emit_call(e, "enter", expr, 0);
+						}
+					}
+					break;
+					case '.':
+					{
+						sym_t f = emit_spop(e, a);
+						sym_t o = emit_spop(e, b);
+						int known = -1;
+						if ((o.kind == SYM_NAME) && (env->scopes[o.a] == FUNCTION_SCOPE)) known = e->local_class[o.a];
+						if ((o.kind == SYM_NAME) && (f.kind == SYM_NAME) && (known >= 0)) {
+							int func_i = get_func_idx(*env, env->c_lookup[known], f.a);
+							if ((func_i >= 0) && (known < STD_LIBS)) {
+								// only the check of the object is left, see emit_sym_expr
+								emit_name_ref(e, o.a, ref);
+								emit_line(e, "as_objt(%s);", ref);
+								emit_spush(e, (sym_t) {SYM_BOUND, -1, known, func_i});
+								break;
+							}
+							if (func_i >= 0) {
+								int t = e->temps++;
+								emit_name_ref(e, o.a, ref);
+								emit_line(e, "obj_t* o%d = as_objt(%s);", t, ref);
+								emit_spush(e, (sym_t) {SYM_BOUND, t, known, func_i});
+								break;
+							}
+						}
+						if (o.kind == SYM_NAME) emit_name_ref(e, o.a, ref);
+						else emit_dynamic_ref(e, b, ref);
+						snprintf(expr, sizeof expr, "bind(%s, as_name(%s, \"both . operands must be names\"))", ref, a);
+						emit_spush(e, (sym_t) {SYM_TEMP, emit_new_temp(e, expr), 0, 0});
+					}
+					break;
+					case '?':
+					{
+						token_t next = env->tokens[t_i + 1];
+						int tail = (next.type == ASCII) && ((next.data == ']') || (next.data == '^'));
+						if ((e->n_syms > 0) && (e->syms[e->n_syms - 1].kind == SYM_BOUND)) {
+							sym_t f = e->syms[--e->n_syms];
+							if (f.b < STD_LIBS) {
+								emit_std_call(e, f.b, f.c);
+							}
+							else {
+								emit_flush(e);
+								snprintf(expr, sizeof expr, "%d, o%d", e->func_base[f.b] + f.c, f.a);
+								emit_call(e, "enter", expr, tail);
+							}
+							break;
+						}
+						emit_spop(e, a);
+						emit_flush(e);
+						emit_call(e, "call_val", a, tail);
+					}
+					break;
+					case '^':
+						emit_flush(e);
+						emit_line(e, "return frame_pop(fr);");
+					break;
+					case '/':
+						emit_flush(e);
+						t_i++;
+						if (env->scopes[env->tokens[t_i].data] == FUNCTION_SCOPE) e->local_used[env->tokens[t_i].data] = 1;
+						emit_name_ref(e, env->tokens[t_i].data, ref);
+						emit_line(e, "for (;;) {");
+						e->indent++;
+						emit_line(e, "if (%s.type != NUMB) fail(\"for now, only numbers supported as loop conditions\");", ref);
+						emit_line(e, "if (!%s.numb) break;", ref);
+					break;
+					case '\\':
+						emit_flush(e);
+						e->indent--;
+						emit_line(e, "}");
+					break;
+					case ']':
+						emit_flush(e);
+						emit_line(e, "return frame_pop(fr);");
+						return;
+					default:
+					emit_error("bad ascii token in function body");
+				}
+			break;
+			default:
+			emit_error("function body runs off the end of the program");
+		}
+	}
+}
+
+void emit_c(glass_env* env, FILE* out) {
+	// translate the whole program to a standalone C file on out
+	emitter e = {0};
+	e.env = env;
+	e.out = out;
+	int n_classes = env->n_classes;
+
+	int main_c = get_class_idx(*env, find_name(env, "M"));
+	int main_f = (main_c >= 0) ? get_func_idx(*env, find_name(env, "M"), find_name(env, "m")) : -1;
+	if (main_f < 0) emit_error("cannot find M.m");
+	int ctor_name = find_name(env, "c__");
+
+	e.local_class = (int*) malloc(env->n_names * sizeof (int));
+	e.local_used = (char*) malloc(env->n_names);
+	e.field_used = (char*) malloc(env->n_names);
+	e.func_base = (int*) malloc(n_classes * sizeof (int));
+	e.ctor = (int*) malloc(n_classes * sizeof (int));
+	if (!e.local_class || !e.local_used || !e.field_used || !e.func_base || !e.ctor) emit_error("could not malloc emitter tables");
+	int n_funcs = 0;
+	for (int c = 0; c < n_classes; c++) {
+		e.func_base[c] = n_funcs;
+		int f = ((c >= STD_LIBS) && (ctor_name >= 0)) ? get_func_idx(*env, env->c_lookup[c], ctor_name) : -1;
+		e.ctor[c] = (f >= 0) ? n_funcs + f : -1;
+		if (c >= STD_LIBS) n_funcs += emit_class_has_func(env, c);
+	}
+
+	emit_prelude(env, out);
+
+	// string literals
+	for (int i = 0; i < env->n_strings; i++) {
+		fprintf(out, "static const char STR_%d[] = \"", i);
+		for (char* c = env->strings[i]; *c; c++) {
+			if ((*c == '"') || (*c == '\\')) fprintf(out, "\\%c", *c);
+			else if (isprint((unsigned char) *c)) fputc(*c, out);
+			else fprintf(out, "\\%03o", (unsigned char) *c);
+		}
+		fprintf(out, "\";\n");
+	}
+
+	// one struct per user class holding exactly the object names its functions mention
+	fprintf(out, "\n");
+	for (int c = STD_LIBS; c < n_classes; c++) {
+		emit_class_fields(env, c, e.field_used);
+		fprintf(out, "typedef struct {\n\tobj_t hdr; /* class %s */\n", env->names[env->c_lookup[c]]);
+		for (int n = 0; n < env->n_names; n++) {
+			if (e.field_used[n]) fprintf(out, "\tval f%d; /* %s */\n", n, env->names[n]);
+		}
+		fprintf(out, "} C%d;\n", c);
+	}
+
+	// dynamic lookup helpers, only used where a name or target is not known statically
+	fprintf(out, "\nstatic val* field_ref(obj_t* o, int n) {\n\tswitch (o->class_i) {\n");
+	for (int c = STD_LIBS; c < n_classes; c++) {
+		fprintf(out, "\t\tcase %d: switch (n) {\n", c);
+		emit_class_fields(env, c, e.field_used);
+		for (int n = 0; n < env->n_names; n++) {
+			if (e.field_used[n]) fprintf(out, "\t\t\tcase %d: return &((C%d*) o)->f%d;\n", n, c, n);
+		}
+		fprintf(out, "\t\t} break;\n");
+	}
+	fprintf(out, "\t}\n\treturn extra_ref(&o->extra, n);\n}\n");
+
+	fprintf(out,
+		"MAYBE_UNUSED static val* ref(frame* fr, int n, const int* lnames, const int* loffs) {\n"
+		"\tif (SCOPES[n] == %d) return G + n;\n"
+		"\tif (SCOPES[n] == %d) return field_ref(fr->self, n);\n"
+		"\tfor (int i = 0; lnames[i] >= 0; i++) if (lnames[i] == n) return (val*) ((char*) fr + loffs[i]);\n"
+		"\treturn extra_ref(&fr->extra, n);\n}\n",
+		GLOBAL_SCOPE, OBJECT_SCOPE);
+
+	// one frame struct per function holding the locals it mentions, plus the name tables ref()
+	// needs in functions resolving names at run time. The dry run finds both out
+	for (int c = STD_LIBS; c < n_classes; c++) {
+		for (int f = 0; f < emit_class_has_func(env, c); f++) {
+			int k = e.func_base[c] + f;
+			e.class_i = c;
+			e.func_k = k;
+			for (int i = 0; i < env->n_names; i++) e.local_class[i] = -1;
+			memset(e.local_used, 0, env->n_names);
+			e.dynamic = 0;
+			e.dry = 1;
+			emit_function_body(&e, env->f_locs[c][f]);
+			fprintf(out, "\ntypedef struct { /* %s.%s */\n\tframe hdr;\n", env->names[env->c_lookup[c]], env->names[env->f_lookup[c][f]]);
+			for (int n = 0; n < env->n_names; n++) {
+				if (e.local_used[n]) fprintf(out, "\tval l%d; /* %s */\n", n, env->names[n]);
+			}
+			fprintf(out, "} F%d;\n", k);
+			if (!e.dynamic) continue;
+			fprintf(out, "static const int LNAMES_%d[] = {", k);
+			for (int n = 0; n < env->n_names; n++) if (e.local_used[n]) fprintf(out, "%d, ", n);
+			fprintf(out, "-1};\nstatic const int LOFFS_%d[] = {", k);
+			for (int n = 0; n < env->n_names; n++) if (e.local_used[n]) fprintf(out, "offsetof(F%d, l%d), ", k, n);
+			fprintf(out, "0};\n");
+		}
+	}
+
+	// functions by number: first by class, the constructor of each class, and how to enter them
+	fprintf(out, "\n");
+	for (int k = 0; k < n_funcs; k++) fprintf(out, "static frame* fn_%d(frame* fr);\n", k);
+	fprintf(out, "static frame* (*const FUNCS[])(frame*) = {");
+	for (int k = 0; k < n_funcs; k++) fprintf(out, "fn_%d, ", k);
+	fprintf(out, "NULL};\nstatic const size_t FRAME_SIZE[] = {");
+	for (int k = 0; k < n_funcs; k++) fprintf(out, "sizeof (F%d), ", k);
+	fprintf(out, "0};\nstatic const int FUNC_BASE[] = {");
+	for (int c = 0; c < n_classes; c++) fprintf(out, "%d, ", e.func_base[c]);
+	if (e.new_dynamic) {
+		fprintf(out, "0};\nstatic const int CTOR[] = {");
+		for (int c = 0; c < n_classes; c++) fprintf(out, "%d, ", e.ctor[c]);
+	}
+	fprintf(out, "0};\nstatic frame* POOL[%d];\n", n_funcs + 1);
+	fprintf(out, "static frame* enter(frame* prev, int k, obj_t* o) {\n\treturn frame_push(POOL + k, prev, o, FRAME_SIZE[k], k);\n}\n");
+
+	// objects start with every field unset, run() runs the constructor
+	fprintf(out, "\nstatic obj_t* new_object(int c) {\n\tobj_t* o;\n\tswitch (c) {\n");
+	for (int c = 0; c < n_classes; c++) {
+		if (c < STD_LIBS) fprintf(out, "\t\tcase %d: o = (obj_t*) calloc(1, sizeof (obj_t)); break;\n", c);
+		else fprintf(out, "\t\tcase %d: o = (obj_t*) calloc(1, sizeof (C%d)); break;\n", c, c);
+	}
+	fprintf(out, "\t\tdefault: fail(\"init_object: bad class index\"); return NULL;\n\t}\n");
+	fprintf(out, "\tif (!o) fail(\"could not malloc object\");\n\to->class_i = c;\n\treturn o;\n}\n");
+
+	if (e.new_dynamic) {
+		fprintf(out, "static obj_t* new_dynamic(frame* fr, const int* lnames, const int* loffs, val n, val c) {\n");
+		fprintf(out, "\tif ((n.type != NAME) || (c.type != NAME)) fail(\"both ! operands must be names\");\n");
+		fprintf(out, "\tint ci = -1;\n\tswitch (c.name) {\n");
+		for (int c = 0; c < n_classes; c++) fprintf(out, "\t\tcase %d: ci = %d; break;\n", env->c_lookup[c], c);
+		fprintf(out, "\t}\n\tobj_t* o = new_object(ci);\n\t*ref(fr, n.name, lnames, loffs) = mk_objt(o);\n\treturn o;\n}\n");
+	}
+
+	// method resolution by name, for . on objects whose class is not known statically
+	fprintf(out, "MAYBE_UNUSED static val bind(val o, int name) {\n\tobj_t* obj = as_objt(o);\n\tswitch (obj->class_i) {\n");
+	for (int c = 0; c < n_classes; c++) {
+		fprintf(out, "\t\tcase %d: switch (name) {\n", c);
+		for (int f = 0; f < emit_class_has_func(env, c); f++) {
+			if (get_func_idx(*env, env->c_lookup[c], env->f_lookup[c][f]) != f) continue; // shadowed
+			fprintf(out, "\t\t\tcase %d: return mk_func(%d, %d, obj);\n", env->f_lookup[c][f], c, f);
+		}
+		fprintf(out, "\t\t} break;\n");
+	}
+	fprintf(out, "\t}\n\tfail(\"no such function in class\");\n\treturn o;\n}\n");
+
+	// generic call of a standard function, through the real stack
+	fprintf(out, "static void call(int c, int f) {\n\tval x, y, z;\n\tswitch (c) {\n");
+	fprintf(out, "\t\tcase 0:\n\t\t\ty = pop();\n\t\t\tif (f == 5) { push(mk_numb(as_numb(y, \"arithmetic operands must be numbers\"))); return; }\n");
+	fprintf(out, "\t\t\tx = pop();\n\t\t\t{\n\t\t\t\tint a = as_numb(x, \"arithmetic operands must be numbers\");\n");
+	fprintf(out, "\t\t\t\tint b = as_numb(y, \"arithmetic operands must be numbers\");\n\t\t\t\tswitch (f) {\n");
+	{
+		static const char* ops[] = {"+", "-", "*", "/", "%", "", "==", "!=", "<", "<=", ">", ">="};
+		for (int f = 0; f < 12; f++) {
+			if (f != 5) fprintf(out, "\t\t\t\t\tcase %d: push(mk_numb(a %s b)); return;\n", f, ops[f]);
+		}
+	}
+	fprintf(out, "\t\t\t\t}\n\t\t\t}\n\t\tbreak;\n\t\tcase 1:\n\t\t\tswitch (f) {\n");
+	fprintf(out, "\t\t\t\tcase 0: x = pop(); push(mk_numb((int) strlen(as_stng(x, \"string length operand must be string\")))); return;\n");
+	fprintf(out, "\t\t\t\tcase 1: y = pop(); x = pop(); push(s_index(x, y)); return;\n");
+	fprintf(out, "\t\t\t\tcase 2: z = pop(); y = pop(); x = pop(); push(s_replace(x, y, z)); return;\n");
+	fprintf(out, "\t\t\t\tcase 3: y = pop(); x = pop(); push(s_concat(x, y)); return;\n");
+	fprintf(out, "\t\t\t\tcase 4: y = pop(); x = pop(); s_split(x, y, &x, &y); push(x); push(y); return;\n");
+	fprintf(out, "\t\t\t\tcase 5: y = pop(); x = pop(); push(mk_numb(!strcmp(as_stng(x, \"string equality operands must be string and string\"), "
+		"as_stng(y, \"string equality operands must be string and string\")))); return;\n");
+	fprintf(out, "\t\t\t\tcase 6: x = pop(); push(s_chr(x)); return;\n");
+	fprintf(out, "\t\t\t\tcase 7: x = pop(); push(mk_numb(as_stng(x, \"character to number operand must be number\")[0])); return;\n");
+	fprintf(out, "\t\t\t}\n\t\tbreak;\n");
+	fprintf(out, "\t\tcase 2: fail(\"V class not yet supported\"); break;\n");
+	fprintf(out, "\t\tcase 3: x = pop(); if (f == 0) o_out(x); else o_outn(x); return;\n");
+	fprintf(out, "\t\tcase 4: push(f == 0 ? i_line() : (f == 1) ? i_char() : i_end()); return;\n");
+	fprintf(out, "\t}\n\tfail(\"execute_std_function: bad class input\");\n}\n");
+	fprintf(out, "MAYBE_UNUSED static frame* call_val(frame* prev, val f) {\n\t// frame to run a user function in, NULL once a standard one has run\n");
+	fprintf(out, "\tif (f.type != FUNC) fail(\"operand of ? must be a function\");\n");
+	fprintf(out, "\tif (f.func.c >= %d) return enter(prev, FUNC_BASE[f.func.c] + f.func.f, f.func.o);\n", STD_LIBS);
+	fprintf(out, "\tcall(f.func.c, f.func.f);\n\treturn NULL;\n}\n");
+
+	// the functions themselves. Each one is translated three times: a dry run to find out which
+	// locals only ever hold one class of object, another one from there to count the return
+	// points of what the real translation will emit, then for real
+	int* facts = (int*) malloc(env->n_names * sizeof (int));
+	if (!facts) emit_error("could not malloc emitter tables");
+	for (int c = STD_LIBS; c < n_classes; c++) {
+		for (int f = 0; f < emit_class_has_func(env, c); f++) {
+			int k = e.func_base[c] + f;
+			e.class_i = c;
+			e.func_k = k;
+			for (int i = 0; i < env->n_names; i++) e.local_class[i] = -1;
+			memset(e.local_used, 0, env->n_names);
+			e.dynamic = 0;
+			e.dry = 1;
+			e.temps = 0;
+			emit_function_body(&e, env->f_locs[c][f]);
+			memcpy(facts, e.local_class, env->n_names * sizeof (int));
+			e.rets = 0;
+			emit_function_body(&e, env->f_locs[c][f]);
+			memcpy(e.local_class, facts, env->n_names * sizeof (int));
+
+			fprintf(out, "\n// %s.%s\nstatic frame* fn_%d(frame* fr) {\n", env->names[env->c_lookup[c]], env->names[env->f_lookup[c][f]], k);
+			if (e.rets) {
+				fprintf(out, "\tswitch (fr->pc) {\n");
+				for (int r = 1; r <= e.rets; r++) fprintf(out, "\t\tcase %d: goto ret_%d;\n", r, r);
+				fprintf(out, "\t}\n");
+			}
+			e.dry = 0;
+			e.temps = 0;
+			e.rets = 0;
+			e.indent = 1;
+			emit_function_body(&e, env->f_locs[c][f]);
+			fprintf(out, "}\n");
+		}
+	}
+
+	fprintf(out, "\nstatic void run(int k, obj_t* o) {\n");
+	fprintf(out, "\t// run user function k on o, and every function it calls, see emit_c.h\n");
+	fprintf(out, "\tframe* fr = enter(NULL, k, o);\n\twhile (fr) fr = FUNCS[fr->k](fr);\n}\n");
+
+	fprintf(out, "\nint main(void) {\n\tobj_t* m = new_object(%d);\n", main_c);
+	if (e.ctor[main_c] >= 0) fprintf(out, "\trun(%d, m);\n", e.ctor[main_c]);
+	fprintf(out, "\trun(%d, m);\n\tfflush(stdout);\n\treturn 0;\n}\n", e.func_base[main_c] + main_f);
+
+	free(e.local_class);
+	free(e.local_used);
+	free(e.field_used);
+	free(e.func_base);
+	free(e.ctor);
+	free(facts);
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+#include "vars.h"
+#include "trace.h"
+
+// precise mark-and-sweep collector for runtime objects and strings
+// every object_t, extra_vars table and runtime string lives behind a gc_hdr, and all of them are chained
+// together so the sweep can find the unmarked ones. Collections only start at safe points
+// (function entry and loop heads, see gc_poll), where every live value is reachable from a root:
+// the value stack, global_vars, and the locals and object of every live frame.
+// the heap may grow to its threshold before a collection, after which the threshold is reset to
+// twice the surviving bytes (but never below the initial one, set with --gc-heap). Each collection
+// is a trace event, and the profile reports how many there were and what they freed
+// strings are immutable, so values share them freely. String literals and the one-character
+// strings are static: they carry a permanently set mark and are not on the sweep list
+
+#define GC_HEAP_INIT (4 << 20) // default bytes allocated before the first collection
+#define GC_GRAY_INIT 256
+
+enum gc_kind {GC_OBJT, GC_STNG, GC_EXTRA};
+
+typedef struct gc_hdr gc_hdr;
+
+// sits right in front of the object or string it describes
+struct gc_hdr {
+	gc_hdr*       next;   // next allocation in env->gc->all
+	size_t        size;   // bytes after the header
+	unsigned char kind;   // an enum gc_kind
+	unsigned char marked;
+};
+
+struct gc_heap {
+	gc_hdr*  all;       // every allocation, newest first
+	size_t   bytes;     // bytes currently allocated, headers included
+	size_t   threshold; // collect at the next safe point once bytes reaches this
+	size_t   min_threshold;
+	v_list*  stack;     // the value stack, set by interpret
+	gc_hdr** gray;      // marked objects and extra_vars whose values are still to be marked
+	int      n_gray;
+	int      gray_cap;
+	int      n_collections;
+	size_t   freed;     // bytes freed by all collections
+	char**   literals;  // literals[i] is the static copy of env->strings[i]
+	int      n_literals;
+	char*    chars[256]; // chars[c] is the static string holding just the character c
+};
+
+void gc_error(char* error_text);
+
+void gc_init(glass_env* env, size_t threshold);
+void gc_free(glass_env* env);
+void* gc_alloc(glass_env* env, enum gc_kind kind, size_t size);
+char* gc_new_string(glass_env* env, size_t len);
+char* gc_copy_string(glass_env* env, char* s);
+char* gc_static_string(char* s, size_t len);
+void gc_mark(gc_heap* gc, void* p);
+void gc_mark_val(gc_heap* gc, val v);
+void gc_collect(glass_env* env);
+void gc_poll(glass_env* env);
+
+void gc_error(char* error_text) {
+	trap_error("Error in gc.h: ", error_text);
+	fprintf(stderr, "Error in gc.h: %s\n", error_text);
+	exit(1);
+}
+
+void gc_init(glass_env* env, size_t threshold) {
+	gc_heap* gc = (gc_heap*) malloc(sizeof (gc_heap));
+	if (!gc) gc_error("could not malloc heap in gc_init");
+	if (!threshold) threshold = GC_HEAP_INIT;
+	*gc = (gc_heap) {.threshold = threshold, .min_threshold = threshold}; // the rest starts out empty
+	gc->gray = (gc_hdr**) malloc(GC_GRAY_INIT * sizeof (gc_hdr*));
+	if (!gc->gray) gc_error("could not malloc gray stack in gc_init");
+	gc->gray_cap = GC_GRAY_INIT;
+
+	gc->n_literals = env->n_strings;
+	gc->literals = (char**) malloc((gc->n_literals + 1) * sizeof (char*));
+	if (!gc->literals) gc_error("could not malloc literals in gc_init");
+	for (int i = 0; i < gc->n_literals; i++) {
+		gc->literals[i] = gc_static_string(env->strings[i], strlen(env->strings[i]));
+	}
+	for (int c = 0; c < 256; c++) {
+		char ch = (char) c;
+		gc->chars[c] = gc_static_string(&ch, 1);
+	}
+	env->gc = gc;
+}
+
+void gc_free(glass_env* env) {
+	// release the whole heap, live or not
+	gc_heap* gc = env->gc;
+	if (!gc) return;
+	while (gc->all) {
+		gc_hdr* next = gc->all->next;
+		free(gc->all);
+		gc->all = next;
+	}
+	for (int i = 0; i < gc->n_literals; i++) free((gc_hdr*) gc->literals[i] - 1);
+	for (int c = 0; c < 256; c++) free((gc_hdr*) gc->chars[c] - 1);
+	free(gc->literals);
+	free(gc->gray);
+	free(gc);
+	env->gc = NULL;
+}
+
+void* gc_alloc(glass_env* env, enum gc_kind kind, size_t size) {
+	// allocate size bytes owned by the collector
+	// never collects by itself, so values held in C variables stay valid until the next safe point
+	gc_heap* gc = env->gc;
+	if (!gc) gc_error("gc_alloc called without a heap");
+	gc_hdr* h = (gc_hdr*) malloc(sizeof (gc_hdr) + size);
+	if (!h) gc_error("could not malloc in gc_alloc");
+	if (!val_ptr_ok(h + 1)) gc_error("heap pointer does not fit in a val");
+	*h = (gc_hdr) {gc->all, size, kind, 0};
+	gc->all = h;
+	gc->bytes += sizeof (gc_hdr) + size;
+	return h + 1;
+}
+
+char* gc_new_string(glass_env* env, size_t len) {
+	// room for a string of len characters, terminated
+	char* res = (char*) gc_alloc(env, GC_STNG, len + 1);
+	res[len] = '\0';
+	return res;
+}
+
+char* gc_copy_string(glass_env* env, char* s) {
+	size_t len = strlen(s);
+	char* res = gc_new_string(env, len);
+	memcpy(res, s, len);
+	return res;
+}
+
+char* gc_static_string(char* s, size_t len) {
+	// a string that lives as long as the heap, marked forever so collections leave it alone
+	gc_hdr* h = (gc_hdr*) malloc(sizeof (gc_hdr) + len + 1);
+	if (!h) gc_error("could not malloc in gc_static_string");
+	if (!val_ptr_ok(h + 1)) gc_error("heap pointer does not fit in a val");
+	*h = (gc_hdr) {NULL, len + 1, GC_STNG, 1};
+	char* res = (char*) (h + 1);
+	memcpy(res, s, len);
+	res[len] = '\0';
+	return res;
+}
+
+void gc_mark(gc_heap* gc, void* p) {
+	// mark the allocation at p, queueing objects and extra_vars so their values get marked too
+	if (!p) return;
+	gc_hdr* h = (gc_hdr*) p - 1;
+	if (h->marked) return;
+	h->marked = 1;
+	if (h->kind == GC_STNG) return;
+	if (gc->n_gray >= gc->gray_cap) {
+		gc->gray_cap *= 2;
+		gc->gray = (gc_hdr**) realloc(gc->gray, gc->gray_cap * sizeof (gc_hdr*));
+		if (!gc->gray) gc_error("could not realloc gray stack in gc_mark");
+	}
+	gc->gray[gc->n_gray++] = h;
+}
+
+void gc_mark_val(gc_heap* gc, val v) {
+	// objects, bound functions and strings all carry a heap pointer
+	switch (val_tag(v)) {
+		case OBJT: case FUNC: case STNG: gc_mark(gc, val_ptr(v)); break;
+		default: break;
+	}
+}
+
+void gc_collect(glass_env* env) {
+	gc_heap* gc = env->gc;
+
+	// roots
+	if (gc->stack) {
+		for (int i = 0; i <= gc->stack->last_i; i++) gc_mark_val(gc, gc->stack->vs[i]);
+	}
+	for (int i = 0; i < env->n_names; i++) gc_mark_val(gc, env->global_vars[i]);
+	if (env->vars) {
+		for (int i = 0; i < env->vars->n; i++) gc_mark_val(gc, env->vars->vals[i]);
+	}
+	for (frame_t* fr = env->frame; fr; fr = fr->prev) {
+		gc_mark(gc, fr->obj);
+		gc_mark(gc, fr->extra);
+		for (int i = 0; i < fr->n_locals; i++) gc_mark_val(gc, fr->locals[i]);
+	}
+
+	// everything reachable from the roots, with an explicit stack so long object chains are fine
+	while (gc->n_gray) {
+		gc_hdr* h = gc->gray[--gc->n_gray];
+		if (h->kind == GC_EXTRA) {
+			extra_vars* x = (extra_vars*) (h + 1);
+			for (int i = 0; i < x->n; i++) gc_mark_val(gc, x->vars[i].v);
+			continue;
+		}
+		object_t* obj = (object_t*) (h + 1);
+		gc_mark(gc, obj->extra);
+		int n_fields = env->shapes[obj->class_i].n_fields;
+		for (int i = 0; i < n_fields; i++) gc_mark_val(gc, obj->vars[i]);
+	}
+
+	// sweep
+	size_t before = gc->bytes;
+	gc_hdr** link = &gc->all;
+	while (*link) {
+		gc_hdr* h = *link;
+		if (h->marked) {
+			h->marked = 0;
+			link = &h->next;
+		}
+		else {
+			*link = h->next;
+			gc->bytes -= sizeof (gc_hdr) + h->size;
+			free(h);
+		}
+	}
+
+	gc->threshold = 2 * gc->bytes;
+	if (gc->threshold < gc->min_threshold) gc->threshold = gc->min_threshold;
+	gc->n_collections++;
+	gc->freed += before - gc->bytes;
+	if (TRACING(env)) trace_put(env, TRACE_GC, (before - gc->bytes > INT32_MAX) ? INT32_MAX : (int) (before - gc->bytes));
+}
+
+void gc_poll(glass_env* env) {
+	// safe point: collect if the heap has outgrown its threshold
+	if (env->gc->bytes >= env->gc->threshold) gc_collect(env);
+}
+
+#endif
@@ -1,43 +1,262 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include "glassdefs.h"
 #include "parser.h"
+#include "compiler.h"
 #include "runtime.h"
+#include "batch.h"
+#include "image.h"
+#include "emit_c.h"
 
 void glass_error(char* err_text) {
 	fprintf(stderr, "Error in glass.c: %s\n", err_text);
 	exit(0);
 }
 
-void interpret(glass_env env) {
+void interpret(glass_env* env) {
 	v_list stack = init_stack();
+	env->gc->stack = &stack;
 
-	int main_idx = get_class_idx(env, find_name(env.names, "M"));
-	int m_idx = get_func_idx(env, find_name(env.names, "M"), find_name(env.names, "m"));
+	int main_idx = get_class_idx(*env, find_name(env, "M"));
+	int m_idx = get_func_idx(*env, find_name(env, "M"), find_name(env, "m"));
 	if (m_idx < 0) glass_error("cannot find M.m");
 
-	object_t* main_obj = init_object(&env, main_idx, &stack);
+	object_t* main_obj = init_object(env, main_idx, &stack);
 
 	func_t main_func = (func_t) {main_idx, m_idx, main_obj};
 
-	execute_function(&env, main_func, &stack);
+	execute_function(env, main_func, &stack);
+
+	env->gc->stack = NULL;
+	free(stack.vs);
+}
+
+void write_profile(glass_env* env, char* path) {
+	// the text report goes to path, the folded stacks to path.folded
+	FILE* out = fopen(path, "w");
+	if (!out) glass_error("could not open profile output");
+	prof_report(env, out);
+	fclose(out);
+
+	char* folded_path = (char*) malloc(strlen(path) + 8);
+	if (!folded_path) glass_error("could not malloc in write_profile");
+	sprintf(folded_path, "%s.folded", path);
+	out = fopen(folded_path, "w");
+	if (!out) glass_error("could not open folded stack output");
+	prof_folded(env, out);
+	fclose(out);
+	free(folded_path);
+}
+
+// glass --batch keeps each run's output here until the runs before it have been printed
+typedef struct batch_out {
+	char*  buff;
+	size_t used;
+	size_t size;
+} batch_out;
+
+void batch_out_write(void* user, const char* s, size_t len) {
+	batch_out* out = (batch_out*) user;
+	if (out->used + len > out->size) {
+		size_t size = out->size ? out->size : 4096;
+		while (out->used + len > size) size *= 2;
+		out->buff = (char*) realloc(out->buff, size);
+		if (!out->buff) glass_error("could not grow batch output");
+		out->size = size;
+	}
+	memcpy(out->buff + out->used, s, len);
+	out->used += len;
+}
+
+int compare_paths(const void* a, const void* b) {
+	return strcmp(*(char**) a, *(char**) b);
+}
+
+int list_inputs(char* dir, char*** paths) {
+	// the regular files in dir, sorted by name, returns how many
+	DIR* d = opendir(dir);
+	if (!d) glass_error("could not open batch input directory");
+	int n = 0;
+	int cap = 0;
+	char** res = NULL;
+	struct dirent* e;
+	while ((e = readdir(d))) {
+		char* path = (char*) malloc(strlen(dir) + strlen(e->d_name) + 2);
+		if (!path) glass_error("could not malloc in list_inputs");
+		sprintf(path, "%s/%s", dir, e->d_name);
+		struct stat st;
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		res = (char**) grow_table(res, &cap, n + 1, sizeof (char*));
+		res[n++] = path;
+	}
+	closedir(d);
+	qsort(res, n, sizeof (char*), compare_paths);
+	*paths = res;
+	return n;
+}
+
+void run_batch(glass_env* env, char* dir, int n_threads, size_t gc_heap) {
+	// run the program once per file in dir, with that file as its input, n_threads runs at a time
+	// the outputs are printed in the order of the file names, each under a ==> name <== line.
+	// a run's runtime error goes to stderr and the others carry on
+	char** paths;
+	int n = list_inputs(dir, &paths);
+	batch_job* jobs = (batch_job*) calloc(n + 1, sizeof (batch_job));
+	batch_out* outs = (batch_out*) calloc(n + 1, sizeof (batch_out));
+	if (!jobs || !outs) glass_error("could not malloc in run_batch");
+	for (int i = 0; i < n; i++) {
+		jobs[i].fd = open(paths[i], O_RDONLY);
+		if (jobs[i].fd < 0) glass_error("could not open batch input");
+		jobs[i].write = batch_out_write;
+		jobs[i].write_user = outs + i;
+	}
+
+	batch_state b;
+	batch_start(&b, env, jobs, n, n_threads, gc_heap);
+	for (int i = 0; i < n; i++) {
+		batch_wait(&b, i);
+		printf("==> %s <==\n", paths[i]);
+		fwrite(outs[i].buff, 1, outs[i].used, stdout);
+		if (jobs[i].failed) {
+			fflush(stdout);
+			fprintf(stderr, "%s: %s\n", paths[i], jobs[i].message);
+		}
+		free(outs[i].buff);
+		close(jobs[i].fd);
+		free(paths[i]);
+	}
+	batch_finish(&b);
+	fflush(stdout);
+	free(paths);
+	free(jobs);
+	free(outs);
 }
 
 int main(int argc, char *argv[] ) {
-	if (argc != 2) glass_error("glass takes exactly two arguments");
+	char* usage = "usage: glass [-q] [--line-buffered] [--emit-c] [--compile [-o prog.glc]] [--jit] [--memo] [--no-peephole] [--profile out] [--gc-heap bytes] [--trace] [--batch inputs/ [--threads n]] program.gl\n       glass --decode-trace file [--last n]";
+	char* filename = NULL;
+	int quiet = 0; // no token dump or banner, just the program's output
+	int line_mode = isatty(STDOUT_FILENO); // flush the program's output at every newline
+	int emit = 0;
+	int compile = 0;
+	char* out_name = NULL; // image to write with --compile
+	int jit = 0;
+	int memo = 0;
+	int peephole = 1; // run fused instructions, see peephole.h
+	char* profile = NULL; // where to write the profile, NULL for none
+	size_t gc_heap = 0; // bytes before the first collection, 0 for the default
+	char* batch = NULL; // directory of inputs to run the program on, NULL to run it once
+	int n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN); // worker threads for --batch
+	// record runtime events (see trace.h), GLASS_TRACE=events does the same with a ring of that size
+	char* trace_var = getenv("GLASS_TRACE");
+	int trace = trace_var && *trace_var && strcmp(trace_var, "0");
+	int trace_size = trace ? atoi(trace_var) : 0;
+	char* decode = NULL; // trace file to print instead of running anything
+	int last = 0; // events to print from it, 0 for all
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet")) quiet = 1;
+		else if (!strcmp(argv[i], "--line-buffered")) line_mode = 1;
+		else if (!strcmp(argv[i], "--emit-c")) emit = 1;
+		else if (!strcmp(argv[i], "--compile")) compile = 1;
+		else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) out_name = argv[++i];
+		else if (!strcmp(argv[i], "--jit")) jit = 1;
+		else if (!strcmp(argv[i], "--memo")) memo = 1;
+		else if (!strcmp(argv[i], "--no-peephole")) peephole = 0;
+		else if (!strcmp(argv[i], "--profile") && (i + 1 < argc)) profile = argv[++i];
+		else if (!strcmp(argv[i], "--gc-heap") && (i + 1 < argc)) gc_heap = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--batch") && (i + 1 < argc)) batch = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && (i + 1 < argc)) n_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--trace")) trace = 1;
+		else if (!strcmp(argv[i], "--decode-trace") && (i + 1 < argc)) decode = argv[++i];
+		else if (!strcmp(argv[i], "--last") && (i + 1 < argc)) last = atoi(argv[++i]);
+		else if (!filename) filename = argv[i];
+		else glass_error(usage);
+	}
+	if (decode) {
+		trace_decode(decode, last, stdout);
+		return 0;
+	}
+	if (!filename) glass_error(usage);
+
+	// a precompiled image (see image.h) is mapped as it is, source is parsed and compiled
+	glass_env env;
+	if (image_is_image(filename)) env = image_load(filename);
+	else {
+		env = parse_file(filename);
+		compile_env(&env);
+	}
 
-	glass_env env = parse_file(argv[1]);
-	
-	int main_idx = get_class_idx(env, find_name(env.names, "M"));
+	if (emit) {
+		// translate to C on stdout instead of running
+		emit_c(&env, stdout);
+		free_env(env);
+		image_unload(&env);
+		return 0;
+	}
 
-	printf("Program tokens:\n");
-	print_tokens(env.tokens);
+	if (compile) {
+		// write the image instead of running, prog.gl goes to prog.glc unless -o says otherwise
+		char* image_name = out_name;
+		if (!image_name) {
+			image_name = (char*) malloc(strlen(filename) + 2);
+			if (!image_name) glass_error("could not malloc image name");
+			sprintf(image_name, "%sc", filename);
+		}
+		image_write(&env, image_name);
+		if (image_name != out_name) free(image_name);
+		free_env(env);
+		image_unload(&env);
+		return 0;
+	}
+	env.peephole = peephole;
+	// machine code doesn't count its instructions or record events, so profiles and traces are
+	// always interpreted
+	if (jit && !profile && !trace) jit_init(&env);
+	if (memo) {
+		analyze_env(&env);
+		memo_init(&env);
+	}
+	if (batch) {
+		// env is only read from here on, each worker runs on a copy of its own (see batch.h)
+		if (profile) glass_error("--profile doesn't work with --batch");
+		if (trace) glass_error("--trace doesn't work with --batch");
+		run_batch(&env, batch, n_threads, gc_heap);
+		memo_free(&env);
+		jit_free(&env);
+		free_env(env);
+		image_unload(&env);
+		return 1;
+	}
+	if (profile) prof_init(&env);
+	gc_init(&env, gc_heap);
+	out_init(&env, STDOUT_FILENO, line_mode);
+	in_init(&env, STDIN_FILENO);
+	if (trace) trace_init(&env, (trace_size > 1) ? trace_size : 0, getenv("GLASS_TRACE_FILE"));
 
-	printf("Beginning execution (MM!Mm.?) ...\n\n");
-	interpret(env);
+	if (!quiet) {
+		printf("Program tokens:\n");
+		print_tokens(env.tokens);
+		printf("Beginning execution (MM!Mm.?) ...\n\n");
+	}
+	interpret(&env);
+	out_free(&env);
+	in_free(&env);
+	vars_free(&env);
+	trace_free(&env);
+	if (profile) write_profile(&env, profile);
 
+	gc_free(&env);
+	prof_free(&env);
+	memo_free(&env);
+	jit_free(&env);
 	free_env(env);
+	image_unload(&env);
 
 	return 1;
 }
\ No newline at end of file
@@ -1,38 +1,90 @@
 #ifndef GLASS_DEFS_H
 #define GLASS_DEFS_H
 
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
-
-#define MAX_NAMES 256
-#define MAX_CLASSES 256
-#define MAX_FUNCS 256
-#define MAX_LITERALS 256
-#define MAX_PROGRAM 1024
+#include <stdint.h>
+#include <setjmp.h>
+
+// the tables below start at these sizes and double as the program needs, see grow_table
+#define NAMES_INIT 256
+#define CLASSES_INIT 16
+#define FUNCS_INIT 8      // per class
+#define LITERALS_INIT 64
+#define PROGRAM_INIT 1024 // tokens
+#define ARENA_CHUNK 4096  // bytes per chunk of env->arena
 #define MAX_LOOP_DEPTH 64
+#define NAME_HASH_INIT 512 // initial slots in the name hash table, a power of two
+#define FUNC_HASH_INIT 256 // initial slots in the function hash table, a power of two
 
 #define STD_LIBS 5 // number of standard classes
+#define IC_WAYS 4  // entries per inline cache, call sites seeing more receivers take the slow path
+#define TRAP_MESSAGE_SIZE 512
 
 enum val_type {NO_VAL=0, FUNC, OBJT, NUMB, NAME, STNG, CMDS};
 enum token_type {NO_TOKEN, ASCII, NAME_IDX, NUMBER, STNG_IDX, STCK_IDX};
 enum scope_type {NO_SCOPE=0, GLOBAL_SCOPE, OBJECT_SCOPE, FUNCTION_SCOPE};
+// bytecode operations produced by compiler.h (order must match the dispatch table in runtime.h)
+// the ones from OP_FIRST_FUSED on replace an OP_NAME heading a sequence, see peephole.h
+enum op_code {OP_NAME=0, OP_NUMB, OP_STNG, OP_DUP, OP_POP, OP_RET, OP_ASSIGN, OP_NEW,
+	OP_BIND, OP_CALL, OP_LOAD, OP_SELF, OP_LOOP, OP_ENDLOOP, OP_END, OP_ENTER,
+	OP_ARITH_IMM, OP_ARITH_VAR, OP_UPDATE_IMM, OP_UPDATE_VAR, OP_BRANCH_IMM, OP_BRANCH_VAR,
+	OP_CALL_STD, N_OPS};
+#define OP_FIRST_FUSED OP_ARITH_IMM
+// jump of an OP_CALL_STD (see devirtualize_env in analysis.h): standard function f of class c
+#define STD_CALL_JUMP(c, f) (((c) << 8) | (f))
+#define STD_CALL_CLASS(j) ((j) >> 8)
+#define STD_CALL_FUNC(j) ((j) & 0xff)
+// runtime checks verify.h proved can't fail, in instr_t.proven
+#define PROVEN_DEPTH 1 // the values the instruction pops (or copies) are on the stack
+#define PROVEN_TYPES 2 // its operands have the types it checks for, a number for the name of a /
+#define PROVEN_ARGS  4 // the ? calls an A function whose operands are there and are numbers
 
 typedef struct val val;
 typedef struct v_list v_list;
 typedef struct glass_env glass_env;
 typedef struct token_t token_t;
+typedef struct instr_t instr_t;
+typedef struct jit_state jit_state;
+typedef struct ic_t ic_t;
+typedef struct frame_t frame_t;
+typedef struct extra_var extra_var;
+typedef struct extra_vars extra_vars;
+typedef struct frame_chunk frame_chunk;
+typedef struct shape_t shape_t;
+typedef struct gc_heap gc_heap;
+typedef struct func_info func_info;
+typedef struct memo_table memo_table;
+typedef struct prof_state prof_state;
+typedef struct arena_chunk arena_chunk;
+typedef struct func_key func_key;
+typedef struct image_map image_map;
+typedef struct out_buffer out_buffer;
+typedef struct in_buffer in_buffer;
+typedef struct var_pool var_pool;
+typedef struct glass_trap glass_trap;
+typedef struct trace_event trace_event;
+typedef struct trace_ring trace_ring;
 
 // objects and functions can be on the stack, so we need structs for the relevant attributes
 // object structs have persistent state, function structs just have class and function names
 typedef struct object_t object_t;
 typedef struct func_t func_t;
 
+void trap_error(char* prefix, char* error_text);
 void glassdefs_error(char* error_text);
 
+void* grow_table(void* table, int* cap, int need, size_t size);
+char* arena_alloc(glass_env* env, size_t n);
 void free_env(glass_env env);
+void free_env_tables(glass_env env);
 
-int find_name(char** all_n, char* n);
-int add_name(char** all_n, enum scope_type* scopes, char* n);
+unsigned int hash_name(char* n);
+unsigned int hash_func_key(int class_i, int name);
+int find_name(glass_env* env, char* n);
+int add_name(glass_env* env, char* n);
+void func_hash_set(glass_env* env, int class_i, int name, int func_i);
 
 int get_class_idx(glass_env env, int class_name_idx);
 int get_func_idx(glass_env env, int class_name_idx, int func_name_idx);
@@ -45,18 +97,23 @@ struct func_t {
 	object_t* obj;
 };
 
+// values are a single tagged word, built and taken apart with the *_val and val_* functions below
+// the low VAL_TAG_BITS hold the val_type. NUMB and NAME keep their int in the upper 32 bits, the
+// bits in between are 0 except for the generation of a name made by V.n (see vars.h).
+// STNG and OBJT are heap pointers (8-byte aligned, so the tag bits are free). FUNC is the bound
+// object's pointer with the function index in the top 16 bits, the class being the object's class.
+// NO_VAL is all zeros
 struct val {
-	enum val_type type;
-
-	union {
-		int       numb;
-		int       name;
-		char*     stng;
-		object_t* objt;
-		func_t    func;
-	};
+	uint64_t bits;
 };
 
+#define VAL_TAG_BITS 3
+#define VAL_TAG_MASK ((uint64_t) 7)
+#define VAL_PTR_MASK ((uint64_t) 0x0000fffffffffff8) // pointers must fit in 48 bits
+#define VAL_FUNC_SHIFT 48
+#define VAL_FUNC_MAX 0xffff // largest function index a FUNC can hold
+#define VAL_INT_OFFSET 4 // byte offset of the int payload (little-endian), used by the JIT
+
 // data structure for the stack
 struct v_list {
 	int        last_i;
@@ -71,52 +128,268 @@ struct token_t {
 	int data;
 };
 
+// data structure for compiler output
+
+// op and proven are bytes so that an instruction stays 16 bytes
+struct instr_t {
+	unsigned char op;     // enum op_code
+	unsigned char proven; // checks the instruction can skip, PROVEN_* bits set by verify.h
+	int arg;  // decoded operand: name index, number, literal index, stack depth, IC index (. and !)
+	          // or tail call flag (?)
+	int jump; // absolute instruction index for loop ops, -1 otherwise (A function index for fused ops)
+	int tok;  // index of the token this instruction was compiled from (for errors)
+};
+
+// the op an instruction was compiled as, before peephole.h fused it
+static inline enum op_code base_op(enum op_code op) { return (op >= OP_FIRST_FUSED) ? OP_NAME : op; }
+// every function starts with an OP_ENTER whose arg is the number of local slots it needs and
+// whose jump is the offset of its sorted local names in env->local_names
+
+// activation of a user function: locals[i] holds the value of function-scope name names[i]
+// frames live on the frame stack right in front of their locals (see frame_push)
+struct frame_t {
+	object_t* obj;
+	val*      locals;
+	int*      names;
+	int       n_locals;
+	int       start; // index of the function's OP_ENTER
+	int       memo;  // the call goes into env->memo, its arguments are saved after the locals
+	frame_t*  prev;  // the caller's frame, live frames are chained for the collector
+	instr_t*  ret;   // instruction to resume in prev on return, NULL to return to C
+	extra_vars* extra; // local names outside names, NULL while there are none
+};
+
+// names a frame or object has no slot for, because they only reach its functions at run time (a
+// caller passes (_x) or (x) in and a function assigns it). Owned by the collector, see extra_target
+struct extra_var {
+	int name;
+	val v;
+};
+struct extra_vars {
+	int n;
+	int cap;
+	extra_var vars[];
+};
+
+// frames are bump-allocated from a stack of chunks, which never move once allocated
+struct frame_chunk {
+	frame_chunk* prev;
+	int used;
+	int cap;
+	val slots[];
+};
+
+// object layout of a class: vars[i] of an instance holds the value of object-scope name names[i]
+// only names that appear in the class's functions get a slot, the others go in the object's extra
+struct shape_t {
+	int  n_fields;
+	int* names; // sorted, points into env->field_names
+};
+
+// names and string literals are bump-allocated from a list of chunks, freed all at once
+struct arena_chunk {
+	arena_chunk* prev;
+	size_t used;
+	size_t cap;
+	char   data[];
+};
+
+// entry of the function hash table: function func_i of class class_i is named name
+struct func_key {
+	int class_i; // -1 if the slot is empty
+	int name;
+	int func_i;
+};
+
+// inline cache for one . or ! site, filled at runtime
+struct ic_t {
+	int n;             // number of filled entries
+	int key[IC_WAYS];  // receiver class index for ., class name for !
+	int name[IC_WAYS]; // function name for .
+	int res[IC_WAYS];  // resolved function index for ., class index for !
+};
+
 struct glass_env {
 	char**   names;     // all names defined in the program (for debug purposes)
 	enum scope_type* scopes; // each name has a scope (depends on first letter of name)
+	int      n_names;
+	int      names_cap; // room in names, scopes, name_class and global_vars
+	int*     name_hash; // open-addressing hash table of name indices (-1 is empty), see find_name
+	int      name_hash_cap; // number of slots in name_hash, a power of two
+	int*     name_class; // name_class[n] is the index of the class named n, -1 if none
+	int      n_classes;
+	int      classes_cap; // room in c_lookup, n_funcs, funcs_cap, f_lookup, f_locs and f_code
+	int*     n_funcs;   // n_funcs[c] is the number of functions of class c
+	int*     funcs_cap; // funcs_cap[c] is the room in f_lookup[c], f_locs[c] and f_code[c]
+	func_key* func_hash; // open-addressing hash table of (class, function name), see get_func_idx
+	int      func_hash_cap; // number of slots in func_hash, a power of two
+	int      n_func_keys;
 	int*     c_lookup;    // c_lookup[i] = n means the ith class has name n (in the name array)
 	int**    f_lookup;   // f_lookup[c][i] = n means the number ith function of the cth class has name n
 	int**    f_locs;    // f_locs[c][f] is index of first token of the fth function of cth class (after name)
-	token_t* tokens;  // array of tokens forming the program. 
+	token_t* tokens;  // array of tokens forming the program, terminated by a NO_TOKEN
+	int      n_tokens;
+	int      tokens_cap;
+	instr_t* code;    // bytecode for all user functions, filled out by compile_env
+	int      n_code;  // number of instructions in code
+	int*     c_ctor;  // c_ctor[c] is the function index of the constructor (c__) of class c, -1 if none
+	ic_t*    ics;     // inline caches, indexed by the arg of OP_BIND and OP_NEW instructions
+	int      n_ics;
+	int*     local_names; // sorted function-scope names of every function, see OP_ENTER
+	int**    f_code;  // f_code[c][f] is index of first instruction of the fth function of cth class
+	shape_t* shapes;  // shapes[c] is the object layout of class c
+	int*     field_names; // sorted object-scope names of every class, see shape_t
 
 	char** strings;   // array of all string literals used in program
+	int    n_strings;
+	int    strings_cap;
+	arena_chunk* arena; // memory of names and strings
+	image_map* image; // the precompiled image the tables above live in, NULL if parsed (see image.h)
 	val* global_vars; // for use during runtime
+	jit_state* jit;   // machine code state, NULL unless running with --jit
+	frame_chunk* frame_top;   // frame stack for local variables
+	frame_chunk* frame_spare; // an empty chunk kept for reuse
+	frame_t* frame;   // innermost live frame
+	gc_heap* gc;      // runtime heap for objects and strings, see gc.h
+	func_info* f_info; // f_info[start] describes the function whose OP_ENTER is at start, see analysis.h
+	memo_table* memo; // cached results of pure functions, NULL unless running with --memo
+	prof_state* prof; // call and instruction counters, NULL unless running with --profile
+	trace_ring* trace; // recent runtime events, NULL unless tracing (see trace.h)
+	out_buffer* out;  // where O writes, see output.h
+	in_buffer* in;    // where I reads from, see input.h
+	var_pool* vars;   // names made by V.n, NULL until the first one (see vars.h)
+	int peephole;     // run the fused instructions made by peephole.h, 0 to run what they replaced
 };
 
+// errors end the process, except while a trap is set on the thread (see libglass.c): then the
+// *_error functions leave their message in it and longjmp back to whoever set it
+struct glass_trap {
+	jmp_buf jump;
+	char    message[TRAP_MESSAGE_SIZE];
+};
+
+static __thread glass_trap* trap_live = NULL;
+
 struct object_t {
-	int class_i; // index of the class of which this is an instance
-	val vars[MAX_NAMES]; // object variables. For now, storage allocated for all variables
-	// TODO reduce overhead by only storing variables for names with scope=OBJECT_SCOPE
+	int class_i;       // index of the class of which this is an instance
+	extra_vars* extra; // object names outside the class's layout, NULL while there are none
+	val vars[];        // object variables, laid out by env->shapes[class_i]
 };
 
+static inline val no_val() { return (val) {0}; }
+static inline val numb_val(int n) { return (val) {((uint64_t) (uint32_t) n << 32) | NUMB}; }
+static inline val name_val(int n) { return (val) {((uint64_t) (uint32_t) n << 32) | NAME}; }
+static inline val stng_val(char* s) { return (val) {(uint64_t) (uintptr_t) s | STNG}; }
+static inline val objt_val(object_t* o) { return (val) {(uint64_t) (uintptr_t) o | OBJT}; }
+static inline val func_val(func_t f) {
+	// the class is implied by f.obj
+	return (val) {((uint64_t) f.func_i << VAL_FUNC_SHIFT) | (uint64_t) (uintptr_t) f.obj | FUNC};
+}
+
+static inline enum val_type val_tag(val v) { return (enum val_type) (v.bits & VAL_TAG_MASK); }
+static inline int val_numb(val v) { return (int) (int32_t) (v.bits >> 32); }
+static inline int val_name(val v) { return (int) (int32_t) (v.bits >> 32); }
+static inline void* val_ptr(val v) { return (void*) (uintptr_t) (v.bits & VAL_PTR_MASK); }
+static inline char* val_stng(val v) { return (char*) val_ptr(v); }
+static inline object_t* val_objt(val v) { return (object_t*) val_ptr(v); }
+static inline func_t val_func(val v) {
+	object_t* obj = val_objt(v);
+	return (func_t) {obj->class_i, (int) (v.bits >> VAL_FUNC_SHIFT), obj};
+}
+static inline int val_ptr_ok(void* p) {
+	// whether p can be stored in a val
+	return !((uint64_t) (uintptr_t) p & ~VAL_PTR_MASK);
+}
+
+void trap_error(char* prefix, char* error_text) {
+	// hand the error to the trap if there is one, returns otherwise
+	glass_trap* trap = trap_live;
+	if (!trap) return;
+	snprintf(trap->message, TRAP_MESSAGE_SIZE, "%s%s", prefix, error_text);
+	longjmp(trap->jump, 1);
+}
+
 void glassdefs_error(char* error_text) {
+	trap_error("Error in glassdefs.h: ", error_text);
 	fprintf(stderr, "Error in glassdefs.h: %s\n", error_text);
 	exit(1);
 }
 
+void* grow_table(void* table, int* cap, int need, size_t size) {
+	// make room for need entries of size bytes in table, which has room for *cap now
+	// doubles, so filling a table one entry at a time is amortized O(1). New entries are garbage
+	if (need <= *cap) return table;
+	int new_cap = *cap ? *cap : 1;
+	while (new_cap < need) new_cap *= 2;
+	table = realloc(table, (size_t) new_cap * size);
+	if (!table) glassdefs_error("grow_table: realloc failed");
+	*cap = new_cap;
+	return table;
+}
+
+char* arena_alloc(glass_env* env, size_t n) {
+	// n bytes that live as long as env
+	arena_chunk* ch = env->arena;
+	if (!ch || (ch->used + n > ch->cap)) {
+		size_t cap = (n > ARENA_CHUNK) ? n : ARENA_CHUNK;
+		arena_chunk* next = (arena_chunk*) malloc(sizeof (arena_chunk) + cap);
+		if (!next) glassdefs_error("arena_alloc: malloc failed");
+		*next = (arena_chunk) {ch, 0, cap};
+		env->arena = ch = next;
+	}
+	char* res = ch->data + ch->used;
+	ch->used += n;
+	return res;
+}
+
 void free_env(glass_env env) {
 	// free all the referenced memory in an env
+	// the tables of an env loaded from an image are mapped, image_unload releases them
+	if (!env.image) free_env_tables(env);
+
+	free(env.ics);
+	free(env.f_info);
+	while (env.frame_top) {
+		frame_chunk* prev = env.frame_top->prev;
+		free(env.frame_top);
+		env.frame_top = prev;
+	}
+	free(env.frame_spare);
+	free(env.global_vars);
+}
 
-	// can't free all names :( some are const char* from initialization
-	// TODO fix this leak
-	//for (int i = 0; env.names[i] && i < MAX_NAMES; i++) free(env.names[i]);
-	//free(env.names);
-
+void free_env_tables(glass_env env) {
+	// free what parse_file and compile_env built
+	free(env.names);
+	free(env.scopes);
+	free(env.name_hash);
+	free(env.name_class);
+	free(env.func_hash);
 	free(env.c_lookup);
 
-	for (int i = 0; (env.f_lookup[i] >= 0) && i < MAX_CLASSES; i++) {
+	for (int i = 0; i < env.n_classes; i++) {
 		free(env.f_lookup[i]);
 		free(env.f_locs[i]);
+		free(env.f_code[i]);
 	}
+	free(env.n_funcs);
+	free(env.funcs_cap);
 	free(env.f_lookup);
 	free(env.f_locs);
+	free(env.f_code);
 
 	free(env.tokens);
-	
-	for (int i = 0; env.strings[i] && i < MAX_LITERALS; i++) free(env.strings[i]);
+	free(env.code);
+	free(env.c_ctor);
+	free(env.local_names);
+	free(env.shapes);
+	free(env.field_names);
 	free(env.strings);
-	
-	free(env.global_vars);
+	while (env.arena) {
+		arena_chunk* prev = env.arena->prev;
+		free(env.arena);
+		env.arena = prev;
+	}
 }
 
 enum scope_type name_scope(char* n) {
@@ -127,45 +400,120 @@ enum scope_type name_scope(char* n) {
 	return NO_SCOPE;
 }
 
-int find_name(char** all_n, char* n) {
-	// finds name n (null-terminated) in all_n (NULL-terminated)
+unsigned int hash_name(char* n) {
+	// FNV-1a over the characters of a name
+	unsigned int h = 2166136261u;
+	for (; *n; n++) h = (h ^ (unsigned char) *n) * 16777619u;
+	return h;
+}
+
+void name_hash_insert(glass_env* env, int i) {
+	// place name index i in the open-addressing table (linear probing), no duplicate check
+	unsigned int mask = env->name_hash_cap - 1;
+	unsigned int slot = hash_name(env->names[i]) & mask;
+	while (env->name_hash[slot] >= 0) slot = (slot + 1) & mask;
+	env->name_hash[slot] = i;
+}
+
+void name_hash_grow(glass_env* env) {
+	// double the table and rehash every name
+	free(env->name_hash);
+	env->name_hash_cap *= 2;
+	env->name_hash = (int*) malloc(env->name_hash_cap * sizeof (int));
+	if (!env->name_hash) glassdefs_error("name_hash_grow: malloc failed");
+	for (int i = 0; i < env->name_hash_cap; i++) env->name_hash[i] = -1;
+	for (int i = 0; i < env->n_names; i++) name_hash_insert(env, i);
+}
+
+int find_name(glass_env* env, char* n) {
+	// finds name n (null-terminated) in env->names through the name hash table
 	// returns -1 on failure
-	for (int i = 0; all_n[i]; i++) {
-		if (!strcmp(all_n[i], n)) return i;
+	unsigned int mask = env->name_hash_cap - 1;
+	unsigned int slot = hash_name(n) & mask;
+	for (int i; (i = env->name_hash[slot]) >= 0; slot = (slot + 1) & mask) {
+		if (!strcmp(env->names[i], n)) return i;
 	}
 	return -1;
 }
 
-int add_name(char** all_n, enum scope_type* scopes, char* n) {
-	// adds the name to the end of all_n, returns the place it was added
+int add_name(glass_env* env, char* n) {
+	// adds the name to the end of env->names, returns the place it was added
 	// checks if name is already there, if so returns existing location
-	// allocates new memory for the name, sets all_n[i] pointer
+	// allocates new memory for the name, computes its scope once
 	// returns -1 on failure
-	int loc = find_name(all_n, n);
+	int loc = find_name(env, n);
 	if (loc >= 0) return loc;
-	int i = 0;
-	do {
-		if (!all_n[i]) {
-			// allocate space for the new name
-			all_n[i] = (char*) malloc((strlen(n) * sizeof (char)) + 1);
-			scopes[i] = name_scope(n);
-			strcpy(all_n[i], n);
-			return i;
+
+	if (env->n_names >= env->names_cap) {
+		// the tables indexed by name grow together
+		int cap = env->names_cap;
+		env->names = (char**) grow_table(env->names, &cap, env->n_names + 1, sizeof (char*));
+		cap = env->names_cap;
+		env->scopes = (enum scope_type*) grow_table(env->scopes, &cap, env->n_names + 1, sizeof (enum scope_type));
+		cap = env->names_cap;
+		env->name_class = (int*) grow_table(env->name_class, &cap, env->n_names + 1, sizeof (int));
+		cap = env->names_cap;
+		env->global_vars = (val*) grow_table(env->global_vars, &cap, env->n_names + 1, sizeof (val));
+		for (int j = env->names_cap; j < cap; j++) env->global_vars[j] = no_val();
+		env->names_cap = cap;
+	}
+
+	int i = env->n_names++;
+	env->names[i] = arena_alloc(env, strlen(n) + 1);
+	env->scopes[i] = name_scope(n);
+	strcpy(env->names[i], n);
+	env->name_class[i] = -1;
+
+	// keep the table at most half full
+	if (2 * env->n_names > env->name_hash_cap) name_hash_grow(env);
+	else name_hash_insert(env, i);
+	return i;
+}
+
+unsigned int hash_func_key(int class_i, int name) {
+	return ((unsigned int) class_i * 2654435761u) ^ ((unsigned int) name * 2246822519u);
+}
+
+void func_hash_insert(glass_env* env, func_key k) {
+	// place k in the open-addressing table (linear probing), replacing an entry with the same key
+	unsigned int mask = env->func_hash_cap - 1;
+	unsigned int slot = hash_func_key(k.class_i, k.name) & mask;
+	while (env->func_hash[slot].class_i >= 0) {
+		if ((env->func_hash[slot].class_i == k.class_i) && (env->func_hash[slot].name == k.name)) {
+			env->func_hash[slot].func_i = k.func_i;
+			return;
 		}
-		i++;
-	} while (i < MAX_NAMES);
-	return -1;
+		slot = (slot + 1) & mask;
+	}
+	env->func_hash[slot] = k;
+	env->n_func_keys++;
+}
+
+void func_hash_set(glass_env* env, int class_i, int name, int func_i) {
+	// function name of class class_i is now func_i (a later definition shadows an earlier one)
+	if (2 * (env->n_func_keys + 1) > env->func_hash_cap) {
+		// keep the table at most half full: double it and rehash
+		func_key* old = env->func_hash;
+		int old_cap = env->func_hash_cap;
+		env->func_hash_cap = old_cap ? 2 * old_cap : FUNC_HASH_INIT;
+		env->func_hash = (func_key*) malloc(env->func_hash_cap * sizeof (func_key));
+		if (!env->func_hash) glassdefs_error("func_hash_set: malloc failed");
+		for (int i = 0; i < env->func_hash_cap; i++) env->func_hash[i].class_i = -1;
+		env->n_func_keys = 0;
+		for (int i = 0; i < old_cap; i++) {
+			if (old[i].class_i >= 0) func_hash_insert(env, old[i]);
+		}
+		free(old);
+	}
+	func_hash_insert(env, (func_key) {class_i, name, func_i});
 }
 
 int get_class_idx(glass_env env, int class_name_idx) {
 	// given the name index of a suspected class, return the class' index in the env lookup
 	// returns -1 on failure
 	if (class_name_idx < 0) glassdefs_error("get_class_idx: bad class index input");
-	int res = -1;
-	for (int i = 0; (i < MAX_CLASSES) && (env.c_lookup[i]); i++) {
-		if (env.c_lookup[i] == class_name_idx) res = i;
-	}
-	return res;
+	if (class_name_idx >= env.n_names) return -1;
+	return env.name_class[class_name_idx];
 }
 
 int get_func_idx(glass_env env, int class_name_idx, int func_name_idx) {
@@ -175,11 +523,13 @@ int get_func_idx(glass_env env, int class_name_idx, int func_name_idx) {
 	if (func_name_idx < 0) glassdefs_error("get_func_idx: bad function index input");
 	int c_idx = get_class_idx(env, class_name_idx);
 	if (c_idx < 0) glassdefs_error("get_func_idx: no such class");
-	int res = -1;
-	for (int i = 0; (i < MAX_FUNCS) && (env.f_lookup[c_idx][i]); i++) {
-		if (env.f_lookup[c_idx][i] == func_name_idx) res = i;
+	unsigned int mask = env.func_hash_cap - 1;
+	unsigned int slot = hash_func_key(c_idx, func_name_idx) & mask;
+	for (; env.func_hash[slot].class_i >= 0; slot = (slot + 1) & mask) {
+		func_key k = env.func_hash[slot];
+		if ((k.class_i == c_idx) && (k.name == func_name_idx)) return k.func_i;
 	}
-	return res;
+	return -1;
 }
 
 void print_tok(token_t t) {
@@ -211,7 +561,7 @@ void print_tok(token_t t) {
 void print_tokens(token_t* t) {
 	// print a NO_TOKEN terminated array of tokens
 	int i = 0;
-	while(t[i].type != NO_TOKEN && i < MAX_PROGRAM) {
+	while(t[i].type != NO_TOKEN) {
 		print_tok(t[i]);
 		i++;
 	}
@@ -220,18 +570,18 @@ void print_tokens(token_t* t) {
 
 void print_val(val v) {
 	char* type_names[] = {"NO_VAL", "FUNC", "OBJT", "NUMB", "NAME", "STNG", "CMDS"};
-	printf("type-%s-val-", type_names[v.type]);
-	if ((v.type == NUMB) || (v.type == NAME)) {
-		printf("%d\n", v.numb);
+	printf("type-%s-val-", type_names[val_tag(v)]);
+	if ((val_tag(v) == NUMB) || (val_tag(v) == NAME)) {
+		printf("%d\n", val_numb(v));
 	}
-	else if (v.type == STNG) {
-		printf("%s\n", v.stng);
+	else if (val_tag(v) == STNG) {
+		printf("%s\n", val_stng(v));
 	}
-	else if (v.type == FUNC) {
-		printf("%d-%d\n", v.func.class_i, v.func.func_i);
+	else if (val_tag(v) == FUNC) {
+		printf("%d-%d\n", val_func(v).class_i, val_func(v).func_i);
 	}
-	else if (v.type == OBJT) {
-		printf("%p\n", (void *) v.objt);
+	else if (val_tag(v) == OBJT) {
+		printf("%p\n", (void *) val_objt(v));
 	}
 	else printf("none\n");
 }
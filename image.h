@@ -0,0 +1,311 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "glassdefs.h"
+#include "verify.h"
+
+// precompiled program images (glass --compile prog.gl -o prog.glc, then glass prog.glc)
+// an image holds everything parse_file and compile_env produce: names and their scopes and hash
+// table, the class and function tables, tokens, bytecode, frame and object layouts and string
+// literals. Sections are stored at 8-byte aligned offsets from the start of the file, and tables
+// that hold pointers in the env (names, strings, function rows, shapes) are stored as offsets,
+// so the image doesn't depend on where it is loaded.
+// image_load maps the file copy-on-write and points the env's tables straight into it. Only the
+// pointer tables are rebuilt (in one block), and the runtime state (globals, inline caches)
+// is allocated fresh. The proven bits of the bytecode aren't taken from the file: they are
+// cleared and verify_env works them out again, so an image can't make the runtime skip a check
+// (that writes the code's pages, nothing else is). Images are tied to the build that wrote
+// them: the header records the struct sizes and a version, anything else is rejected.
+
+#define IMAGE_MAGIC "GLASSIMG"
+#define IMAGE_VERSION 2 // bumped whenever the bytecode changes (new ops, instr_t fields)
+
+typedef struct image_header image_header;
+
+struct image_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t sizes; // sizeof token_t, instr_t, func_key and enum scope_type, a byte each
+	int32_t  n_names;
+	int32_t  name_hash_cap;
+	int32_t  n_classes;
+	int32_t  n_all_funcs; // functions of all classes together
+	int32_t  func_hash_cap;
+	int32_t  n_func_keys;
+	int32_t  n_tokens;
+	int32_t  n_code;
+	int32_t  n_ics;
+	int32_t  n_strings;
+	int32_t  n_local_names;
+	int32_t  n_field_names;
+	// section offsets
+	uint64_t name_offs;   // uint32 offset of each name in name_chars
+	uint64_t name_chars;
+	uint64_t scopes;
+	uint64_t name_class;
+	uint64_t name_hash;
+	uint64_t c_lookup;
+	uint64_t n_funcs;
+	uint64_t f_row;       // int32 index of each class's first function in f_lookup, f_locs, f_code
+	uint64_t f_lookup;
+	uint64_t f_locs;
+	uint64_t f_code;
+	uint64_t func_hash;
+	uint64_t c_ctor;
+	uint64_t tokens;
+	uint64_t code;
+	uint64_t local_names;
+	uint64_t field_names;
+	uint64_t n_fields;    // int32 per class
+	uint64_t field_row;   // int32 index of each class's field names in field_names
+	uint64_t string_offs;
+	uint64_t string_chars;
+};
+
+struct image_map {
+	void*  base; // the mapped file
+	size_t size;
+	void*  ptrs; // the rebuilt pointer tables
+};
+
+void image_error(char* error_text);
+
+uint32_t image_sizes();
+uint64_t image_put(FILE* f, const void* data, size_t size);
+void image_write(glass_env* env, char* filename);
+int image_is_image(char* filename);
+void* image_section(image_map* map, uint64_t off, size_t size);
+glass_env image_load(char* filename);
+void image_unload(glass_env* env);
+
+void image_error(char* error_text) {
+	trap_error("Error in image.h: ", error_text);
+	fprintf(stderr, "Error in image.h: %s\n", error_text);
+	exit(1);
+}
+
+uint32_t image_sizes() {
+	return (uint32_t) sizeof (token_t) | ((uint32_t) sizeof (instr_t) << 8)
+		| ((uint32_t) sizeof (func_key) << 16) | ((uint32_t) sizeof (enum scope_type) << 24);
+}
+
+uint64_t image_put(FILE* f, const void* data, size_t size) {
+	// append size bytes at the next 8-byte boundary, return their offset
+	static const char zeros[8] = {0};
+	long at = ftell(f);
+	if (at < 0) image_error("ftell failed in image_put");
+	if (at % 8) fwrite(zeros, 1, 8 - at % 8, f);
+	at = ftell(f);
+	if (size && (fwrite(data, 1, size, f) != size)) image_error("could not write image");
+	return (uint64_t) at;
+}
+
+void image_write(glass_env* env, char* filename) {
+	// write the parsed and compiled env to filename
+	FILE* f = fopen(filename, "wb");
+	if (!f) image_error("could not open image for writing");
+	image_header h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, IMAGE_MAGIC, 8);
+	h.version = IMAGE_VERSION;
+	h.sizes = image_sizes();
+	h.n_names = env->n_names;
+	h.name_hash_cap = env->name_hash_cap;
+	h.n_classes = env->n_classes;
+	h.func_hash_cap = env->func_hash_cap;
+	h.n_func_keys = env->n_func_keys;
+	h.n_tokens = env->n_tokens;
+	h.n_code = env->n_code;
+	h.n_ics = env->n_ics;
+	h.n_strings = env->n_strings;
+	// the header goes first, it is written again once the offsets are known
+	fwrite(&h, sizeof h, 1, f);
+
+	// names and literals: offsets into one block of terminated strings each
+	uint32_t* offs = (uint32_t*) malloc((env->n_names + env->n_strings + 1) * sizeof (uint32_t));
+	if (!offs) image_error("could not malloc in image_write");
+	size_t n_chars = 0;
+	for (int i = 0; i < env->n_names; i++) {
+		offs[i] = (uint32_t) n_chars;
+		n_chars += strlen(env->names[i]) + 1;
+	}
+	h.name_offs = image_put(f, offs, env->n_names * sizeof (uint32_t));
+	h.name_chars = image_put(f, NULL, 0);
+	for (int i = 0; i < env->n_names; i++) fwrite(env->names[i], 1, strlen(env->names[i]) + 1, f);
+	n_chars = 0;
+	for (int i = 0; i < env->n_strings; i++) {
+		offs[i] = (uint32_t) n_chars;
+		n_chars += strlen(env->strings[i]) + 1;
+	}
+	h.string_offs = image_put(f, offs, env->n_strings * sizeof (uint32_t));
+	h.string_chars = image_put(f, NULL, 0);
+	for (int i = 0; i < env->n_strings; i++) fwrite(env->strings[i], 1, strlen(env->strings[i]) + 1, f);
+	free(offs);
+
+	h.scopes = image_put(f, env->scopes, env->n_names * sizeof (enum scope_type));
+	h.name_class = image_put(f, env->name_class, env->n_names * sizeof (int));
+	h.name_hash = image_put(f, env->name_hash, env->name_hash_cap * sizeof (int));
+
+	// function tables, the rows of all classes one after the other
+	int* rows = (int*) malloc((2 * env->n_classes + 1) * sizeof (int));
+	if (!rows) image_error("could not malloc in image_write");
+	for (int c = 0; c < env->n_classes; c++) {
+		rows[c] = h.n_all_funcs;
+		h.n_all_funcs += env->n_funcs[c];
+	}
+	h.c_lookup = image_put(f, env->c_lookup, env->n_classes * sizeof (int));
+	h.n_funcs = image_put(f, env->n_funcs, env->n_classes * sizeof (int));
+	h.f_row = image_put(f, rows, env->n_classes * sizeof (int));
+	h.f_lookup = image_put(f, NULL, 0);
+	for (int c = 0; c < env->n_classes; c++) fwrite(env->f_lookup[c], sizeof (int), env->n_funcs[c], f);
+	h.f_locs = image_put(f, NULL, 0);
+	for (int c = 0; c < env->n_classes; c++) fwrite(env->f_locs[c], sizeof (int), env->n_funcs[c], f);
+	h.f_code = image_put(f, NULL, 0);
+	for (int c = 0; c < env->n_classes; c++) fwrite(env->f_code[c], sizeof (int), env->n_funcs[c], f);
+	h.func_hash = image_put(f, env->func_hash, env->func_hash_cap * sizeof (func_key));
+	h.c_ctor = image_put(f, env->c_ctor, env->n_classes * sizeof (int));
+
+	// program and bytecode, with the layouts compile_env carved out of local_names and field_names
+	h.tokens = image_put(f, env->tokens, (env->n_tokens + 1) * sizeof (token_t));
+	h.code = image_put(f, env->code, env->n_code * sizeof (instr_t));
+	for (int i = 0; i < env->n_code; i++) {
+		instr_t* ins = env->code + i;
+		if ((ins->op == OP_ENTER) && (ins->jump + ins->arg > h.n_local_names)) h.n_local_names = ins->jump + ins->arg;
+	}
+	h.local_names = image_put(f, env->local_names, h.n_local_names * sizeof (int));
+	for (int c = 0; c < env->n_classes; c++) {
+		shape_t* shape = env->shapes + c;
+		rows[env->n_classes + c] = (int) (shape->names - env->field_names);
+		if (rows[env->n_classes + c] + shape->n_fields > h.n_field_names) h.n_field_names = rows[env->n_classes + c] + shape->n_fields;
+		rows[c] = shape->n_fields;
+	}
+	h.field_names = image_put(f, env->field_names, h.n_field_names * sizeof (int));
+	h.n_fields = image_put(f, rows, env->n_classes * sizeof (int));
+	h.field_row = image_put(f, rows + env->n_classes, env->n_classes * sizeof (int));
+	free(rows);
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(&h, sizeof h, 1, f);
+	if (fclose(f)) image_error("could not write image");
+}
+
+int image_is_image(char* filename) {
+	// whether filename starts like an image (rather than Glass source)
+	char magic[8];
+	FILE* f = fopen(filename, "rb");
+	if (!f) return 0;
+	int res = (fread(magic, 1, 8, f) == 8) && !memcmp(magic, IMAGE_MAGIC, 8);
+	fclose(f);
+	return res;
+}
+
+void* image_section(image_map* map, uint64_t off, size_t size) {
+	// pointer to the section at off, checked to lie within the file
+	if ((off > map->size) || (size > map->size - off)) image_error("image is truncated or corrupt");
+	return (char*) map->base + off;
+}
+
+glass_env image_load(char* filename) {
+	// map the image at filename and make an env of it, ready to run
+	glass_env res;
+	memset(&res, 0, sizeof res);
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) image_error("could not open image");
+	struct stat st;
+	if (fstat(fd, &st) || (st.st_size < (off_t) sizeof (image_header))) image_error("image is truncated or corrupt");
+	image_map* map = (image_map*) malloc(sizeof (image_map));
+	if (!map) image_error("could not malloc in image_load");
+	map->size = st.st_size;
+	map->base = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->base == MAP_FAILED) image_error("could not mmap image");
+	image_header* h = (image_header*) map->base;
+	if (memcmp(h->magic, IMAGE_MAGIC, 8) || (h->version != IMAGE_VERSION) || (h->sizes != image_sizes())) {
+		image_error("image was written by a different build of glass");
+	}
+	res.image = map;
+
+	res.n_names = h->n_names;
+	res.names_cap = h->n_names;
+	res.scopes = (enum scope_type*) image_section(map, h->scopes, h->n_names * sizeof (enum scope_type));
+	res.name_class = (int*) image_section(map, h->name_class, h->n_names * sizeof (int));
+	res.name_hash = (int*) image_section(map, h->name_hash, h->name_hash_cap * sizeof (int));
+	res.name_hash_cap = h->name_hash_cap;
+	res.n_classes = h->n_classes;
+	res.classes_cap = h->n_classes;
+	res.c_lookup = (int*) image_section(map, h->c_lookup, h->n_classes * sizeof (int));
+	res.n_funcs = (int*) image_section(map, h->n_funcs, h->n_classes * sizeof (int));
+	res.funcs_cap = res.n_funcs;
+	res.func_hash = (func_key*) image_section(map, h->func_hash, h->func_hash_cap * sizeof (func_key));
+	res.func_hash_cap = h->func_hash_cap;
+	res.n_func_keys = h->n_func_keys;
+	res.c_ctor = (int*) image_section(map, h->c_ctor, h->n_classes * sizeof (int));
+	res.tokens = (token_t*) image_section(map, h->tokens, (h->n_tokens + 1) * sizeof (token_t));
+	res.n_tokens = h->n_tokens;
+	res.tokens_cap = h->n_tokens + 1;
+	res.code = (instr_t*) image_section(map, h->code, h->n_code * sizeof (instr_t));
+	res.n_code = h->n_code;
+	res.n_ics = h->n_ics;
+	res.local_names = (int*) image_section(map, h->local_names, h->n_local_names * sizeof (int));
+	res.field_names = (int*) image_section(map, h->field_names, h->n_field_names * sizeof (int));
+	res.n_strings = h->n_strings;
+	res.strings_cap = h->n_strings;
+
+	// the pointer tables, all in one block
+	size_t n_ptrs = h->n_names + h->n_strings + 3 * h->n_classes;
+	map->ptrs = malloc(n_ptrs * sizeof (void*) + h->n_classes * sizeof (shape_t) + 1);
+	if (!map->ptrs) image_error("could not malloc pointer tables in image_load");
+	res.shapes = (shape_t*) map->ptrs;
+	res.names = (char**) (res.shapes + h->n_classes);
+	res.strings = res.names + h->n_names;
+	res.f_lookup = (int**) (res.strings + h->n_strings);
+	res.f_locs = res.f_lookup + h->n_classes;
+	res.f_code = res.f_locs + h->n_classes;
+
+	uint32_t* offs = (uint32_t*) image_section(map, h->name_offs, h->n_names * sizeof (uint32_t));
+	for (int i = 0; i < h->n_names; i++) res.names[i] = (char*) image_section(map, h->name_chars + offs[i], 1);
+	offs = (uint32_t*) image_section(map, h->string_offs, h->n_strings * sizeof (uint32_t));
+	for (int i = 0; i < h->n_strings; i++) res.strings[i] = (char*) image_section(map, h->string_chars + offs[i], 1);
+
+	int* f_row = (int*) image_section(map, h->f_row, h->n_classes * sizeof (int));
+	int* f_lookup = (int*) image_section(map, h->f_lookup, h->n_all_funcs * sizeof (int));
+	int* f_locs = (int*) image_section(map, h->f_locs, h->n_all_funcs * sizeof (int));
+	int* f_code = (int*) image_section(map, h->f_code, h->n_all_funcs * sizeof (int));
+	int* n_fields = (int*) image_section(map, h->n_fields, h->n_classes * sizeof (int));
+	int* field_row = (int*) image_section(map, h->field_row, h->n_classes * sizeof (int));
+	for (int c = 0; c < h->n_classes; c++) {
+		res.f_lookup[c] = f_lookup + f_row[c];
+		res.f_locs[c] = f_locs + f_row[c];
+		res.f_code[c] = f_code + f_row[c];
+		res.shapes[c] = (shape_t) {n_fields[c], res.field_names + field_row[c]};
+	}
+
+	// the runtime only trusts proven bits verify.h set in this process
+	for (int i = 0; i < res.n_code; i++) res.code[i].proven = 0;
+	verify_env(&res);
+
+	// runtime state
+	res.global_vars = (val*) calloc(h->n_names + 1, sizeof (val)); // all NO_VAL
+	res.ics = (ic_t*) calloc(h->n_ics + 1, sizeof (ic_t));
+	if (!res.global_vars || !res.ics) image_error("could not malloc runtime state in image_load");
+	return res;
+}
+
+void image_unload(glass_env* env) {
+	// unmap the image behind env, after free_env
+	image_map* map = env->image;
+	if (!map) return;
+	munmap(map->base, map->size);
+	free(map->ptrs);
+	free(map);
+	env->image = NULL;
+}
+
+#endif
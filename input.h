@@ -0,0 +1,168 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "glassdefs.h"
+#include "gc.h"
+#include "output.h"
+
+// buffered program input for the I class
+// when stdin is a regular file the rest of it is mapped once and I reads straight from the mapping,
+// otherwise it's read in large blocks into a buffer that doubles whenever a single line outgrows it.
+// either way a line or character costs a memchr and a copy, never a syscall of its own.
+// the program's output is flushed before every read that could block, so prompts show up.
+// I.l pushes the next line including its newline (the last line may have none), I.c the next
+// character and I.e 1 once the input is used up. At the end I.l and I.c push the empty string.
+// an embedder can supply the input through a function instead, see in_init_callback
+
+#define IN_BUFFER_SIZE (64 << 10)
+
+struct in_buffer {
+	char*  buff;   // the mapping or the read buffer
+	size_t pos;    // next unread byte of buff
+	size_t end;    // bytes of buff holding input
+	size_t size;   // capacity of the read buffer
+	size_t map_size; // length of the mapping, 0 if reading
+	int    fd;
+	int    eof;    // nothing more will come from fd
+	long (*read)(void* user, char* buff, size_t len); // reads instead of fd if set
+	void*  user;
+};
+
+void input_error(char* error_text);
+
+void in_init(glass_env* env, int fd);
+void in_init_callback(glass_env* env, long (*read)(void* user, char* buff, size_t len), void* user);
+void in_free(glass_env* env);
+int in_fill(glass_env* env);
+char* in_line(glass_env* env);
+char* in_char(glass_env* env);
+int in_end(glass_env* env);
+
+void input_error(char* error_text) {
+	trap_error("Error in input.h: ", error_text);
+	fprintf(stderr, "Error in input.h: %s\n", error_text);
+	exit(1);
+}
+
+void in_init(glass_env* env, int fd) {
+	in_buffer* in = (in_buffer*) malloc(sizeof (in_buffer));
+	if (!in) input_error("could not malloc input buffer");
+	in->buff = NULL;
+	in->pos = 0;
+	in->end = 0;
+	in->size = 0;
+	in->map_size = 0;
+	in->fd = fd;
+	in->eof = 0;
+	in->read = NULL;
+	in->user = NULL;
+	env->in = in;
+
+	// map what's left of a regular file, from wherever the shell left the offset
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) return;
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if ((offset < 0) || (st.st_size <= offset)) return;
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return; // the read buffer still works
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	in->buff = (char*) map;
+	in->map_size = st.st_size;
+	in->pos = offset;
+	in->end = st.st_size;
+	in->eof = 1;
+}
+
+void in_init_callback(glass_env* env, long (*read)(void* user, char* buff, size_t len), void* user) {
+	// input comes from read(user, buff, len), which returns like read(2) does
+	// a NULL read is an empty input
+	in_init(env, -1);
+	env->in->read = read;
+	env->in->user = user;
+	if (!read) env->in->eof = 1;
+}
+
+void in_free(glass_env* env) {
+	in_buffer* in = env->in;
+	if (!in) return;
+	if (in->map_size) munmap(in->buff, in->map_size);
+	else free(in->buff);
+	free(in);
+	env->in = NULL;
+}
+
+int in_fill(glass_env* env) {
+	// read another block after the unread bytes, returns how many bytes came in (0 at the end)
+	in_buffer* in = env->in;
+	if (in->eof) return 0;
+	size_t left = in->end - in->pos;
+	if (in->pos) {
+		memmove(in->buff, in->buff + in->pos, left);
+		in->pos = 0;
+		in->end = left;
+	}
+	if (in->end == in->size) {
+		size_t size = in->size ? 2 * in->size : IN_BUFFER_SIZE;
+		char* buff = (char*) realloc(in->buff, size);
+		if (!buff) input_error("could not grow input buffer");
+		in->buff = buff;
+		in->size = size;
+	}
+	// the read may wait on a terminal or pipe, everything printed so far should be out by then
+	if (env->out) out_flush(env->out);
+	for (;;) {
+		ssize_t n = in->read ? in->read(in->user, in->buff + in->end, in->size - in->end)
+			: read(in->fd, in->buff + in->end, in->size - in->end);
+		if (n > 0) {
+			in->end += n;
+			return (int) n;
+		}
+		if ((n < 0) && (errno == EINTR)) continue;
+		// errors end the input like end of file does
+		in->eof = 1;
+		return 0;
+	}
+}
+
+char* in_line(glass_env* env) {
+	// the next line as a new string, newline included, "" at the end of the input
+	in_buffer* in = env->in;
+	size_t scanned = 0; // unread bytes already known not to hold a newline
+	char* nl = NULL;
+	for (;;) {
+		size_t left = in->end - in->pos;
+		if (left > scanned) {
+			nl = (char*) memchr(in->buff + in->pos + scanned, '\n', left - scanned);
+			if (nl) break;
+			scanned = left;
+		}
+		if (!in_fill(env)) break;
+	}
+	size_t len = nl ? (size_t) (nl - (in->buff + in->pos)) + 1 : in->end - in->pos;
+	if (!len) return env->gc->chars[0];
+	char* res = gc_new_string(env, len);
+	memcpy(res, in->buff + in->pos, len);
+	in->pos += len;
+	return res;
+}
+
+char* in_char(glass_env* env) {
+	// the next character as a (static) single-character string, "" at the end of the input
+	in_buffer* in = env->in;
+	if ((in->pos == in->end) && !in_fill(env)) return env->gc->chars[0];
+	return env->gc->chars[(unsigned char) in->buff[in->pos++]];
+}
+
+int in_end(glass_env* env) {
+	// whether the input is used up, may wait for more to find out
+	in_buffer* in = env->in;
+	return (in->pos == in->end) && !in_fill(env);
+}
+
+#endif
@@ -0,0 +1,994 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "glassdefs.h"
+#include "gc.h"
+
+// optional template JIT for x86-64 (glass --jit prog.gl)
+// once a function has been called or has looped JIT_THRESHOLD times, its bytecode is translated
+// by stitching together pre-assembled machine-code templates. The place of every local, field
+// and global name is known when a function is compiled (frame and object layouts are fixed, see
+// compiler.h), so pushes of constants, (x)* loads, (x)...= stores, loop heads, pops and A
+// arithmetic (devirtualized (o)f.? and the fused instructions of peephole.h) are done inline,
+// with a check of each value's tag. When a check fails the code goes to the general case: a call
+// to a helper doing the instruction's work, or for fused instructions the instructions they
+// stand for, which are compiled right after them like any others. Everything else is a helper
+// call with the decoded operand loaded as an immediate, plus native jumps for loops and returns.
+// the compiler follows the names pushed on the stack since the last jump target, so an = whose
+// name is known stores straight into the variable, and proven bits (see verify.h) drop checks.
+// The machine code works on the same stack, locals and object as the interpreter, so execution
+// can switch over at any loop head.
+// calls to user functions (and constructors) leave the machine code: jit_run returns the index of
+// the instruction making the call, the interpreter runs it on its own call stack and comes back
+// into the machine code after the callee returns, so Glass calls never nest on the C stack.
+// functions the JIT can't translate (unknown ops, full buffer, other platforms) stay interpreted.
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#define JIT_THRESHOLD 64
+#define JIT_BUFFER_SIZE (4 << 20)
+#define JIT_MAX_INSTR_BYTES 320 // no template sequence for one instruction is longer than this
+#define JIT_TRACK 16 // values on top of the stack the compiler follows, see jit_compile
+
+// where jit_var found a name
+#define JIT_VAR_NONE   0 // not known when compiling (V.n names, names the layout lacks)
+#define JIT_VAR_LOCAL  1 // in the frame's locals
+#define JIT_VAR_FIELD  2 // in the frame's object
+#define JIT_VAR_GLOBAL 3 // in env->global_vars
+
+typedef struct jit_ctx jit_ctx;
+
+// machine code gets a pointer to this in rbx for its whole run
+struct jit_ctx {
+	glass_env* env;
+	v_list*    stack;
+	frame_t*   fr;
+	int        resume; // instruction for the interpreter to continue at, -1 if the function returned
+};
+
+struct jit_state {
+	unsigned char* buff; // executable buffer, trampoline first
+	size_t used;
+	size_t size;
+	int    n_code;
+	void** entry;        // entry[i] is the machine code for instruction i, NULL if not compiled
+	int*   heat;         // heat[i] counts calls and loop iterations of the function starting at i
+	char*  failed;       // failed[i] is set if the function starting at i can't be compiled
+};
+
+void jit_error(char* error_text);
+
+void jit_init(glass_env* env);
+void jit_free(glass_env* env);
+int jit_compile(glass_env* env, int start);
+void* jit_function_entry(glass_env* env, int start);
+void* jit_loop_entry(glass_env* env, int start, int head);
+int jit_run(glass_env* env, void* entry, v_list* stack, frame_t* fr);
+
+void jit_error(char* error_text) {
+	trap_error("Error in jit.h: ", error_text);
+	fprintf(stderr, "Error in jit.h: %s\n", error_text);
+	exit(1);
+}
+
+// helpers called from the templates, all take the context and the decoded operand
+// (the instruction index for . ! and ?, which need their inline cache or to set resume, unused
+// by the ones that take none)
+// helpers returning int ask to leave the machine code when they return nonzero
+
+void jit_op_name(jit_ctx* c, int arg) { push(c->stack, name_val(arg)); }
+void jit_op_numb(jit_ctx* c, int arg) { push(c->stack, numb_val(arg)); }
+void jit_op_stng(jit_ctx* c, int arg) { push(c->stack, stng_val(c->env->gc->literals[arg])); }
+void jit_op_pop(jit_ctx* c, int arg) { (void) arg; pop(c->stack); }
+void jit_op_assign(jit_ctx* c, int proven) {
+	if (!(proven & PROVEN_DEPTH)) {
+		exec_assign(c->env, c->stack, c->fr);
+		return;
+	}
+	v_list* stack = c->stack;
+	stack->last_i -= 2;
+	*get_name_target(c->env, c->fr, stack->vs[stack->last_i + 1]) = stack->vs[stack->last_i + 2];
+}
+int jit_op_new(jit_ctx* c, int i) {
+	// objects with a constructor are left to the interpreter, which has to push a frame
+	v_list* stack = c->stack;
+	if (stack->last_i < 1) runtime_error("cannot pop from empty stack");
+	val cn = stack->vs[stack->last_i];
+	if (val_tag(cn) == NAME) {
+		int class_i = ic_find_class(c->env, c->env->ics + c->env->code[i].arg, val_name(cn));
+		if ((class_i >= STD_LIBS) && (c->env->c_ctor[class_i] >= 0)) {
+			c->resume = i;
+			return 1;
+		}
+	}
+	exec_new(c->env, stack, c->fr, c->env->code + i);
+	return 0;
+}
+void jit_op_bind(jit_ctx* c, int i) { exec_bind(c->env, c->stack, c->fr, c->env->code + i); }
+int jit_op_call(jit_ctx* c, int i) {
+	// standard functions run right here, user functions in the interpreter
+	v_list* stack = c->stack;
+	if (stack->last_i < 0) runtime_error("cannot pop from empty stack");
+	val f = stack->vs[stack->last_i];
+	if ((val_tag(f) == FUNC) && (val_func(f).class_i < STD_LIBS)) {
+		exec_call(c->env, stack);
+		return 0;
+	}
+	c->resume = i;
+	return 1;
+}
+void jit_op_load(jit_ctx* c, int arg) { (void) arg; exec_load(c->env, c->stack, c->fr); }
+void jit_op_load_name(jit_ctx* c, int name) {
+	// (x)* where the inline load found x unset, for the error
+	push(c->stack, name_val(name));
+	exec_load(c->env, c->stack, c->fr);
+}
+void jit_push(jit_ctx* c, uint64_t bits) { push(c->stack, (val) {bits}); }
+void jit_op_self(jit_ctx* c, int arg) { (void) arg; exec_self(c->env, c->stack, c->fr); }
+int jit_op_loop(jit_ctx* c, int name) { return loop_condition(c->env, c->fr, name, 0); }
+
+void jit_op_dup(jit_ctx* c, int arg) {
+	v_list* stack = c->stack;
+	if (stack->last_i < arg) runtime_error("duplicate call overshoots stack");
+	push(stack, stack->vs[stack->last_i - arg]);
+}
+
+int jit_op_call_std(jit_ctx* c, int i) {
+	// OP_CALL_STD at i: returns 0, having done nothing, when o doesn't hold an object and the
+	// (o)f.? it stands for has to run as it is (see the interpreter)
+	instr_t* ins = c->env->code + i;
+	val o = *get_name_target(c->env, c->fr, name_val(ins->arg));
+	if (val_tag(o) != OBJT) return 0;
+	int class_i = STD_CALL_CLASS(ins->jump);
+	if (!class_i) execute_A_function(STD_CALL_FUNC(ins->jump), c->stack);
+	else execute_std_function(c->env, (func_t) {class_i, STD_CALL_FUNC(ins->jump), val_objt(o)}, c->stack);
+	return 1;
+}
+
+int jit_op_bind_call(jit_ctx* c, int i) {
+	// . immediately followed by ? : resolve and run without the FUNC round trip through the stack
+	// a user function goes back on the stack for the interpreter to run the ?
+	func_t f = resolve_bind(c->env, c->stack, c->fr, c->env->code + i);
+	if (f.class_i < STD_LIBS) {
+		execute_std_function(c->env, f, c->stack);
+		return 0;
+	}
+	push(c->stack, func_val(f));
+	c->resume = i + 1;
+	return 1;
+}
+
+#ifdef JIT_SUPPORTED
+
+// templates. rbx holds the jit_ctx*, the stack is 16-byte aligned between templates
+static const unsigned char jit_tpl_trampoline[] = {
+	0x53,                               // push rbx
+	0x48, 0x89, 0xfb,                   // mov rbx, rdi
+	0xff, 0xe6                          // jmp rsi
+};
+static const unsigned char jit_tpl_helper[] = {
+	0x48, 0x89, 0xdf,                   // mov rdi, rbx
+	0xbe, 0, 0, 0, 0,                   // mov esi, imm32 (operand)
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov rax, imm64 (helper address)
+	0xff, 0xd0                          // call rax
+};
+#define JIT_HELPER_ARG 4
+#define JIT_HELPER_FUNC 10
+static const unsigned char jit_tpl_branch_false[] = {
+	0x85, 0xc0,                         // test eax, eax
+	0x0f, 0x84, 0, 0, 0, 0              // jz rel32
+};
+#define JIT_BRANCH_REL 4
+static const unsigned char jit_tpl_jump[] = {
+	0xe9, 0, 0, 0, 0                    // jmp rel32
+};
+#define JIT_JUMP_REL 1
+// push of a NUMB or NAME constant, inlined: bump last_i and store unless the stack has to grow,
+// in which case the helper call that follows does the whole push. Displacements are patched
+// from offsetof so the template tracks the v_list/val layout. The value is stored as two dwords,
+// the tag and the int payload (see struct val)
+static const unsigned char jit_tpl_push_const[] = {
+	0x48, 0x8b, 0x7b, 0,                // mov rdi, [rbx + ctx.stack]
+	0x8b, 0x47, 0,                      // mov eax, [rdi + last_i]
+	0xff, 0xc0,                         // inc eax
+	0x48, 0x63, 0xc8,                   // movsxd rcx, eax
+	0x48, 0x69, 0xc9, 0, 0, 0, 0,       // imul rcx, rcx, sizeof (val)
+	0x48, 0x3b, 0x4f, 0,                // cmp rcx, [rdi + alloc]
+	0x73, 0x16,                         // jae slow, the helper template right after this one
+	0x89, 0x47, 0,                      // mov [rdi + last_i], eax
+	0x48, 0x03, 0x4f, 0,                // add rcx, [rdi + vs]
+	0xc7, 0x01, 0, 0, 0, 0,             // mov dword [rcx], tag
+	0xc7, 0x41, 0, 0, 0, 0, 0,          // mov dword [rcx + VAL_INT_OFFSET], operand
+	0xeb, 0x14                          // jmp over the helper template
+};
+#define JIT_PUSH_CTX_STACK 3
+#define JIT_PUSH_LAST_I 6
+#define JIT_PUSH_VAL_SIZE 15
+#define JIT_PUSH_ALLOC 22
+#define JIT_PUSH_STORE_LAST_I 27
+#define JIT_PUSH_VS 31
+#define JIT_PUSH_TYPE 34
+#define JIT_PUSH_NUMB_OFF 40
+#define JIT_PUSH_OPERAND 41
+static const unsigned char jit_tpl_exit_if[] = {
+	0x85, 0xc0,                         // test eax, eax
+	0x74, 0x02,                         // jz over the return
+	0x5b,                               // pop rbx
+	0xc3                                // ret
+};
+static const unsigned char jit_tpl_return[] = {
+	0x5b,                               // pop rbx
+	0xc3                                // ret
+};
+static const unsigned char jit_tpl_jump_if[] = {
+	0x85, 0xc0,                         // test eax, eax
+	0x0f, 0x85, 0, 0, 0, 0              // jnz rel32
+};
+#define JIT_JUMP_IF_REL 4
+// variables whose place jit_var found: rcx gets the base, the value is at [rcx + disp32].
+// Locals are in the frame, fields in the frame's object (always of the function's class) and
+// globals at a fixed address
+static const unsigned char jit_tpl_frame_base[] = {
+	0x48, 0x8b, 0x4b, 0,                // mov rcx, [rbx + ctx.fr]
+	0x48, 0x8b, 0x49, 0                 // mov rcx, [rcx + frame.locals or frame.obj]
+};
+#define JIT_BASE_CTX_FR 3
+#define JIT_BASE_FRAME 7
+static const unsigned char jit_tpl_global_base[] = {
+	0x48, 0xb9, 0, 0, 0, 0, 0, 0, 0, 0  // mov rcx, imm64 (address of the global)
+};
+#define JIT_GLOBAL_ADDR 2
+static const unsigned char jit_tpl_var_load[] = {
+	0x48, 0x8b, 0x81, 0, 0, 0, 0        // mov rax, [rcx + disp32]
+};
+static const unsigned char jit_tpl_var_store[] = {
+	0x48, 0x89, 0x81, 0, 0, 0, 0        // mov [rcx + disp32], rax
+};
+#define JIT_VAR_DISP 3
+// checks of the value in rax, jumping to the general case when they fail
+static const unsigned char jit_tpl_check_set[] = {
+	0xa8, 0,                            // test al, VAL_TAG_MASK
+	0x0f, 0x84, 0, 0, 0, 0              // jz rel32
+};
+#define JIT_SET_MASK 1
+#define JIT_SET_REL 4
+static const unsigned char jit_tpl_check_tag[] = {
+	0x89, 0xc2,                         // mov edx, eax
+	0x83, 0xe2, 0,                      // and edx, VAL_TAG_MASK
+	0x83, 0xfa, 0,                      // cmp edx, tag
+	0x0f, 0x85, 0, 0, 0, 0              // jne rel32
+};
+#define JIT_TAG_MASK 4
+#define JIT_TAG_TAG 7
+#define JIT_TAG_REL 10
+static const unsigned char jit_tpl_check_class[] = {
+	0x48, 0xb9, 0, 0, 0, 0, 0, 0, 0, 0, // mov rcx, VAL_PTR_MASK
+	0x48, 0x21, 0xc8,                   // and rax, rcx
+	0x83, 0x78, 0, 0,                   // cmp dword [rax + object.class_i], class
+	0x0f, 0x85, 0, 0, 0, 0              // jne rel32
+};
+#define JIT_CLASS_MASK 2
+#define JIT_CLASS_OFF 15
+#define JIT_CLASS_CLASS 16
+#define JIT_CLASS_REL 19
+// numbers: the int payload of a NUMB in rax to eax and back
+static const unsigned char jit_tpl_numb_int[] = {
+	0x48, 0xc1, 0xe8, 0                 // shr rax, 8 * VAL_INT_OFFSET
+};
+#define JIT_INT_SHIFT 3
+static const unsigned char jit_tpl_int_numb[] = {
+	0x48, 0xc1, 0xe0, 0,                // shl rax, 8 * VAL_INT_OFFSET
+	0x48, 0x83, 0xc8, 0                 // or rax, NUMB
+};
+#define JIT_NUMB_SHIFT 3
+#define JIT_NUMB_TAG 7
+// A functions take x in eax and y in ecx, x waits in r8d while y is fetched
+static const unsigned char jit_tpl_save_x[] = {
+	0x41, 0x89, 0xc0                    // mov r8d, eax
+};
+static const unsigned char jit_tpl_restore_x[] = {
+	0x44, 0x89, 0xc0                    // mov eax, r8d
+};
+static const unsigned char jit_tpl_y_var[] = {
+	0x89, 0xc1                          // mov ecx, eax
+};
+static const unsigned char jit_tpl_y_imm[] = {
+	0xb9, 0, 0, 0, 0                    // mov ecx, imm32
+};
+#define JIT_Y_IMM 1
+// the two-operand A functions on eax and ecx, result in eax, by index as in a_apply (length first)
+static const unsigned char jit_tpl_a_ops[12][9] = {
+	{2, 0x01, 0xc8},                                    // add eax, ecx
+	{2, 0x29, 0xc8},                                    // sub eax, ecx
+	{3, 0x0f, 0xaf, 0xc1},                              // imul eax, ecx
+	{3, 0x99, 0xf7, 0xf9},                              // cdq; idiv ecx
+	{5, 0x99, 0xf7, 0xf9, 0x89, 0xd0},                  // cdq; idiv ecx; mov eax, edx
+	{0},                                                // f has one operand
+	{8, 0x39, 0xc8, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0}, // cmp eax, ecx; sete al; movzx eax, al
+	{8, 0x39, 0xc8, 0x0f, 0x95, 0xc0, 0x0f, 0xb6, 0xc0}, // setne
+	{8, 0x39, 0xc8, 0x0f, 0x9c, 0xc0, 0x0f, 0xb6, 0xc0}, // setl
+	{8, 0x39, 0xc8, 0x0f, 0x9e, 0xc0, 0x0f, 0xb6, 0xc0}, // setle
+	{8, 0x39, 0xc8, 0x0f, 0x9f, 0xc0, 0x0f, 0xb6, 0xc0}, // setg
+	{8, 0x39, 0xc8, 0x0f, 0x9d, 0xc0, 0x0f, 0xb6, 0xc0}  // setge
+};
+// the top of the stack: rdi is the v_list, rdx last_i and rsi points at the top value
+static const unsigned char jit_tpl_stack_top[] = {
+	0x48, 0x8b, 0x7b, 0,                // mov rdi, [rbx + ctx.stack]
+	0x48, 0x63, 0x57, 0,                // movsxd rdx, dword [rdi + last_i]
+	0x48, 0x8b, 0x77, 0,                // mov rsi, [rdi + vs]
+	0x48, 0x8d, 0x34, 0xd6              // lea rsi, [rsi + rdx * 8]
+};
+#define JIT_TOP_CTX_STACK 3
+#define JIT_TOP_LAST_I 7
+#define JIT_TOP_VS 11
+static const unsigned char jit_tpl_check_depth[] = {
+	0x83, 0xfa, 0,                      // cmp edx, values needed - 1
+	0x0f, 0x8c, 0, 0, 0, 0              // jl rel32
+};
+#define JIT_DEPTH_N 2
+#define JIT_DEPTH_REL 5
+static const unsigned char jit_tpl_stack_load[] = {
+	0x48, 0x8b, 0x46, 0                 // mov rax, [rsi + disp8]
+};
+#define JIT_STACK_DISP 3
+static const unsigned char jit_tpl_a_operands[] = {
+	0x8b, 0x46, 0,                      // mov eax, [rsi + disp8] (x, below the top)
+	0x8b, 0x4e, 0                       // mov ecx, [rsi + disp8] (y, on top)
+};
+#define JIT_OPERAND_X 2
+#define JIT_OPERAND_Y 5
+static const unsigned char jit_tpl_a_result[] = {
+	0x48, 0x89, 0x46, 0,                // mov [rsi + disp8], rax (where x was)
+	0xff, 0x4f, 0                       // dec dword [rdi + last_i]
+};
+#define JIT_RESULT_DISP 3
+#define JIT_RESULT_LAST_I 6
+// push of rax, with a call to jit_push when the stack has to grow (as in jit_tpl_push_const)
+static const unsigned char jit_tpl_push_rax[] = {
+	0x48, 0x8b, 0x7b, 0,                // mov rdi, [rbx + ctx.stack]
+	0x8b, 0x4f, 0,                      // mov ecx, [rdi + last_i]
+	0xff, 0xc1,                         // inc ecx
+	0x48, 0x63, 0xd1,                   // movsxd rdx, ecx
+	0x48, 0x69, 0xd2, 0, 0, 0, 0,       // imul rdx, rdx, sizeof (val)
+	0x48, 0x3b, 0x57, 0,                // cmp rdx, [rdi + alloc]
+	0x73, 0x0c,                         // jae slow
+	0x89, 0x4f, 0,                      // mov [rdi + last_i], ecx
+	0x48, 0x03, 0x57, 0,                // add rdx, [rdi + vs]
+	0x48, 0x89, 0x02,                   // mov [rdx], rax
+	0xeb, 0x12,                         // jmp over the slow path
+	0x48, 0x89, 0xdf,                   // slow: mov rdi, rbx
+	0x48, 0x89, 0xc6,                   // mov rsi, rax
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov rax, imm64 (jit_push)
+	0xff, 0xd0                          // call rax
+};
+#define JIT_PUSHR_CTX_STACK 3
+#define JIT_PUSHR_LAST_I 6
+#define JIT_PUSHR_VAL_SIZE 15
+#define JIT_PUSHR_ALLOC 22
+#define JIT_PUSHR_STORE_LAST_I 27
+#define JIT_PUSHR_VS 31
+#define JIT_PUSHR_HELPER 45
+// pops whose value is known to be there: = takes the value into rax and drops both operands
+static const unsigned char jit_tpl_pop_value[] = {
+	0x48, 0x8b, 0x7b, 0,                // mov rdi, [rbx + ctx.stack]
+	0x48, 0x63, 0x57, 0,                // movsxd rdx, dword [rdi + last_i]
+	0x48, 0x8b, 0x77, 0,                // mov rsi, [rdi + vs]
+	0x48, 0x8b, 0x04, 0xd6,             // mov rax, [rsi + rdx * 8]
+	0x83, 0x6f, 0, 0x02                 // sub dword [rdi + last_i], 2
+};
+#define JIT_POPV_CTX_STACK 3
+#define JIT_POPV_LAST_I 7
+#define JIT_POPV_VS 11
+#define JIT_POPV_STORE_LAST_I 18
+static const unsigned char jit_tpl_pop[] = {
+	0x48, 0x8b, 0x7b, 0,                // mov rdi, [rbx + ctx.stack]
+	0xff, 0x4f, 0                       // dec dword [rdi + last_i]
+};
+#define JIT_POP_CTX_STACK 3
+#define JIT_POP_LAST_I 6
+// loop heads are safe points: leave it to jit_op_loop if the heap needs collecting
+static const unsigned char jit_tpl_gc_poll[] = {
+	0x48, 0x8b, 0x43, 0,                // mov rax, [rbx + ctx.env]
+	0x48, 0x8b, 0x80, 0, 0, 0, 0,       // mov rax, [rax + env.gc]
+	0x48, 0x8b, 0x48, 0,                // mov rcx, [rax + gc.bytes]
+	0x48, 0x3b, 0x48, 0,                // cmp rcx, [rax + gc.threshold]
+	0x0f, 0x83, 0, 0, 0, 0              // jae rel32
+};
+#define JIT_GC_CTX_ENV 3
+#define JIT_GC_ENV_GC 7
+#define JIT_GC_BYTES 14
+#define JIT_GC_THRESHOLD 18
+#define JIT_GC_REL 21
+
+void jit_init(glass_env* env) {
+	// allocate the executable buffer and per-instruction tables, install the trampoline
+	jit_state* jit = (jit_state*) malloc(sizeof (jit_state));
+	if (!jit) jit_error("could not malloc jit state");
+	jit->n_code = env->n_code;
+	jit->entry = (void**) calloc(jit->n_code + 1, sizeof (void*));
+	jit->heat = (int*) calloc(jit->n_code + 1, sizeof (int));
+	jit->failed = (char*) calloc(jit->n_code + 1, sizeof (char));
+	if (!jit->entry || !jit->heat || !jit->failed) jit_error("could not malloc jit tables");
+
+	jit->size = JIT_BUFFER_SIZE;
+	jit->buff = (unsigned char*) mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->buff == MAP_FAILED) jit_error("could not mmap code buffer");
+	memcpy(jit->buff, jit_tpl_trampoline, sizeof jit_tpl_trampoline);
+	jit->used = 16; // keep function code aligned
+	if (mprotect(jit->buff, jit->size, PROT_READ | PROT_EXEC)) jit_error("could not make code buffer executable");
+
+	env->jit = jit;
+}
+
+void jit_free(glass_env* env) {
+	jit_state* jit = env->jit;
+	if (!jit) return;
+	munmap(jit->buff, jit->size);
+	free(jit->entry);
+	free(jit->heat);
+	free(jit->failed);
+	free(jit);
+	env->jit = NULL;
+}
+
+static unsigned char* jit_put(unsigned char* p, const unsigned char* tpl, size_t len) {
+	memcpy(p, tpl, len);
+	return p + len;
+}
+
+static unsigned char* jit_put_helper(unsigned char* p, void* helper, int arg) {
+	unsigned char* t = p;
+	p = jit_put(p, jit_tpl_helper, sizeof jit_tpl_helper);
+	memcpy(t + JIT_HELPER_ARG, &arg, 4);
+	memcpy(t + JIT_HELPER_FUNC, &helper, 8);
+	return p;
+}
+
+static unsigned char* jit_put_push_const(unsigned char* p, void* helper, enum val_type type, int arg) {
+	// inline push with the helper as slow path
+	unsigned char* t = p;
+	int val_size = sizeof (val);
+	int numb_off = VAL_INT_OFFSET;
+	int tag = type;
+	p = jit_put(p, jit_tpl_push_const, sizeof jit_tpl_push_const);
+	t[JIT_PUSH_CTX_STACK] = offsetof(jit_ctx, stack);
+	t[JIT_PUSH_LAST_I] = offsetof(v_list, last_i);
+	memcpy(t + JIT_PUSH_VAL_SIZE, &val_size, 4);
+	t[JIT_PUSH_ALLOC] = offsetof(v_list, alloc);
+	t[JIT_PUSH_STORE_LAST_I] = offsetof(v_list, last_i);
+	t[JIT_PUSH_VS] = offsetof(v_list, vs);
+	memcpy(t + JIT_PUSH_TYPE, &tag, 4);
+	t[JIT_PUSH_NUMB_OFF] = numb_off;
+	memcpy(t + JIT_PUSH_OPERAND, &arg, 4);
+	return jit_put_helper(p, helper, arg);
+}
+
+static void jit_patch(unsigned char* field, unsigned char* target) {
+	// rel32 is relative to the end of the 4-byte field
+	int rel = (int) (target - (field + 4));
+	memcpy(field, &rel, 4);
+}
+
+static unsigned char* jit_put_jump(unsigned char* p, unsigned char** field) {
+	// jmp whose rel32 *field is patched later
+	*field = p + JIT_JUMP_REL;
+	return jit_put(p, jit_tpl_jump, sizeof jit_tpl_jump);
+}
+
+static int jit_func_class(glass_env* env, int start) {
+	// class of the user function whose first instruction is start
+	for (int c = STD_LIBS; c < env->n_classes; c++) {
+		for (int f = 0; f < env->n_funcs[c]; f++) if (env->f_code[c][f] == start) return c;
+	}
+	return -1;
+}
+
+static int jit_var(glass_env* env, int class_i, int start, int name, int* disp) {
+	// where name is while the function at start (of class class_i) runs, see JIT_VAR_*
+	// *disp is its offset from the base jit_put_var_base loads
+	int slot;
+	switch (env->scopes[name]) {
+		case FUNCTION_SCOPE:
+		slot = name_slot(env->local_names + env->code[start].jump, env->code[start].arg, name);
+		if (slot < 0) return JIT_VAR_NONE;
+		*disp = slot * sizeof (val);
+		return JIT_VAR_LOCAL;
+		case OBJECT_SCOPE:
+		if (class_i < STD_LIBS) return JIT_VAR_NONE;
+		slot = name_slot(env->shapes[class_i].names, env->shapes[class_i].n_fields, name);
+		if (slot < 0) return JIT_VAR_NONE;
+		*disp = offsetof(object_t, vars) + slot * sizeof (val);
+		return JIT_VAR_FIELD;
+		case GLOBAL_SCOPE:
+		*disp = 0;
+		return JIT_VAR_GLOBAL;
+		default:
+		return JIT_VAR_NONE;
+	}
+}
+
+static unsigned char* jit_put_var(glass_env* env, unsigned char* p, const unsigned char* tpl, int where, int name, int disp) {
+	// load (jit_tpl_var_load) or store (jit_tpl_var_store) rax at a variable jit_var found
+	unsigned char* t = p;
+	if (where == JIT_VAR_GLOBAL) {
+		val* addr = env->global_vars + name;
+		p = jit_put(p, jit_tpl_global_base, sizeof jit_tpl_global_base);
+		memcpy(t + JIT_GLOBAL_ADDR, &addr, 8);
+	}
+	else {
+		p = jit_put(p, jit_tpl_frame_base, sizeof jit_tpl_frame_base);
+		t[JIT_BASE_CTX_FR] = offsetof(jit_ctx, fr);
+		t[JIT_BASE_FRAME] = (where == JIT_VAR_LOCAL) ? offsetof(frame_t, locals) : offsetof(frame_t, obj);
+	}
+	t = p;
+	p = jit_put(p, tpl, sizeof jit_tpl_var_load);
+	memcpy(t + JIT_VAR_DISP, &disp, 4);
+	return p;
+}
+
+static unsigned char* jit_put_check(unsigned char* p, enum val_type type, unsigned char** fail) {
+	// jump to *fail (patched later) unless rax is of the given type, or for NO_VAL set to anything
+	unsigned char* t = p;
+	if (type == NO_VAL) {
+		p = jit_put(p, jit_tpl_check_set, sizeof jit_tpl_check_set);
+		t[JIT_SET_MASK] = VAL_TAG_MASK;
+		*fail = t + JIT_SET_REL;
+		return p;
+	}
+	p = jit_put(p, jit_tpl_check_tag, sizeof jit_tpl_check_tag);
+	t[JIT_TAG_MASK] = VAL_TAG_MASK;
+	t[JIT_TAG_TAG] = type;
+	*fail = t + JIT_TAG_REL;
+	return p;
+}
+
+static unsigned char* jit_put_check_a(unsigned char* p, unsigned char** fail) {
+	// jump to *fail unless the OBJT in rax is the A object (class 0)
+	unsigned char* t = p;
+	uint64_t mask = VAL_PTR_MASK;
+	p = jit_put(p, jit_tpl_check_class, sizeof jit_tpl_check_class);
+	memcpy(t + JIT_CLASS_MASK, &mask, 8);
+	t[JIT_CLASS_OFF] = offsetof(object_t, class_i);
+	t[JIT_CLASS_CLASS] = 0;
+	*fail = t + JIT_CLASS_REL;
+	return p;
+}
+
+static unsigned char* jit_put_numb_int(unsigned char* p) {
+	unsigned char* t = p;
+	p = jit_put(p, jit_tpl_numb_int, sizeof jit_tpl_numb_int);
+	t[JIT_INT_SHIFT] = 8 * VAL_INT_OFFSET;
+	return p;
+}
+
+static unsigned char* jit_put_int_numb(unsigned char* p) {
+	unsigned char* t = p;
+	p = jit_put(p, jit_tpl_int_numb, sizeof jit_tpl_int_numb);
+	t[JIT_NUMB_SHIFT] = 8 * VAL_INT_OFFSET;
+	t[JIT_NUMB_TAG] = NUMB;
+	return p;
+}
+
+static unsigned char* jit_put_push_rax(unsigned char* p) {
+	unsigned char* t = p;
+	int val_size = sizeof (val);
+	void* helper = (void*) jit_push;
+	p = jit_put(p, jit_tpl_push_rax, sizeof jit_tpl_push_rax);
+	t[JIT_PUSHR_CTX_STACK] = offsetof(jit_ctx, stack);
+	t[JIT_PUSHR_LAST_I] = offsetof(v_list, last_i);
+	memcpy(t + JIT_PUSHR_VAL_SIZE, &val_size, 4);
+	t[JIT_PUSHR_ALLOC] = offsetof(v_list, alloc);
+	t[JIT_PUSHR_STORE_LAST_I] = offsetof(v_list, last_i);
+	t[JIT_PUSHR_VS] = offsetof(v_list, vs);
+	memcpy(t + JIT_PUSHR_HELPER, &helper, 8);
+	return p;
+}
+
+static unsigned char* jit_put_stack_top(unsigned char* p) {
+	unsigned char* t = p;
+	p = jit_put(p, jit_tpl_stack_top, sizeof jit_tpl_stack_top);
+	t[JIT_TOP_CTX_STACK] = offsetof(jit_ctx, stack);
+	t[JIT_TOP_LAST_I] = offsetof(v_list, last_i);
+	t[JIT_TOP_VS] = offsetof(v_list, vs);
+	return p;
+}
+
+static unsigned char* jit_put_a_stack(unsigned char* p, int a_func, int proven, unsigned char** fail) {
+	// A function a_func on the two values on top of the stack, replacing them with the result.
+	// Unless proven, checks that both are there and are numbers, jumping to fail[0..2] otherwise
+	unsigned char* t;
+	p = jit_put_stack_top(p);
+	if (!proven) {
+		t = p;
+		p = jit_put(p, jit_tpl_check_depth, sizeof jit_tpl_check_depth);
+		t[JIT_DEPTH_N] = 1;
+		fail[0] = t + JIT_DEPTH_REL;
+		for (int k = 0; k < 2; k++) {
+			t = p;
+			p = jit_put(p, jit_tpl_stack_load, sizeof jit_tpl_stack_load);
+			t[JIT_STACK_DISP] = (unsigned char) (-k * (int) sizeof (val));
+			p = jit_put_check(p, NUMB, fail + 1 + k);
+		}
+	}
+	t = p;
+	p = jit_put(p, jit_tpl_a_operands, sizeof jit_tpl_a_operands);
+	t[JIT_OPERAND_X] = (unsigned char) (VAL_INT_OFFSET - (int) sizeof (val));
+	t[JIT_OPERAND_Y] = VAL_INT_OFFSET;
+	p = jit_put(p, jit_tpl_a_ops[a_func] + 1, jit_tpl_a_ops[a_func][0]);
+	p = jit_put_int_numb(p);
+	t = p;
+	p = jit_put(p, jit_tpl_a_result, sizeof jit_tpl_a_result);
+	t[JIT_RESULT_DISP] = (unsigned char) (-(int) sizeof (val));
+	t[JIT_RESULT_LAST_I] = offsetof(v_list, last_i);
+	return p;
+}
+
+static unsigned char* jit_put_fused(glass_env* env, int class_i, int start, int i, unsigned char* p, unsigned char** done) {
+	// fast path of the fused instruction at i (see peephole.h), ending in a jump through *done
+	// (patched by the caller) to the instruction after the pattern. When a check fails it goes
+	// on to the code after it, which runs the pattern as it is. Puts nothing, leaving *done NULL,
+	// if the place of a name isn't known
+	instr_t* ins = env->code + i;
+	int update = (ins->op == OP_UPDATE_IMM) || (ins->op == OP_UPDATE_VAR) || (ins->op == OP_BRANCH_IMM) || (ins->op == OP_BRANCH_VAR);
+	int imm = (ins->op == OP_ARITH_IMM) || (ins->op == OP_UPDATE_IMM) || (ins->op == OP_BRANCH_IMM);
+	instr_t* a = update ? ins + 1 : ins; // the (y)* <k> (o)f.? or (y)* (z)* (o)f.?
+	int o_name = a[imm ? 3 : 4].arg;
+	int x_disp, y_disp, z_disp, o_disp;
+	int x_where = update ? jit_var(env, class_i, start, ins->arg, &x_disp) : JIT_VAR_LOCAL;
+	int y_where = jit_var(env, class_i, start, a[0].arg, &y_disp);
+	int z_where = imm ? JIT_VAR_LOCAL : jit_var(env, class_i, start, a[2].arg, &z_disp);
+	int o_where = jit_var(env, class_i, start, o_name, &o_disp);
+	*done = NULL;
+	if (!x_where || !y_where || !z_where || !o_where) return p;
+
+	unsigned char* fail[4];
+	unsigned char* t;
+	p = jit_put_var(env, p, jit_tpl_var_load, o_where, o_name, o_disp);
+	p = jit_put_check(p, OBJT, fail);
+	p = jit_put_check_a(p, fail + 1);
+	p = jit_put_var(env, p, jit_tpl_var_load, y_where, a[0].arg, y_disp);
+	p = jit_put_check(p, NUMB, fail + 2);
+	p = jit_put_numb_int(p);
+	p = jit_put(p, jit_tpl_save_x, sizeof jit_tpl_save_x);
+	if (imm) {
+		t = p;
+		p = jit_put(p, jit_tpl_y_imm, sizeof jit_tpl_y_imm);
+		memcpy(t + JIT_Y_IMM, &a[2].arg, 4);
+		fail[3] = NULL;
+	}
+	else {
+		p = jit_put_var(env, p, jit_tpl_var_load, z_where, a[2].arg, z_disp);
+		p = jit_put_check(p, NUMB, fail + 3);
+		p = jit_put_numb_int(p);
+		p = jit_put(p, jit_tpl_y_var, sizeof jit_tpl_y_var);
+	}
+	p = jit_put(p, jit_tpl_restore_x, sizeof jit_tpl_restore_x);
+	p = jit_put(p, jit_tpl_a_ops[ins->jump] + 1, jit_tpl_a_ops[ins->jump][0]);
+	p = jit_put_int_numb(p);
+	if (update) p = jit_put_var(env, p, jit_tpl_var_store, x_where, ins->arg, x_disp);
+	else p = jit_put_push_rax(p);
+	p = jit_put_jump(p, done);
+	for (int k = 0; k < 4; k++) if (fail[k]) jit_patch(fail[k], p);
+	return p;
+}
+
+static unsigned char* jit_put_call_std(glass_env* env, int class_i, int start, int i, unsigned char* p, unsigned char** done) {
+	// OP_CALL_STD at i: A functions on the stack inline, others through jit_op_call_std. Goes
+	// through done[0] or done[1] (patched by the caller, NULL if unused) to the instruction
+	// after the (o)f.?, and on to the code after this, the (o)f.? as it is, when o isn't an object
+	instr_t* ins = env->code + i;
+	int f = STD_CALL_FUNC(ins->jump);
+	int disp;
+	int where = jit_var(env, class_i, start, ins->arg, &disp);
+	done[0] = NULL;
+	if (!STD_CALL_CLASS(ins->jump) && (f != 5) && where) {
+		unsigned char* unfused;
+		unsigned char* fail[3] = {NULL, NULL, NULL};
+		p = jit_put_var(env, p, jit_tpl_var_load, where, ins->arg, disp);
+		p = jit_put_check(p, OBJT, &unfused);
+		p = jit_put_a_stack(p, f, ins[3].proven & PROVEN_ARGS, fail);
+		p = jit_put_jump(p, done);
+		// missing or non-number operands: execute_A_function reports them
+		for (int k = 0; k < 3; k++) if (fail[k]) jit_patch(fail[k], p);
+		p = jit_put_helper(p, (void*) jit_op_call_std, i);
+		p = jit_put_jump(p, done + 1);
+		jit_patch(unfused, p);
+		return p;
+	}
+	p = jit_put_helper(p, (void*) jit_op_call_std, i);
+	p = jit_put(p, jit_tpl_jump_if, sizeof jit_tpl_jump_if);
+	done[1] = p - sizeof jit_tpl_jump_if + JIT_JUMP_IF_REL;
+	return p;
+}
+
+static unsigned char* jit_put_loop(glass_env* env, int class_i, int start, instr_t* ins, unsigned char* p, unsigned char** exit) {
+	// loop head: poll the collector and test the condition, leaving through *exit (patched by
+	// the caller) when it is 0. jit_op_loop does it when the heap needs collecting, the
+	// condition isn't a number or its place isn't known
+	int disp;
+	int where = jit_var(env, class_i, start, ins->arg, &disp);
+	unsigned char* test = NULL;
+	if (where) {
+		unsigned char* slow[2] = {NULL, NULL};
+		unsigned char* t = p;
+		int env_gc = offsetof(glass_env, gc);
+		p = jit_put(p, jit_tpl_gc_poll, sizeof jit_tpl_gc_poll);
+		t[JIT_GC_CTX_ENV] = offsetof(jit_ctx, env);
+		memcpy(t + JIT_GC_ENV_GC, &env_gc, 4);
+		t[JIT_GC_BYTES] = offsetof(gc_heap, bytes);
+		t[JIT_GC_THRESHOLD] = offsetof(gc_heap, threshold);
+		slow[0] = t + JIT_GC_REL;
+		p = jit_put_var(env, p, jit_tpl_var_load, where, ins->arg, disp);
+		if (!(ins->proven & PROVEN_TYPES)) p = jit_put_check(p, NUMB, slow + 1);
+		p = jit_put_numb_int(p);
+		p = jit_put_jump(p, &test);
+		for (int k = 0; k < 2; k++) if (slow[k]) jit_patch(slow[k], p);
+	}
+	p = jit_put_helper(p, (void*) jit_op_loop, ins->arg);
+	if (test) jit_patch(test, p);
+	p = jit_put(p, jit_tpl_branch_false, sizeof jit_tpl_branch_false);
+	*exit = p - sizeof jit_tpl_branch_false + JIT_BRANCH_REL;
+	return p;
+}
+
+int jit_compile(glass_env* env, int start) {
+	// translate the function whose first instruction is start. returns 1 on success
+	jit_state* jit = env->jit;
+	instr_t* code = env->code;
+	int fuse = env->peephole; // otherwise fused instructions are translated as their OP_NAME
+
+	// find the end of the function and check that every op has a template
+	int end = start;
+	while (code[end].op != OP_END) {
+		switch (base_op(code[end].op)) {
+			case OP_NAME: case OP_NUMB: case OP_STNG: case OP_DUP: case OP_POP: case OP_RET:
+			case OP_ASSIGN: case OP_NEW: case OP_BIND: case OP_CALL: case OP_LOAD: case OP_SELF:
+			case OP_LOOP: case OP_ENDLOOP: case OP_ENTER:
+			break;
+			default:
+			return 0;
+		}
+		end++;
+	}
+	int n = end - start + 1;
+	size_t worst = (size_t) n * JIT_MAX_INSTR_BYTES;
+	if (jit->used + worst > jit->size) return 0;
+
+	if (mprotect(jit->buff, jit->size, PROT_READ | PROT_WRITE)) jit_error("could not make code buffer writable");
+
+	unsigned char* base = jit->buff + jit->used;
+	unsigned char* p = base;
+	int class_i = jit_func_class(env, start);
+	// rel32 fields to patch once every instruction has an address: (field, target instruction)
+	unsigned char** fix_at = (unsigned char**) malloc(2 * n * sizeof (unsigned char*));
+	int* fix_to = (int*) malloc(2 * n * sizeof (int));
+	// join[i - start] is set when a fast path jumps to instruction i
+	char* join = (char*) calloc(n + 1, sizeof (char));
+	if (!fix_at || !fix_to || !join) jit_error("could not malloc jit fixups");
+	int n_fix = 0;
+
+	// the values pushed since control last came in from elsewhere, top last: a name (>= 0) or
+	// something else (-1). A name here is on the stack for sure, so = can store it inline
+#define JIT_KNOW(v) do { \
+	int known_v = (v); \
+	if (n_known == JIT_TRACK) memmove(known, known + 1, (--n_known) * sizeof (int)); \
+	known[n_known++] = known_v; \
+} while (0)
+#define JIT_FORGET(k) do { n_known = (n_known > (k)) ? n_known - (k) : 0; } while (0)
+	int known[JIT_TRACK];
+	int n_known = 0;
+
+	for (int i = start; i <= end; i++) {
+		instr_t* ins = code + i;
+		int op = fuse ? ins->op : base_op(ins->op);
+		jit->entry[i] = p;
+		enum op_code prev = (i > start) ? code[i - 1].op : OP_ENTER;
+		if (join[i - start] || (op == OP_LOOP) || (prev == OP_ENDLOOP) || (prev == OP_CALL) || (prev == OP_NEW) || (prev == OP_RET)) n_known = 0;
+
+		if (op >= OP_FIRST_FUSED) {
+			// a fast path, then the instructions the fused one stands for
+			unsigned char* done[2] = {NULL, NULL};
+			int after;
+			if (op == OP_CALL_STD) {
+				p = jit_put_call_std(env, class_i, start, i, p, done);
+				after = i + 4;
+			}
+			else {
+				p = jit_put_fused(env, class_i, start, i, p, done);
+				int imm = (op == OP_ARITH_IMM) || (op == OP_UPDATE_IMM) || (op == OP_BRANCH_IMM);
+				after = i + ((op == OP_ARITH_IMM) || (op == OP_ARITH_VAR) ? 7 : 9) + !imm;
+			}
+			for (int k = 0; k < 2; k++) {
+				if (!done[k]) continue;
+				fix_at[n_fix] = done[k];
+				fix_to[n_fix++] = after;
+				join[after - start] = 1;
+			}
+			op = OP_NAME;
+		}
+
+		switch (op) {
+			case OP_NAME:
+			{
+				int disp;
+				int where = jit_var(env, class_i, start, ins->arg, &disp);
+				if ((ins[1].op == OP_LOAD) && where && !join[i + 1 - start]) {
+					// (x)* : push the value, jit_op_load_name reports it unset
+					unsigned char* unset;
+					unsigned char* over;
+					p = jit_put_var(env, p, jit_tpl_var_load, where, ins->arg, disp);
+					p = jit_put_check(p, NO_VAL, &unset);
+					p = jit_put_push_rax(p);
+					p = jit_put_jump(p, &over);
+					jit_patch(unset, p);
+					p = jit_put_helper(p, (void*) jit_op_load_name, ins->arg);
+					jit_patch(over, p);
+					i++;
+					jit->entry[i] = NULL;
+					JIT_KNOW(-1);
+				}
+				else {
+					p = jit_put_push_const(p, (void*) jit_op_name, NAME, ins->arg);
+					JIT_KNOW(ins->arg);
+				}
+			}
+			break;
+			case OP_NUMB:
+				p = jit_put_push_const(p, (void*) jit_op_numb, NUMB, ins->arg);
+				JIT_KNOW(-1);
+			break;
+			case OP_STNG:
+				p = jit_put_helper(p, (void*) jit_op_stng, ins->arg);
+				JIT_KNOW(-1);
+			break;
+			case OP_DUP:
+				p = jit_put_helper(p, (void*) jit_op_dup, ins->arg);
+				JIT_KNOW((ins->arg < n_known) ? known[n_known - 1 - ins->arg] : -1);
+			break;
+			case OP_POP:
+				if ((ins->proven & PROVEN_DEPTH) || n_known) {
+					unsigned char* t = p;
+					p = jit_put(p, jit_tpl_pop, sizeof jit_tpl_pop);
+					t[JIT_POP_CTX_STACK] = offsetof(jit_ctx, stack);
+					t[JIT_POP_LAST_I] = offsetof(v_list, last_i);
+				}
+				else p = jit_put_helper(p, (void*) jit_op_pop, 0);
+				JIT_FORGET(1);
+			break;
+			case OP_ASSIGN:
+			{
+				int disp;
+				int x = (n_known >= 2) ? known[n_known - 2] : -1;
+				int where = (x >= 0) ? jit_var(env, class_i, start, x, &disp) : JIT_VAR_NONE;
+				if (where) {
+					unsigned char* t = p;
+					p = jit_put(p, jit_tpl_pop_value, sizeof jit_tpl_pop_value);
+					t[JIT_POPV_CTX_STACK] = offsetof(jit_ctx, stack);
+					t[JIT_POPV_LAST_I] = offsetof(v_list, last_i);
+					t[JIT_POPV_VS] = offsetof(v_list, vs);
+					t[JIT_POPV_STORE_LAST_I] = offsetof(v_list, last_i);
+					p = jit_put_var(env, p, jit_tpl_var_store, where, x, disp);
+				}
+				else p = jit_put_helper(p, (void*) jit_op_assign, ins->proven);
+				JIT_FORGET(2);
+			}
+			break;
+			case OP_NEW:
+				p = jit_put_helper(p, (void*) jit_op_new, i);
+				p = jit_put(p, jit_tpl_exit_if, sizeof jit_tpl_exit_if);
+			break;
+			case OP_CALL:
+				p = jit_put_helper(p, (void*) jit_op_call, i);
+				p = jit_put(p, jit_tpl_exit_if, sizeof jit_tpl_exit_if);
+			break;
+			case OP_LOAD:
+				p = jit_put_helper(p, (void*) jit_op_load, 0);
+				if (n_known) known[n_known - 1] = -1;
+			break;
+			case OP_SELF:
+				p = jit_put_helper(p, (void*) jit_op_self, 0);
+				JIT_FORGET(1);
+			break;
+			case OP_BIND:
+				if (ins[1].op == OP_CALL) {
+					// the ? can't be a jump target, fuse the pair
+					p = jit_put_helper(p, (void*) jit_op_bind_call, i);
+					p = jit_put(p, jit_tpl_exit_if, sizeof jit_tpl_exit_if);
+					i++;
+					jit->entry[i] = NULL;
+				}
+				else {
+					p = jit_put_helper(p, (void*) jit_op_bind, i);
+					JIT_FORGET(2);
+					JIT_KNOW(-1);
+				}
+			break;
+			case OP_LOOP:
+				p = jit_put_loop(env, class_i, start, ins, p, fix_at + n_fix);
+				fix_to[n_fix++] = ins->jump;
+			break;
+			case OP_ENDLOOP:
+				p = jit_put_jump(p, fix_at + n_fix);
+				fix_to[n_fix++] = ins->jump;
+			break;
+			case OP_ENTER:
+				// the frame is set up by execute_function before entering machine code
+			break;
+			case OP_RET:
+			case OP_END:
+				p = jit_put(p, jit_tpl_return, sizeof jit_tpl_return);
+			break;
+			default:
+			jit_error("jit_compile: op without template");
+		}
+	}
+#undef JIT_KNOW
+#undef JIT_FORGET
+
+	for (int k = 0; k < n_fix; k++) {
+		if (!jit->entry[fix_to[k]]) jit_error("jit_compile: jump into a fused pair");
+		jit_patch(fix_at[k], (unsigned char*) jit->entry[fix_to[k]]);
+	}
+	free(fix_at);
+	free(fix_to);
+	free(join);
+
+	jit->used += ((p - base) + 15) & ~((size_t) 15);
+	if (mprotect(jit->buff, jit->size, PROT_READ | PROT_EXEC)) jit_error("could not make code buffer executable");
+	return 1;
+}
+
+int jit_run(glass_env* env, void* entry, v_list* stack, frame_t* fr) {
+	// run machine code from entry until the function returns (-1) or makes a call that the
+	// interpreter has to do (the index of the instruction to continue at)
+	jit_ctx ctx = (jit_ctx) {env, stack, fr, -1};
+	void (*trampoline)(jit_ctx*, void*) = (void (*)(jit_ctx*, void*)) env->jit->buff;
+	trampoline(&ctx, entry);
+	return ctx.resume;
+}
+
+#else
+
+void jit_init(glass_env* env) {
+	fprintf(stderr, "warning: the JIT is only available on x86-64, interpreting instead\n");
+	env->jit = NULL;
+}
+
+void jit_free(glass_env* env) {}
+
+int jit_compile(glass_env* env, int start) { return 0; }
+
+int jit_run(glass_env* env, void* entry, v_list* stack, frame_t* fr) {
+	jit_error("jit_run: no JIT on this platform");
+	return -1;
+}
+
+#endif
+
+void* jit_function_entry(glass_env* env, int start) {
+	// called on entry to a user function. returns machine code to run instead, or NULL
+	jit_state* jit = env->jit;
+	if (jit->entry[start]) return jit->entry[start];
+	if (jit->failed[start]) return NULL;
+	if (++jit->heat[start] < JIT_THRESHOLD) return NULL;
+	if (!jit_compile(env, start)) jit->failed[start] = 1;
+	return jit->entry[start];
+}
+
+void* jit_loop_entry(glass_env* env, int start, int head) {
+	// called on every loop back-edge, head is the OP_LOOP instruction about to run
+	jit_state* jit = env->jit;
+	if (jit->entry[head]) return jit->entry[head];
+	if (jit->failed[start]) return NULL;
+	if (++jit->heat[start] < JIT_THRESHOLD) return NULL;
+	if (!jit_compile(env, start)) jit->failed[start] = 1;
+	return jit->entry[head];
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "libglass.h"
+#include "glassdefs.h"
+#include "parser.h"
+#include "compiler.h"
+#include "runtime.h"
+#include "batch.h"
+
+// the library side of libglass.h
+// glass_parse and glass_run set a trap (see glassdefs.h) while they work, so any error of the
+// interpreter longjmps back to them with its message. They then free whatever the failed step had
+// built: after a parse error the vm is empty again, after a runtime error it keeps its program.
+// runs go through batch.h, glass_run being a batch of one on the vm's own env
+
+struct glass_vm {
+	glass_env env;
+	int       parsed;  // env holds a compiled program
+	int       flags;   // GLASS_JIT etc.
+	char*     source;  // cleaned program text, only while parsing
+	glass_write_fn write; // NULL for stdout
+	void*     write_user;
+	glass_read_fn read;   // NULL for an empty input
+	void*     read_user;
+	glass_trap trap;   // its message is the last error, "" if the last call succeeded
+};
+
+void vm_release(glass_vm* vm);
+int vm_usage_error(glass_vm* vm, char* error_text);
+
+glass_vm* glass_new(int flags) {
+	glass_vm* vm = (glass_vm*) calloc(1, sizeof (glass_vm));
+	if (!vm) return NULL;
+	vm->flags = flags;
+	return vm;
+}
+
+void glass_free(glass_vm* vm) {
+	if (!vm) return;
+	vm_release(vm);
+	free(vm);
+}
+
+void glass_set_output(glass_vm* vm, glass_write_fn write, void* user) {
+	// takes effect with the next run
+	vm->write = write;
+	vm->write_user = user;
+}
+
+void glass_set_input(glass_vm* vm, glass_read_fn read, void* user) {
+	// takes effect with the next run, which reads from the start of whatever read supplies
+	vm->read = read;
+	vm->read_user = user;
+}
+
+const char* glass_error_message(glass_vm* vm) {
+	return vm->trap.message;
+}
+
+int glass_parse(glass_vm* vm, const char* src, size_t len) {
+	// parse and compile the program src (len characters), replacing the vm's program if it has one
+	vm_release(vm);
+	glass_trap* prev = trap_live;
+	if (setjmp(vm->trap.jump)) {
+		trap_live = prev;
+		vm_release(vm);
+		return GLASS_PARSE_ERROR;
+	}
+	trap_live = &vm->trap;
+
+	glass_env* env = &vm->env;
+	memset(env, 0, sizeof (glass_env));
+	vm->source = clean_source((char*) src, (long) len);
+	vm->parsed = 1; // from here on env has tables to free
+	parse_source(env, vm->source);
+	compile_env(env);
+	env->peephole = !(vm->flags & GLASS_NO_PEEPHOLE);
+	if (vm->flags & GLASS_JIT) jit_init(env);
+	if (vm->flags & GLASS_MEMO) {
+		analyze_env(env);
+		memo_init(env);
+	}
+	// glass finds out when it starts running, here it's a parse error
+	int m_class = find_name(env, "M");
+	int m_func = find_name(env, "m");
+	if ((m_class < 0) || (m_func < 0) || (get_class_idx(*env, m_class) < 0) || (get_func_idx(*env, m_class, m_func) < 0)) {
+		parse_error("cannot find M.m");
+	}
+
+	trap_live = prev;
+	free(vm->source);
+	vm->source = NULL;
+	vm->trap.message[0] = '\0';
+	return GLASS_OK;
+}
+
+int glass_run(glass_vm* vm) {
+	// run the program's M.m once, returns when it does
+	if (!vm->parsed) return vm_usage_error(vm, "glass_run: no program, see glass_parse");
+	batch_job job = {-1, vm->read, vm->read_user, vm->write, vm->write_user, 0, "", 0};
+	if (!batch_run(&vm->env, &job, 0)) {
+		memcpy(vm->trap.message, job.message, TRAP_MESSAGE_SIZE);
+		return GLASS_RUNTIME_ERROR;
+	}
+	vm->trap.message[0] = '\0';
+	return GLASS_OK;
+}
+
+int glass_run_batch(glass_vm* vm, glass_job* jobs, int n_jobs, int n_threads) {
+	// run the program once per job on n_threads threads, returns when all the runs have
+	if (!vm->parsed) return vm_usage_error(vm, "glass_run_batch: no program, see glass_parse");
+	if (n_jobs <= 0) return GLASS_OK;
+	batch_job* runs = (batch_job*) calloc(n_jobs, sizeof (batch_job));
+	if (!runs) return vm_usage_error(vm, "glass_run_batch: could not malloc jobs");
+	for (int i = 0; i < n_jobs; i++) {
+		runs[i] = (batch_job) {-1, jobs[i].read, jobs[i].read_user, jobs[i].write, jobs[i].write_user, 0, "", 0};
+	}
+	glass_trap* prev = trap_live;
+	if (setjmp(vm->trap.jump)) {
+		// couldn't start, no job has run
+		trap_live = prev;
+		free(runs);
+		return GLASS_USAGE_ERROR;
+	}
+	trap_live = &vm->trap;
+	batch_state b;
+	batch_start(&b, &vm->env, runs, n_jobs, n_threads, 0);
+	trap_live = prev;
+	batch_finish(&b);
+
+	int res = GLASS_OK;
+	for (int i = 0; i < n_jobs; i++) {
+		jobs[i].status = runs[i].failed ? GLASS_RUNTIME_ERROR : GLASS_OK;
+		snprintf(jobs[i].message, GLASS_MESSAGE_SIZE, "%s", runs[i].message);
+		if (runs[i].failed) res = GLASS_RUNTIME_ERROR;
+	}
+	free(runs);
+	vm->trap.message[0] = '\0';
+	return res;
+}
+
+void vm_release(glass_vm* vm) {
+	// drop the vm's program, if any
+	free(vm->source);
+	vm->source = NULL;
+	if (!vm->parsed) return;
+	glass_env* env = &vm->env;
+	memo_free(env);
+	jit_free(env);
+	free_env(*env);
+	vm->parsed = 0;
+}
+
+int vm_usage_error(glass_vm* vm, char* error_text) {
+	snprintf(vm->trap.message, TRAP_MESSAGE_SIZE, "%s", error_text);
+	return GLASS_USAGE_ERROR;
+}
@@ -0,0 +1,56 @@
+#ifndef LIBGLASS_H
+#define LIBGLASS_H
+
+#include <stddef.h>
+
+// the Glass interpreter as a library: make libglass.a, include this header and link with
+// -lglass -lpthread
+// a glass_vm holds one compiled program. Parse it once, then run it as often as needed: every run
+// starts from fresh globals, heap and input. Nothing is shared between vms, so separate threads can
+// each use their own at the same time (one vm must not be used by two threads at once).
+// errors don't end the process, the call that ran into one returns its status and
+// glass_error_message has the text glass would have printed.
+// glass_run_batch runs the program on many inputs over a pool of threads, all sharing the vm's
+// compiled program
+//
+//   glass_vm* vm = glass_new(0);
+//   glass_set_output(vm, my_write, my_data);
+//   if (glass_parse(vm, src, len) || glass_run(vm)) report(glass_error_message(vm));
+//   glass_free(vm);
+
+#define GLASS_MESSAGE_SIZE 512
+
+enum glass_status {GLASS_OK=0, GLASS_PARSE_ERROR, GLASS_RUNTIME_ERROR, GLASS_USAGE_ERROR};
+
+// flags for glass_new, the library counterparts of glass --jit, --memo and --no-peephole
+#define GLASS_JIT         1
+#define GLASS_MEMO        2
+#define GLASS_NO_PEEPHOLE 4
+
+// receives the program's output (O.o, O.on) in blocks, at the latest when glass_run returns
+typedef void (*glass_write_fn)(void* user, const char* s, size_t len);
+// supplies the program's input (I.l, I.c, I.e) like read(2): bytes put in buff, 0 at the end
+typedef long (*glass_read_fn)(void* user, char* buff, size_t len);
+
+typedef struct glass_vm glass_vm;
+
+// one run of glass_run_batch. Each job's callbacks are only called from the thread running it
+typedef struct glass_job {
+	glass_read_fn  read;       // NULL for an empty input
+	void*          read_user;
+	glass_write_fn write;      // NULL for stdout
+	void*          write_user;
+	int            status;     // set by glass_run_batch, GLASS_OK or GLASS_RUNTIME_ERROR
+	char           message[GLASS_MESSAGE_SIZE]; // the error, if status says there was one
+} glass_job;
+
+glass_vm* glass_new(int flags);
+void glass_free(glass_vm* vm);
+void glass_set_output(glass_vm* vm, glass_write_fn write, void* user);
+void glass_set_input(glass_vm* vm, glass_read_fn read, void* user);
+int glass_parse(glass_vm* vm, const char* src, size_t len);
+int glass_run(glass_vm* vm);
+int glass_run_batch(glass_vm* vm, glass_job* jobs, int n_jobs, int n_threads);
+const char* glass_error_message(glass_vm* vm);
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+#include "analysis.h"
+
+// result cache for pure user functions (glass --memo prog.gl)
+// a call to a function analysis.h found pure, whose arguments are all numbers or names, is looked
+// up by (function, arguments) in a direct-mapped table. On a hit the arguments are replaced by the
+// cached results without running the function. On a miss the arguments are saved in the callee's
+// frame and the results are stored when it returns, provided they are numbers or names too.
+// colliding entries overwrite each other, so the table never grows past MEMO_SIZE entries
+
+#define MEMO_SIZE (1 << 16) // entries, a power of two
+#define MEMO_MAX_ARGS 4
+#define MEMO_MAX_RESULTS 4
+
+typedef struct memo_entry memo_entry;
+
+struct memo_entry {
+	int      start; // OP_ENTER of the function, -1 if the entry is empty
+	uint64_t args[MEMO_MAX_ARGS];
+	uint64_t results[MEMO_MAX_RESULTS];
+};
+
+struct memo_table {
+	memo_entry* entries;
+	long        hits;
+	long        misses;
+};
+
+void memo_error(char* error_text);
+
+void memo_init(glass_env* env);
+void memo_free(glass_env* env);
+int memo_immediate(val v);
+int memo_usable(glass_env* env, int start, v_list* stack);
+memo_entry* memo_slot(glass_env* env, int start, val* args, int n_args);
+int memo_lookup(glass_env* env, int start, v_list* stack);
+void memo_store(glass_env* env, frame_t* fr, v_list* stack);
+
+void memo_error(char* error_text) {
+	trap_error("Error in memo.h: ", error_text);
+	fprintf(stderr, "Error in memo.h: %s\n", error_text);
+	exit(1);
+}
+
+void memo_init(glass_env* env) {
+	// needs env->f_info from analyze_env
+	memo_table* memo = (memo_table*) malloc(sizeof (memo_table));
+	if (!memo) memo_error("could not malloc memo table");
+	memo->entries = (memo_entry*) malloc(MEMO_SIZE * sizeof (memo_entry));
+	if (!memo->entries) memo_error("could not malloc memo entries");
+	for (int i = 0; i < MEMO_SIZE; i++) memo->entries[i].start = -1;
+	memo->hits = 0;
+	memo->misses = 0;
+	env->memo = memo;
+}
+
+void memo_free(glass_env* env) {
+	if (!env->memo) return;
+	free(env->memo->entries);
+	free(env->memo);
+	env->memo = NULL;
+}
+
+int memo_immediate(val v) {
+	// values that can be cached: equal bits mean equal values, and nothing for the collector
+	return (val_tag(v) == NUMB) || (val_tag(v) == NAME);
+}
+
+int memo_usable(glass_env* env, int start, v_list* stack) {
+	// whether a call to the function at start with the current stack can go through the table
+	func_info* fi = env->f_info + start;
+	if (!fi->pure || (fi->n_args > MEMO_MAX_ARGS) || (fi->n_results > MEMO_MAX_RESULTS)) return 0;
+	if (stack->last_i + 1 < fi->n_args) return 0;
+	for (int i = 0; i < fi->n_args; i++) {
+		if (!memo_immediate(stack->vs[stack->last_i - i])) return 0;
+	}
+	return 1;
+}
+
+memo_entry* memo_slot(glass_env* env, int start, val* args, int n_args) {
+	// the one entry (function, args) can live in
+	uint64_t h = 14695981039346656037ULL ^ (uint64_t) start;
+	for (int i = 0; i < n_args; i++) {
+		h = (h ^ args[i].bits) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	return env->memo->entries + (h & (MEMO_SIZE - 1));
+}
+
+int memo_lookup(glass_env* env, int start, v_list* stack) {
+	// on a hit replace the arguments on the stack by the results and return 1
+	func_info* fi = env->f_info + start;
+	val* args = stack->vs + stack->last_i + 1 - fi->n_args;
+	memo_entry* e = memo_slot(env, start, args, fi->n_args);
+	if (e->start != start) {
+		env->memo->misses++;
+		return 0;
+	}
+	for (int i = 0; i < fi->n_args; i++) {
+		if (e->args[i] != args[i].bits) {
+			env->memo->misses++;
+			return 0;
+		}
+	}
+	env->memo->hits++;
+	for (int i = 0; i < fi->n_args; i++) pop(stack);
+	for (int i = 0; i < fi->n_results; i++) push(stack, (val) {e->results[i]});
+	return 1;
+}
+
+void memo_store(glass_env* env, frame_t* fr, v_list* stack) {
+	// fr is returning, its arguments were saved after its locals by the call
+	func_info* fi = env->f_info + fr->start;
+	val* args = fr->locals + fr->n_locals;
+	val* results = stack->vs + stack->last_i + 1 - fi->n_results;
+	for (int i = 0; i < fi->n_results; i++) {
+		if (!memo_immediate(results[i])) return;
+	}
+	memo_entry* e = memo_slot(env, fr->start, args, fi->n_args);
+	e->start = fr->start;
+	for (int i = 0; i < fi->n_args; i++) e->args[i] = args[i].bits;
+	for (int i = 0; i < fi->n_results; i++) e->results[i] = results[i].bits;
+}
+
+#endif
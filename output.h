@@ -0,0 +1,170 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "glassdefs.h"
+
+// buffered program output for the O class
+// O.o and O.on append to one buffer that goes out with a single write once it fills up, when the
+// program ends (also through exit, see out_init) and before the program blocks on input. In line
+// mode (the default when stdout is a terminal) every newline flushes as well.
+// the interpreter's own messages still go through stdio, which is flushed before each write so
+// the two stay in order. An embedder can have the output handed to a function instead of a file
+// descriptor, see out_init_callback
+
+#define OUT_BUFFER_SIZE (64 << 10)
+
+struct out_buffer {
+	char*  buff;
+	size_t used;
+	size_t size;
+	int    fd;
+	int    line_mode; // flush after every newline
+	void (*write)(void* user, const char* s, size_t len); // takes the output instead of fd if set
+	void*  user;
+};
+
+static out_buffer* out_live = NULL; // flushed by out_flush_live when the process exits
+
+void output_error(char* error_text);
+
+out_buffer* out_new(int fd, int line_mode);
+void out_init(glass_env* env, int fd, int line_mode);
+void out_init_callback(glass_env* env, void (*write)(void* user, const char* s, size_t len), void* user);
+void out_free(glass_env* env);
+void out_send(out_buffer* out, const char* s, size_t len);
+void out_flush(out_buffer* out);
+void out_flush_live(void);
+void out_write(out_buffer* out, const char* s, size_t len);
+void out_string(out_buffer* out, const char* s);
+void out_int(out_buffer* out, int n);
+
+void output_error(char* error_text) {
+	trap_error("Error in output.h: ", error_text);
+	fprintf(stderr, "Error in output.h: %s\n", error_text);
+	exit(1);
+}
+
+out_buffer* out_new(int fd, int line_mode) {
+	out_buffer* out = (out_buffer*) malloc(sizeof (out_buffer));
+	if (!out) output_error("could not malloc output buffer");
+	out->buff = (char*) malloc(OUT_BUFFER_SIZE);
+	if (!out->buff) {
+		free(out);
+		output_error("could not malloc output buffer");
+	}
+	out->used = 0;
+	out->size = OUT_BUFFER_SIZE;
+	out->fd = fd;
+	out->line_mode = line_mode;
+	out->write = NULL;
+	out->user = NULL;
+	return out;
+}
+
+void out_init(glass_env* env, int fd, int line_mode) {
+	out_buffer* out = out_new(fd, line_mode);
+	env->out = out;
+
+	// runtime errors end the process with exit, the output so far should still appear
+	static int registered = 0;
+	if (!registered) atexit(out_flush_live);
+	registered = 1;
+	out_live = out;
+}
+
+void out_init_callback(glass_env* env, void (*write)(void* user, const char* s, size_t len), void* user) {
+	// output goes to write(user, ...) in blocks of up to OUT_BUFFER_SIZE bytes
+	// nothing is flushed at exit, the embedder frees the buffer with out_free
+	out_buffer* out = out_new(-1, 0);
+	out->write = write;
+	out->user = user;
+	env->out = out;
+}
+
+void out_free(glass_env* env) {
+	out_buffer* out = env->out;
+	if (!out) return;
+	out_flush(out);
+	if (out_live == out) out_live = NULL;
+	free(out->buff);
+	free(out);
+	env->out = NULL;
+}
+
+void out_send(out_buffer* out, const char* s, size_t len) {
+	// write all of s to out's fd, stdio's buffered text first
+	if (out->write) {
+		out->write(out->user, s, len);
+		return;
+	}
+	fflush(stdout);
+	while (len) {
+		ssize_t n = write(out->fd, s, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			// nowhere to report it, drop the output
+			return;
+		}
+		s += n;
+		len -= n;
+	}
+}
+
+void out_flush(out_buffer* out) {
+	// write out everything buffered
+	if (!out->used) return;
+	out_send(out, out->buff, out->used);
+	out->used = 0;
+}
+
+void out_flush_live(void) {
+	if (out_live) out_flush(out_live);
+}
+
+void out_write(out_buffer* out, const char* s, size_t len) {
+	if (len > out->size - out->used) {
+		out_flush(out);
+		if (len >= out->size) {
+			// wouldn't fit in the buffer anyway
+			out_send(out, s, len);
+			return;
+		}
+	}
+	memcpy(out->buff + out->used, s, len);
+	out->used += len;
+	if (out->line_mode && memchr(s, '\n', len)) out_flush(out);
+}
+
+void out_string(out_buffer* out, const char* s) {
+	out_write(out, s, strlen(s));
+}
+
+void out_int(out_buffer* out, int n) {
+	// decimal digits of n, two at a time from the back
+	static const char pairs[201] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char buff[16];
+	char* p = buff + sizeof buff;
+	unsigned int u = (n < 0) ? 0u - (unsigned int) n : (unsigned int) n;
+	while (u >= 100) {
+		unsigned int r = u % 100;
+		u /= 100;
+		p -= 2;
+		memcpy(p, pairs + 2 * r, 2);
+	}
+	if (u >= 10) {
+		p -= 2;
+		memcpy(p, pairs + 2 * u, 2);
+	}
+	else *--p = (char) ('0' + u);
+	if (n < 0) *--p = '-';
+	out_write(out, p, buff + sizeof buff - p);
+}
+
+#endif
@@ -9,34 +9,43 @@
 #define PARSER_H
 
 void parse_error(char* err_text) {
+	trap_error("Error in parser.h: ", err_text);
 	fprintf(stderr, "Error in parser.h: %s\n", err_text);
 	exit(1);
 }
 
 void check_ptr(void* x);
 void check_par(char* start, char a, char b, char end);
-void read_name(char* buff, char* start, int lim);
-char* read_string(char* start);
+int read_name(glass_env* env, char* start);
+char* read_string(glass_env* env, char* start);
 int read_number(char* start);
 token_t make_token(glass_env* env, char* start);
 char* end_of_token(char* start);
 char* read_clean(char* loc);
+char* clean_source(char* buff, long len);
 void alloc_env(glass_env* env);
 void add_class(glass_env* env, char* name);
 void add_class_func(glass_env* env, char* c_name, char* f_name, int tok_idx);
 void init_env(glass_env* env);
 glass_env parse_file(char* filename);
+void parse_source(glass_env* env, char* file);
 
 
 
 glass_env parse_file(char* filename) {
 	// reads in a file, returns parsed and tokenized data to the interpreter
-	// max numbers of names, classes etc. are fixed for now.
 	glass_env res;
-	// intialize the name and lookup arrays with the standard classes and functions
-	init_env(&res);
-
 	char* file = read_clean(filename);
+	parse_source(&res, file);
+	free(file);
+	return res;
+}
+
+void parse_source(glass_env* env, char* file) {
+	// parse the program file, cleaned by clean_source, into env
+	// the env's tables grow with the program, see grow_table
+	// intialize the name and lookup arrays with the standard classes and functions
+	init_env(env);
 	char* file_pos = file;
 
 	//check for matching braces, parens, etc.
@@ -56,18 +65,19 @@ glass_env parse_file(char* filename) {
 
 	while (*file_pos) {
 		// convert the current chunk to a token, add it
-		cur_token = make_token(&res, file_pos);
-		res.tokens[token_idx] = cur_token;
+		cur_token = make_token(env, file_pos);
+		// leave room for the terminating NO_TOKEN
+		env->tokens = (token_t*) grow_table(env->tokens, &env->tokens_cap, token_idx + 2, sizeof (token_t));
+		env->tokens[token_idx] = cur_token;
 		token_idx++;
-		if (token_idx >= MAX_PROGRAM) parse_error("parse_file: MAX_PROGRAM overrun");
 
 		if (next_is_class_name) {
 			next_is_class_name = 0;
 			// the current token should be a name, add the class
 			if (cur_token.type != NAME_IDX) parse_error("parse_file: { must be followed by name");
-			add_class(&res, res.names[cur_token.data]);
+			add_class(env, env->names[cur_token.data]);
 			// set the current class
-			cur_class = res.names[cur_token.data];
+			cur_class = env->names[cur_token.data];
 		}
 		else if (next_is_func_name) {
 			next_is_func_name = 0;
@@ -76,7 +86,7 @@ glass_env parse_file(char* filename) {
 			if (!cur_class) parse_error("parse_file: function definition must follow class definition");
 			// fill out f_loc to point to the token after this name
 			// since token_idx has already been incremented, that's the index to use.
-			add_class_func(&res, cur_class, res.names[cur_token.data], token_idx);
+			add_class_func(env, cur_class, env->names[cur_token.data], token_idx);
 		}
 
 		if (*file_pos == '{') next_is_class_name = 1;
@@ -91,10 +101,9 @@ glass_env parse_file(char* filename) {
 	}
 
 	// terminate with a NO_TOKEN
-	res.tokens[token_idx] = (token_t) {NO_TOKEN, 0};
+	env->tokens[token_idx] = (token_t) {NO_TOKEN, 0};
+	env->n_tokens = token_idx;
 
-	free(file);
-	return res;
 }
 
 void check_ptr(void* x) {
@@ -118,44 +127,39 @@ void check_par(char* start, char a, char b, char end) {
 	if (ps != 0) parse_error("mismatched");
 }
 
-void read_name(char* buff, char* start, int lim) {
-	// copies a name (length < lim-1) possibly in parens into buff
+int read_name(glass_env* env, char* start) {
+	// adds a name, possibly in parens, returns its index
+	// the name is terminated in place for add_name, so start must be writable (it is the file buffer)
+	int len = 1;
 	if (*start == '(') {
 		start++;
-		for (int i = 0; start[i] != ')'; i++) {
-			if (i >= (lim - 2)) parse_error("name too long");
-			buff[i] = start[i];
-			buff[i + 1] = 0;
-		}
-	}
-	else {
-		buff[0] = *start;
-		buff[1] = 0;
+		len = 0;
+		while (start[len] != ')') len++;
 	}
+	char saved = start[len];
+	start[len] = '\0';
+	int res = add_name(env, start);
+	start[len] = saved;
+	return res;
 }
 
-char* read_string(char* start) {
-	// parses a string in ""s, allocates new memory for it
+char* read_string(glass_env* env, char* start) {
+	// parses a string in ""s, copies it to the env's arena
 	// start shoud point to first delimiter
-	char tmp[64] = {0};
 	start++;
-	for (int i = 0; start[i] != '"'; i++) {
-		tmp[i] = start[i];
-	}
-	char* res = (char*) malloc(strlen(tmp) + 1);
-	strcpy(res, tmp);
+	size_t len = 0;
+	while (start[len] != '"') len++;
+	char* res = arena_alloc(env, len + 1);
+	memcpy(res, start, len);
+	res[len] = '\0';
 	return res;
 }
 
 int read_number(char* start) {
 	// parses a number in <>s or ()s
 	// start should point to first delimiter
-	char tmp[64] = {0};
-	start++;
-	for (int i = 0; (start[i] != ')') && (start[i] != '>'); i++) {
-		tmp[i] = start[i];
-	}
-	return atoi(tmp);
+	// atoi stops at the closing delimiter
+	return atoi(start + 1);
 }
 
 token_t make_token(glass_env* env, char* start) {
@@ -164,7 +168,6 @@ token_t make_token(glass_env* env, char* start) {
 	// this function assumes any syntax problems have been caught by now
 	//   -- particularly paren mismatches
 	token_t res;
-	char name_buff[64] = {0};
 	switch (*start) {
 		case '(':
 			if (isdigit(start[1])) {
@@ -176,8 +179,7 @@ token_t make_token(glass_env* env, char* start) {
 			else {
 				// it's a name in parens
 				// TODO add check for illegal characters?
-				read_name(name_buff, start, 64);
-				int name_idx = add_name(env->names, env->scopes, name_buff);
+				int name_idx = read_name(env, start);
 				if (name_idx < 0) parse_error("couldn't add name in make_token");
 				res.type = NAME_IDX;
 				res.data = name_idx;
@@ -193,10 +195,9 @@ token_t make_token(glass_env* env, char* start) {
 			// it's a string - allocate space, add to env->strings, fill out index
 			// written as a block because it opens with a declaration TODO bad hack
 		{
-			char* new_str = read_string(start);
-			int str_idx = 0;
-			while (env->strings[str_idx] && str_idx < MAX_LITERALS) str_idx++;
-			if (str_idx >= MAX_LITERALS) parse_error("MAX_LITERALS exceeded");
+			char* new_str = read_string(env, start);
+			int str_idx = env->n_strings++;
+			env->strings = (char**) grow_table(env->strings, &env->strings_cap, env->n_strings, sizeof (char*));
 			env->strings[str_idx] = new_str;
 			res.type = STNG_IDX;
 			res.data = str_idx;
@@ -206,8 +207,7 @@ token_t make_token(glass_env* env, char* start) {
 		if (isalpha(*start)) {
 			// single-character name
 			// add the name to the name list and set token accordingly
-			read_name(name_buff, start, 64);
-			int name_idx = add_name(env->names, env->scopes, name_buff);
+			int name_idx = read_name(env, start);
 			if (name_idx < 0) parse_error("couldn't add name in make_token");
 			res.type = NAME_IDX;
 			res.data = name_idx;
@@ -258,23 +258,29 @@ char* read_clean(char* loc) {
   		fseek (f, 0, SEEK_SET);
 
   		buff = (char*) malloc(len + 1);
-  		res  = (char*) malloc(len + 1);
-
-  		if (res) memset(res, 0, len+1);
-  		else parse_error("malloc error in read_clean");
-
   		if (buff) fread(buff, sizeof (char), len, f);
   		fclose(f);
 	}
 
 	if (!buff) parse_error("couldn't read file");
 
+	res = clean_source(buff, len);
+	free(buff);
+	return res;
+}
+
+char* clean_source(char* buff, long len) {
+	// a new string holding the len characters of program text at buff, sans whitespace and comments
+	char* res = (char*) malloc(len + 1);
+	if (res) memset(res, 0, len+1);
+	else parse_error("malloc error in clean_source");
+
 	int in_comment = 0;
 	int in_string = 0;
-	int res_i = 0;
+	long res_i = 0;
 	char c;
 
-	for (int i = 0; i < len; i++) {
+	for (long i = 0; i < len; i++) {
 		// strip whitespace and commented text
 		// likely to break - TODO test
 		c = buff[i];
@@ -288,7 +294,6 @@ char* read_clean(char* loc) {
 		}
 	}
 
-	free(buff);
 	return res;
 }
 
@@ -296,54 +301,102 @@ void alloc_env(glass_env* env) {
 	// allocate all the various arrays and nested arrays in an env
 	// initialize everything to 0
 
-	env->names = (char**) malloc(MAX_NAMES * sizeof (char*));
-	memset(env->names, 0, MAX_NAMES * sizeof (char));
-	env->scopes = (enum scope_type*) malloc(MAX_NAMES * sizeof (enum scope_type));
-	memset(env->scopes, 0, MAX_NAMES * sizeof (enum scope_type)); // 0 is NO_SCOPE
+	// every table starts at its *_INIT size and grows as add_name, add_class etc. need it
+	env->arena = NULL;
+	env->image = NULL;
+	env->names_cap = NAMES_INIT;
+	env->names = (char**) malloc(NAMES_INIT * sizeof (char*));
+	env->scopes = (enum scope_type*) malloc(NAMES_INIT * sizeof (enum scope_type));
+	env->name_class = (int*) malloc(NAMES_INIT * sizeof (int));
+	env->global_vars = (val*) malloc(NAMES_INIT * sizeof (val));
+	if (!env->names || !env->scopes || !env->name_class || !env->global_vars) parse_error("could not malloc names in alloc_env");
+	for (int i = 0; i < NAMES_INIT; i++) env->global_vars[i] = no_val();
 	env->names[0] = "~";
+	env->scopes[0] = NO_SCOPE;
+	env->name_class[0] = -1;
 	// ^this is crucial; most subroutines depend on name_idx != 0 for valid names
 	// TODO: needs fixing? Could initialize lookups with -1s but that's inconvenient
-
-	env->c_lookup = (int*) malloc(MAX_CLASSES * sizeof (int));
-	memset(env->c_lookup, 0, MAX_CLASSES * sizeof (int));
-
-	env->f_lookup = (int**) malloc(MAX_CLASSES * sizeof (int*));
-	for (int i = 0; i < MAX_CLASSES; i++) {
-		env->f_lookup[i] = (int*) malloc(MAX_FUNCS * sizeof (int));
-		for (int j = 0; j < MAX_FUNCS; j++) {
-			env->f_lookup[i][j] = -1;
-		}
-	}
-
-	env->f_locs = (int**) malloc(MAX_CLASSES * sizeof (int*));
-	for (int i = 0; i < MAX_CLASSES; i++) {
-		env->f_locs[i] = (int*) malloc(MAX_FUNCS * sizeof (int));
-		memset(env->f_locs[i], 0, MAX_FUNCS * sizeof (int));
-	}
-
-	env->tokens = (token_t*) malloc(MAX_PROGRAM * sizeof (token_t));
-	memset(env->tokens, 0, MAX_PROGRAM * sizeof (token_t));
-
-	env->strings = (char**) malloc(MAX_LITERALS * sizeof (char*));
-	memset(env->strings, 0, MAX_LITERALS * sizeof (char*));
-
-	env->global_vars = (val*) malloc(MAX_NAMES * sizeof (val));
-	for (int i = 0; i < MAX_NAMES; i++) env->global_vars[i] = (val) {NO_VAL, 0};
-
-	//TODO would be good practice to check all these pointerss
+	env->n_names = 1;
+
+	env->name_hash_cap = NAME_HASH_INIT;
+	env->name_hash = (int*) malloc(env->name_hash_cap * sizeof (int));
+	for (int i = 0; i < env->name_hash_cap; i++) env->name_hash[i] = -1;
+	name_hash_insert(env, 0);
+
+	// the per-class tables get rows as classes are added
+	env->n_classes = 0;
+	env->classes_cap = 0;
+	env->c_lookup = NULL;
+	env->n_funcs = NULL;
+	env->funcs_cap = NULL;
+	env->f_lookup = NULL;
+	env->f_locs = NULL;
+	env->f_code = NULL;
+	env->func_hash = NULL;
+	env->func_hash_cap = 0;
+	env->n_func_keys = 0;
+	env->code = NULL; // filled out by compile_env
+	env->n_code = 0;
+	env->c_ctor = NULL;
+	env->shapes = NULL;
+	env->field_names = NULL;
+	env->ics = NULL;
+	env->n_ics = 0;
+	env->local_names = NULL;
+	env->frame = NULL;
+	env->gc = NULL;
+	env->f_info = NULL;
+	env->memo = NULL;
+	env->prof = NULL;
+	env->trace = NULL;
+	env->out = NULL;
+	env->in = NULL;
+	env->vars = NULL;
+	env->peephole = 1;
+	env->frame_top = NULL;
+	env->frame_spare = NULL;
+	env->jit = NULL;
+
+	env->tokens = (token_t*) malloc(PROGRAM_INIT * sizeof (token_t));
+	env->n_tokens = 0;
+	env->tokens_cap = PROGRAM_INIT;
+
+	env->strings = (char**) malloc(LITERALS_INIT * sizeof (char*));
+	env->n_strings = 0;
+	env->strings_cap = LITERALS_INIT;
+	if (!env->tokens || !env->strings) parse_error("could not malloc program in alloc_env");
 }
 
 void add_class(glass_env* env, char* name) {
 	// adds a class to the env c_lookup
-	// if (find_name(env->names, name) >= 0) parse_error("cannot overwrite existing class");
-	// the previous line is commented because it always fails - the tokenizer adds all names
-	// TODO add a proper check for if a class has already been defined
-	// seek the end of class_lookup
-	int i = 0;
-	while (env->c_lookup[i]) i++;
-
-	env->c_lookup[i] = add_name(env->names, env->scopes, name);
+	// a class defined twice shadows the earlier definition (name_class points at the newest)
+	int i = env->n_classes++;
+	if (i >= env->classes_cap) {
+		// the tables indexed by class grow together
+		int cap = env->classes_cap;
+		env->c_lookup = (int*) grow_table(env->c_lookup, &cap, i + 1, sizeof (int));
+		cap = env->classes_cap;
+		env->n_funcs = (int*) grow_table(env->n_funcs, &cap, i + 1, sizeof (int));
+		cap = env->classes_cap;
+		env->funcs_cap = (int*) grow_table(env->funcs_cap, &cap, i + 1, sizeof (int));
+		cap = env->classes_cap;
+		env->f_lookup = (int**) grow_table(env->f_lookup, &cap, i + 1, sizeof (int*));
+		cap = env->classes_cap;
+		env->f_locs = (int**) grow_table(env->f_locs, &cap, i + 1, sizeof (int*));
+		cap = env->classes_cap;
+		env->f_code = (int**) grow_table(env->f_code, &cap, i + 1, sizeof (int*));
+		env->classes_cap = cap;
+	}
+	env->n_funcs[i] = 0;
+	env->funcs_cap[i] = FUNCS_INIT;
+	env->f_lookup[i] = (int*) malloc(FUNCS_INIT * sizeof (int));
+	env->f_locs[i] = (int*) malloc(FUNCS_INIT * sizeof (int));
+	env->f_code[i] = (int*) malloc(FUNCS_INIT * sizeof (int));
+	if (!env->f_lookup[i] || !env->f_locs[i] || !env->f_code[i]) parse_error("could not malloc functions in add_class");
+
+	env->c_lookup[i] = add_name(env, name);
 	if (env->c_lookup[i] < 0) parse_error("couldn't add class name");
+	env->name_class[env->c_lookup[i]] = i;
 }
 
 void add_class_func(glass_env* env, char* c_name, char* f_name, int tok_idx) {
@@ -351,30 +404,38 @@ void add_class_func(glass_env* env, char* c_name, char* f_name, int tok_idx) {
 	// fills out env->f_locs with tok_idx
 	//     for built-in function, supply tok_idx=-1
 
-	int c_name_i = find_name(env->names, c_name);
+	int c_name_i = find_name(env, c_name);
 	// this should never happen
 	if (c_name_i < 0) parse_error("no such class name");
 
 	// get the class' index in f_lookup
-	int c_idx = 0;
-	if (!env->c_lookup[c_idx]) parse_error("no classes in environment");
-	while(env->c_lookup[c_idx]) {
-		if (env->c_lookup[c_idx] == c_name_i) break;
-		c_idx++;
+	if (!env->n_classes) parse_error("no classes in environment");
+	int c_idx = env->name_class[c_name_i];
+	if (c_idx < 0) parse_error("couldn't find class name");
+
+	// take the next empty entry in f_lookup
+	int empty_i = env->n_funcs[c_idx];
+	// a bound function keeps its index in 16 bits (see func_val)
+	if (empty_i > VAL_FUNC_MAX) parse_error("too many functions in one class");
+	if (empty_i >= env->funcs_cap[c_idx]) {
+		int cap = env->funcs_cap[c_idx];
+		env->f_lookup[c_idx] = (int*) grow_table(env->f_lookup[c_idx], &cap, empty_i + 1, sizeof (int));
+		cap = env->funcs_cap[c_idx];
+		env->f_locs[c_idx] = (int*) grow_table(env->f_locs[c_idx], &cap, empty_i + 1, sizeof (int));
+		cap = env->funcs_cap[c_idx];
+		env->f_code[c_idx] = (int*) grow_table(env->f_code[c_idx], &cap, empty_i + 1, sizeof (int));
+		env->funcs_cap[c_idx] = cap;
 	}
-	if (!env->c_lookup[c_idx]) parse_error("couldn't find class name");
-
-	// find the first empty entry in f_lookup
-	int empty_i = 0;
-	while((env->f_lookup[c_idx][empty_i] > 0) && empty_i < MAX_FUNCS) empty_i++;
-	if (empty_i >= MAX_FUNCS) parse_error("MAX_FUNCS exceeded");
 
 	// add the function name, fill out entry
-	int f_name_i = add_name(env->names, env->scopes, f_name);
+	int f_name_i = add_name(env, f_name);
 	if (f_name_i < 0) parse_error("could not add function name");
 	env->f_lookup[c_idx][empty_i] = f_name_i;
+	env->n_funcs[c_idx]++;
+	func_hash_set(env, c_idx, f_name_i, empty_i);
 	// fill out the token index
 	env->f_locs[c_idx][empty_i] = tok_idx;
+	env->f_code[c_idx][empty_i] = 0;
 }
 
 void init_env(glass_env* env) {
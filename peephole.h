@@ -0,0 +1,90 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+
+// peephole pass over the bytecode, run at the end of compile_env
+// the arithmetic idioms of Glass programs take up to eleven instructions, each pushing a name or
+// a function for the next one to pop. The pass finds them and turns the first instruction of each
+// into a fused one doing all of the work at once:
+//   (y)* <k> (o)f.?           OP_ARITH_IMM    push y f k
+//   (y)* (z)* (o)f.?          OP_ARITH_VAR    push y f z
+//   (x) (y)* <k> (o)f.? =     OP_UPDATE_IMM   x = y f k, e.g. (_i)(_i)*<1>(_a)s.?=
+//   (x) (y)* (z)* (o)f.? =    OP_UPDATE_VAR   x = y f z
+//   the same followed by the \ of a loop on x: OP_BRANCH_IMM / OP_BRANCH_VAR, which also test x
+//   and jump straight into the body or past the loop
+// where f is a two-operand A function. The fused instruction keeps the first name as its arg and
+// gets the A function index as its jump, the other operands stay where they were. Only the head
+// changes, so every instruction of the pattern is still there as compiled: when o turns out not to
+// hold the A object, or an operand isn't a number, the fused instruction just acts as the OP_NAME
+// it replaced and the original sequence runs and reports any error as before. For the same reason
+// jumps and returns into the middle of a pattern are fine, and the JIT and the analysis can read
+// a fused instruction as its OP_NAME (base_op).
+// env->peephole = 0 (glass --no-peephole) has the interpreter do exactly that everywhere
+
+int peep_a_func(glass_env* env, instr_t* ins);
+int peep_arith(glass_env* env, instr_t* ins, int* imm, int* a_func);
+int peephole_at(glass_env* env, int i);
+void peephole_env(glass_env* env);
+
+int peep_a_func(glass_env* env, instr_t* ins) {
+	// index of the two-operand A function named by the OP_NAME ins, -1 if it doesn't name one
+	if (ins->op != OP_NAME) return -1;
+	int f = get_func_idx(*env, env->c_lookup[0], ins->arg);
+	if (f == 5) return -1; // A.f takes one operand
+	return f;
+}
+
+int peep_arith(glass_env* env, instr_t* ins, int* imm, int* a_func) {
+	// length of a (y)* <k> (o)f.? or (y)* (z)* (o)f.? sequence at ins, 0 if there is none
+	// every function ends in OP_END, which matches nothing, so the checks never run past it
+	if ((ins[0].op != OP_NAME) || (ins[1].op != OP_LOAD)) return 0;
+	int n;
+	if (ins[2].op == OP_NUMB) n = 1;
+	else if ((ins[2].op == OP_NAME) && (ins[3].op == OP_LOAD)) n = 2;
+	else return 0;
+	instr_t* call = ins + 2 + n;
+	if (call[0].op != OP_NAME) return 0;
+	int f = peep_a_func(env, call + 1);
+	if ((f < 0) || (call[2].op != OP_BIND) || (call[3].op != OP_CALL)) return 0;
+	*imm = (n == 1);
+	*a_func = f;
+	return 2 + n + 4;
+}
+
+int peephole_at(glass_env* env, int i) {
+	// fuse the longest pattern starting at instruction i, returns its length (1 for none)
+	instr_t* ins = env->code + i;
+	int imm, a_func;
+	if (ins->op != OP_NAME) return 1;
+
+	int n = peep_arith(env, ins + 1, &imm, &a_func);
+	if (n && (ins[1 + n].op == OP_ASSIGN)) {
+		n += 2;
+		instr_t* end = ins + n;
+		if ((end->op == OP_ENDLOOP) && (env->code[end->jump].arg == ins->arg)) {
+			ins->op = imm ? OP_BRANCH_IMM : OP_BRANCH_VAR;
+			n++;
+		}
+		else ins->op = imm ? OP_UPDATE_IMM : OP_UPDATE_VAR;
+		ins->jump = a_func;
+		return n;
+	}
+
+	n = peep_arith(env, ins, &imm, &a_func);
+	if (n) {
+		ins->op = imm ? OP_ARITH_IMM : OP_ARITH_VAR;
+		ins->jump = a_func;
+		return n;
+	}
+	return 1;
+}
+
+void peephole_env(glass_env* env) {
+	// fuse the patterns in all of env->code, which compile_env has just filled out
+	for (int i = 0; i < env->n_code; i += peephole_at(env, i));
+}
+
+#endif
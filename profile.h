@@ -0,0 +1,297 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "glassdefs.h"
+#include "gc.h"
+#include "memo.h"
+
+// execution profiler (glass --profile out prog.gl)
+// every frame push and pop (see runtime.h) is timed, which gives the calls and the inclusive and
+// exclusive time of each user function, and every executed instruction is counted at its index
+// in env->code. Instructions stand in for tokens (only /name is folded into one instruction), so
+// the counts of a function's instructions add up to the tokens it executed, and the count of the
+// first instruction of a loop body is the number of iterations of that loop.
+// calls also walk down a call tree, one node per distinct chain of callers, holding the exclusive
+// time spent at that chain. It is written out as folded stacks ("M.m;F.f;F.g 1234", nanoseconds)
+// for flamegraph.pl and similar tools. Chains deeper than PROF_MAX_DEPTH are cut off there, the
+// deeper calls are charged to the node at the cutoff
+
+#define PROF_MAX_DEPTH 256
+#define PROF_INIT_CAP 1024
+
+typedef struct prof_node prof_node;
+typedef struct prof_call prof_call;
+
+struct prof_node {
+	int       start;   // OP_ENTER of the function, -1 for the root
+	int       parent;
+	int       child;   // first child, -1 if none
+	int       sibling; // next child of the parent, -1 if none
+	int       depth;
+	long long self_ns;
+};
+
+// a live call, one per frame
+struct prof_call {
+	int       node;
+	int       start;
+	long long t0;       // when the call started
+	long long child_ns; // time spent in its callees so far
+};
+
+struct prof_state {
+	long*      counts;   // counts[i] is how often env->code[i] ran
+	long*      calls;    // calls, inclusive and exclusive time of the function at start,
+	long long* incl_ns;  // indexed by start like env->f_info
+	long long* excl_ns;
+	int*       active;   // live calls of the function at start, for recursion
+	int*       class_of; // class and function index of the function at start, class -1 elsewhere
+	int*       func_of;
+	long*      std_calls[STD_LIBS]; // std_calls[c][f] counts calls to function f of standard class c
+	prof_node* nodes;
+	int        n_nodes;
+	int        node_cap;
+	prof_call* live;
+	int        n_live;
+	int        live_cap;
+	long long  t_start;
+};
+
+void profile_error(char* error_text);
+
+long long prof_now();
+void prof_init(glass_env* env);
+void prof_free(glass_env* env);
+int prof_child(prof_state* prof, int parent, int start);
+void prof_enter(glass_env* env, int start);
+void prof_exit(glass_env* env);
+void prof_func_name(glass_env* env, int start, char* buf, size_t size);
+int prof_func_end(glass_env* env, int start);
+void prof_report(glass_env* env, FILE* out);
+void prof_folded(glass_env* env, FILE* out);
+
+void profile_error(char* error_text) {
+	trap_error("Error in profile.h: ", error_text);
+	fprintf(stderr, "Error in profile.h: %s\n", error_text);
+	exit(1);
+}
+
+long long prof_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void prof_init(glass_env* env) {
+	// needs env->code from compile_env
+	prof_state* prof = (prof_state*) calloc(1, sizeof (prof_state));
+	if (!prof) profile_error("could not malloc profile in prof_init");
+	int n = env->n_code + 1;
+	prof->counts = (long*) calloc(n, sizeof (long));
+	prof->calls = (long*) calloc(n, sizeof (long));
+	prof->incl_ns = (long long*) calloc(n, sizeof (long long));
+	prof->excl_ns = (long long*) calloc(n, sizeof (long long));
+	prof->active = (int*) calloc(n, sizeof (int));
+	prof->class_of = (int*) malloc(n * sizeof (int));
+	prof->func_of = (int*) malloc(n * sizeof (int));
+	for (int c = 0; c < STD_LIBS; c++) {
+		prof->std_calls[c] = (long*) calloc(env->n_funcs[c] + 1, sizeof (long));
+		if (!prof->std_calls[c]) profile_error("could not malloc std counters in prof_init");
+	}
+	prof->nodes = (prof_node*) malloc(PROF_INIT_CAP * sizeof (prof_node));
+	prof->live = (prof_call*) malloc(PROF_INIT_CAP * sizeof (prof_call));
+	if (!prof->counts || !prof->calls || !prof->incl_ns || !prof->excl_ns || !prof->active || !prof->class_of || !prof->func_of || !prof->nodes || !prof->live) {
+		profile_error("could not malloc counters in prof_init");
+	}
+	for (int i = 0; i < n; i++) prof->class_of[i] = -1;
+	for (int c = STD_LIBS; c < env->n_classes; c++) {
+		for (int f = 0; f < env->n_funcs[c]; f++) {
+			if (env->f_code[c][f] < 0) continue;
+			prof->class_of[env->f_code[c][f]] = c;
+			prof->func_of[env->f_code[c][f]] = f;
+		}
+	}
+	prof->node_cap = PROF_INIT_CAP;
+	prof->live_cap = PROF_INIT_CAP;
+	prof->nodes[0] = (prof_node) {-1, -1, -1, -1, 0, 0};
+	prof->n_nodes = 1;
+	prof->t_start = prof_now();
+	env->prof = prof;
+}
+
+void prof_free(glass_env* env) {
+	prof_state* prof = env->prof;
+	if (!prof) return;
+	free(prof->counts);
+	free(prof->calls);
+	free(prof->incl_ns);
+	free(prof->excl_ns);
+	free(prof->active);
+	free(prof->class_of);
+	free(prof->func_of);
+	for (int c = 0; c < STD_LIBS; c++) free(prof->std_calls[c]);
+	free(prof->nodes);
+	free(prof->live);
+	free(prof);
+	env->prof = NULL;
+}
+
+int prof_child(prof_state* prof, int parent, int start) {
+	// the call tree node for the function at start called from parent, made on first use
+	if (prof->nodes[parent].depth >= PROF_MAX_DEPTH) return parent;
+	for (int n = prof->nodes[parent].child; n >= 0; n = prof->nodes[n].sibling) {
+		if (prof->nodes[n].start == start) return n;
+	}
+	if (prof->n_nodes >= prof->node_cap) {
+		prof->node_cap *= 2;
+		prof->nodes = (prof_node*) realloc(prof->nodes, prof->node_cap * sizeof (prof_node));
+		if (!prof->nodes) profile_error("could not realloc call tree in prof_child");
+	}
+	int n = prof->n_nodes++;
+	prof->nodes[n] = (prof_node) {start, parent, -1, prof->nodes[parent].child, prof->nodes[parent].depth + 1, 0};
+	prof->nodes[parent].child = n;
+	return n;
+}
+
+void prof_enter(glass_env* env, int start) {
+	// a frame for the function at start was just pushed
+	prof_state* prof = env->prof;
+	if (prof->n_live >= prof->live_cap) {
+		prof->live_cap *= 2;
+		prof->live = (prof_call*) realloc(prof->live, prof->live_cap * sizeof (prof_call));
+		if (!prof->live) profile_error("could not realloc live calls in prof_enter");
+	}
+	int parent = prof->n_live ? prof->live[prof->n_live - 1].node : 0;
+	prof->live[prof->n_live++] = (prof_call) {prof_child(prof, parent, start), start, prof_now(), 0};
+	prof->calls[start]++;
+	prof->active[start]++;
+}
+
+void prof_exit(glass_env* env) {
+	// the innermost frame is being popped
+	prof_state* prof = env->prof;
+	if (!prof->n_live) profile_error("prof_exit without a live call");
+	prof_call* call = prof->live + --prof->n_live;
+	long long t = prof_now() - call->t0;
+	long long self = t - call->child_ns;
+	prof->excl_ns[call->start] += self;
+	prof->nodes[call->node].self_ns += self;
+	// recursive calls are inside the outermost one, which alone counts towards inclusive time
+	if (!--prof->active[call->start]) prof->incl_ns[call->start] += t;
+	if (prof->n_live) prof->live[prof->n_live - 1].child_ns += t;
+}
+
+void prof_func_name(glass_env* env, int start, char* buf, size_t size) {
+	// "Class.func" for the function whose OP_ENTER is at start
+	int c = env->prof->class_of[start];
+	int f = env->prof->func_of[start];
+	if (c < 0) snprintf(buf, size, "?");
+	else snprintf(buf, size, "%s.%s", env->names[env->c_lookup[c]], env->names[env->f_lookup[c][f]]);
+}
+
+int prof_func_end(glass_env* env, int start) {
+	// index of the OP_END closing the function at start
+	int end = start;
+	while (env->code[end].op != OP_END) end++;
+	return end;
+}
+
+void prof_report(glass_env* env, FILE* out) {
+	// the text report: functions by exclusive time, loops by iterations, standard library calls, then
+	// the collector's and the memo table's counters
+	prof_state* prof = env->prof;
+	char name[256];
+	long total = 0;
+	for (int i = 0; i < env->n_code; i++) {
+		if (env->code[i].op != OP_ENTER) total += prof->counts[i];
+	}
+	fprintf(out, "glass profile: %ld tokens executed in %.3fs\n", total, (prof_now() - prof->t_start) / 1e9);
+
+	// user functions, by start, sorted by exclusive time (selection sort, there aren't many)
+	int* funcs = (int*) malloc((env->n_code + 1) * sizeof (int));
+	if (!funcs) profile_error("could not malloc in prof_report");
+	int n_funcs = 0;
+	for (int i = 0; i < env->n_code; i++) {
+		if ((env->code[i].op == OP_ENTER) && prof->calls[i]) funcs[n_funcs++] = i;
+	}
+	for (int i = 0; i < n_funcs; i++) {
+		int best = i;
+		for (int j = i + 1; j < n_funcs; j++) {
+			if (prof->excl_ns[funcs[j]] > prof->excl_ns[funcs[best]]) best = j;
+		}
+		int tmp = funcs[i];
+		funcs[i] = funcs[best];
+		funcs[best] = tmp;
+	}
+	fprintf(out, "\nfunctions:\n%12s %14s %12s %12s  %s\n", "calls", "tokens", "incl ms", "excl ms", "function");
+	for (int i = 0; i < n_funcs; i++) {
+		int start = funcs[i];
+		long tokens = 0;
+		int end = prof_func_end(env, start);
+		for (int k = start + 1; k <= end; k++) tokens += prof->counts[k];
+		prof_func_name(env, start, name, sizeof name);
+		fprintf(out, "%12ld %14ld %12.3f %12.3f  %s\n", prof->calls[start], tokens,
+			prof->incl_ns[start] / 1e6, prof->excl_ns[start] / 1e6, name);
+	}
+
+	// loops, sorted by iterations: the body's first instruction runs once per iteration
+	int n_loops = 0;
+	for (int i = 0; i < env->n_code; i++) {
+		if ((env->code[i].op == OP_LOOP) && prof->counts[i]) funcs[n_loops++] = i;
+	}
+	for (int i = 0; i < n_loops; i++) {
+		int best = i;
+		for (int j = i + 1; j < n_loops; j++) {
+			if (prof->counts[funcs[j] + 1] > prof->counts[funcs[best] + 1]) best = j;
+		}
+		int tmp = funcs[i];
+		funcs[i] = funcs[best];
+		funcs[best] = tmp;
+	}
+	fprintf(out, "\nloops:\n%12s  %s\n", "iterations", "loop");
+	for (int i = 0; i < n_loops; i++) {
+		int at = funcs[i];
+		int start = at;
+		while (env->code[start].op != OP_ENTER) start--;
+		prof_func_name(env, start, name, sizeof name);
+		fprintf(out, "%12ld  /%s in %s at token %d\n", prof->counts[at + 1],
+			env->names[env->code[at].arg], name, env->code[at].tok);
+	}
+	free(funcs);
+
+	fprintf(out, "\nstandard library calls:\n%12s  %s\n", "calls", "function");
+	for (int c = 0; c < STD_LIBS; c++) {
+		for (int f = 0; f < env->n_funcs[c]; f++) {
+			if (!prof->std_calls[c][f]) continue;
+			fprintf(out, "%12ld  %s.%s\n", prof->std_calls[c][f], env->names[env->c_lookup[c]], env->names[env->f_lookup[c][f]]);
+		}
+	}
+
+	if (env->gc) {
+		fprintf(out, "\nheap:\n%12d  collections\n%12zu  bytes freed\n%12zu  bytes live\n",
+			env->gc->n_collections, env->gc->freed, env->gc->bytes);
+	}
+	if (env->memo) fprintf(out, "\nmemo:\n%12ld  hits\n%12ld  misses\n", env->memo->hits, env->memo->misses);
+}
+
+void prof_folded(glass_env* env, FILE* out) {
+	// one line per call tree node that spent time on its own: the chain of callers, then nanoseconds
+	prof_state* prof = env->prof;
+	int chain[PROF_MAX_DEPTH + 1];
+	char name[256];
+	for (int n = 1; n < prof->n_nodes; n++) {
+		if (prof->nodes[n].self_ns <= 0) continue;
+		int depth = 0;
+		for (int k = n; k > 0; k = prof->nodes[k].parent) chain[depth++] = k;
+		for (int d = depth - 1; d >= 0; d--) {
+			prof_func_name(env, prof->nodes[chain[d]].start, name, sizeof name);
+			fprintf(out, "%s%c", name, d ? ';' : ' ');
+		}
+		fprintf(out, "%lld\n", prof->nodes[n].self_ns);
+	}
+}
+
+#endif
@@ -3,13 +3,40 @@
 
 #define STACK_INC 1000
 #define STACK_DEC 1500
+#define FRAME_CHUNK 4096 // slots per frame stack chunk
+#define FRAME_HDR_SLOTS ((int) ((sizeof (frame_t) + sizeof (val) - 1) / sizeof (val)))
+#define EXTRA_INIT 4 // entries of a new extra_vars table
+
+// dispatch macros for the bytecode loop in execute_function
+// gcc and clang get computed-goto threading (one indirect jump per instruction), others a switch
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
 
-#define is_func_end(tok) ((tok.type == ASCII)&&(tok.data==']'))
-#define is_loop_end(tok) ((tok.type == ASCII)&&(tok.data=='\\'))
+// with --profile every instruction is counted first (see profile.h): the threaded loop switches to
+// a dispatch table that leads through L_PROFILE, so there is no cost when not profiling
+// fused instructions (peephole.h) run as the OP_NAME they replaced when profiling or with
+// env->peephole off, through another table or the fuse flag of the switch
+#ifdef THREADED_DISPATCH
+#define DISPATCH_START() NEXT()
+#define OP(op) L_##op:
+#define NEXT() goto *table[pc->op]
+#define DISPATCH_END()
+#else
+#define PROFILE_INSTR() if (env->prof) env->prof->counts[pc - code]++
+#define DISPATCH_START() for (;;) { PROFILE_INSTR(); \
+	switch ((fuse || (pc->op < OP_FIRST_FUSED)) ? pc->op : OP_NAME) {
+#define OP(op) case op:
+#define NEXT() continue
+#define DISPATCH_END() default: runtime_error("execute_function: bad op"); } }
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include "glassdefs.h"
+#include "gc.h"
+#include "output.h"
+#include "input.h"
 
 void runtime_error(char* error_text);
 void runtime_error_verbose(glass_env* env, v_list* stack, int t_i, char* error_text);
@@ -17,31 +44,68 @@ void runtime_error_verbose(glass_env* env, v_list* stack, int t_i, char* error_t
 v_list init_stack();
 void push(v_list* stack, val x);
 val pop(v_list* stack);
+static inline val pop_proven(v_list* stack, int proven);
 
 void print_stack(v_list* stack);
-void print_func(glass_env* env, func_t f);
 void print_loc(glass_env* env, int t_i);
 
 void execute_A_function(int func_i, v_list* stack);
-void execute_S_function(int func_i, v_list* stack);
+static inline void a_proven(int func_i, v_list* stack);
+int a_apply(int func_i, int x, int y);
+void execute_S_function(glass_env* env, int func_i, v_list* stack);
 void execute_O_function(glass_env* env, int func_i, v_list* stack);
+void execute_V_function(glass_env* env, frame_t* fr, int func_i, v_list* stack);
+void execute_I_function(glass_env* env, int func_i, v_list* stack);
 void execute_std_function(glass_env* env, func_t func, v_list* stack);
 
+object_t* new_object(glass_env* env, int class_i);
 object_t* init_object(glass_env* env, int class_i, v_list* stack);
-val* get_name_target(glass_env* env, val* obj_vals, val* locals, val n);
-int execute_token(glass_env* env, object_t* obj, v_list* stack, val* lcl_vars, int t_i);
+int ic_find_func(glass_env* env, ic_t* ic, int class_i, int f_name);
+int ic_find_class(glass_env* env, ic_t* ic, int c_name);
+val* frame_alloc(glass_env* env, int n);
+void frame_free(glass_env* env, int n);
+frame_t* frame_push(glass_env* env, object_t* obj, int start, instr_t* ret, int memo, v_list* stack);
+void frame_pop(glass_env* env);
+int name_slot(int* names, int n, int name);
+int frame_slot(frame_t* fr, int name);
+val* extra_target(glass_env* env, extra_vars** extra, int name);
+int field_slot(glass_env* env, object_t* obj, int name);
+val* get_name_target(glass_env* env, frame_t* fr, val n);
+void exec_assign(glass_env* env, v_list* stack, frame_t* fr);
+object_t* exec_new(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins);
+func_t resolve_bind(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins);
+void exec_bind(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins);
+void exec_call(glass_env* env, v_list* stack);
+void exec_load(glass_env* env, v_list* stack, frame_t* fr);
+void exec_self(glass_env* env, v_list* stack, frame_t* fr);
+int loop_condition(glass_env* env, frame_t* fr, int name, int proven);
+int fused_arith(glass_env* env, frame_t* fr, instr_t* ins, int a_func, int imm, int* res);
 void execute_function(glass_env* env, func_t func, v_list* stack);
 
+#include "jit.h"
+#include "memo.h"
+#include "profile.h"
+#include "trace.h"
+
 void runtime_error(char* error_text) {
+	trap_error("runtime error: ", error_text);
+	// the program's output so far comes before the error
+	out_flush_live();
 	fprintf(stderr, "runtime error:\n%s\n", error_text);
+	trace_fail(error_text);
 	exit(1);
 }
 
 void runtime_error_verbose(glass_env* env, v_list* stack, int t_i, char* error_text) {
+	// a trap gets the message without the state dump, which would go to stdout
+	trap_error("runtime error: ", error_text);
+	if (env->out) out_flush(env->out);
 	printf("runtime error:\n%s\n", error_text);
 	printf("state info follows:\n");
 	print_loc(env, t_i);
 	print_stack(stack);
+	fflush(stdout);
+	trace_fail(error_text);
 	exit(1);
 }
 
@@ -65,16 +129,8 @@ void push(v_list* stack, val x) {
 		if (!stack->vs) runtime_error("could not realloc stack memory in push");
 	}
 
-	if (x.type == STNG) {
-		// any string pushed to the stack gets copied and a new alloc
-		// TODO figure out when to properly free this (woo leaks) (hint: can't do it on pop())
-		char* x_copy = (char*) malloc((strlen(x.stng) + 1) * sizeof (char));
-		strcpy(x_copy, x.stng);
-		stack->vs[stack->last_i] = (val) {STNG, .stng = x_copy};
-	}
-	else {
-		stack->vs[stack->last_i] = x;
-	}
+	// strings are never modified in place, so the stack can share them
+	stack->vs[stack->last_i] = x;
 }
 
 val pop(v_list* stack) {
@@ -95,6 +151,13 @@ val pop(v_list* stack) {
 	return res;
 }
 
+static inline val pop_proven(v_list* stack, int proven) {
+	// pop for an instruction with verify.h's proven bits, without the checks when the value is
+	// known to be there (the stack shrinks at the next checked pop)
+	if (proven & PROVEN_DEPTH) return stack->vs[stack->last_i--];
+	return pop(stack);
+}
+
 void print_stack(v_list* stack) {
 	printf("stack:\n");
 	for (int i = stack->last_i; i >= 0; i--) {
@@ -103,13 +166,6 @@ void print_stack(v_list* stack) {
 	printf("end stack\n");
 }
 
-void print_func(glass_env* env, func_t f) {
-	printf("function c:%s f:%s, obj c:%s\n", 
-		env->names[env->c_lookup[f.class_i]],
-		env->names[env->f_lookup[f.class_i][f.func_i]],
-		env->names[env->c_lookup[f.obj->class_i]]);
-}
-
 void print_loc(glass_env* env, int t_i) {
 	print_tokens(env->tokens);
 	for (int i = 0; i < t_i; i++) printf(" ");
@@ -125,65 +181,55 @@ void execute_A_function(int func_i, v_list* stack) {
 	if (func_i != 5) {
 		// floor doesn't use two operands
 		x = pop(stack);
-		if (x.type != NUMB) runtime_error("arithmetic operands must be numbers");
+		if (val_tag(x) != NUMB) runtime_error("arithmetic operands must be numbers");
 	}
-	if (y.type != NUMB) runtime_error("arithmetic operands must be numbers");
+	if (val_tag(y) != NUMB) runtime_error("arithmetic operands must be numbers");
+
+	if (func_i == 5) push(stack, numb_val(val_numb(y)));
+	else push(stack, numb_val(a_apply(func_i, val_numb(x), val_numb(y))));
+}
 
+static inline void a_proven(int func_i, v_list* stack) {
+	// execute_A_function on operands verify.h proved are there and are numbers
+	if (func_i == 5) return; // the floor of a number is itself
+	val* top = stack->vs + stack->last_i;
+	top[-1] = numb_val(a_apply(func_i, val_numb(top[-1]), val_numb(top[0])));
+	stack->last_i--;
+}
+
+int a_apply(int func_i, int x, int y) {
+	// result of the two-operand A function func_i, also used by the fused instructions
 	switch (func_i) {
-		case 0:
-			push(stack, (val) {NUMB, (int) (x.numb + y.numb)});
-		break;
-		case 1:
-			push(stack, (val) {NUMB, (int) (x.numb - y.numb)});
-		break;
-		case 2:
-			push(stack, (val) {NUMB, (int) (x.numb * y.numb)});
-		break;
-		case 3:
-			push(stack, (val) {NUMB, (int) (x.numb / y.numb)});
-		break;
-		case 4:
-			push(stack, (val) {NUMB, (int) (x.numb % y.numb)});
-		break;
-		case 5:
-			push(stack, (val) {NUMB, (int) (y.numb)});
-		break;
-		case 6:
-			push(stack, (val) {NUMB, (int) (x.numb == y.numb)});
-		break;
-		case 7:
-			push(stack, (val) {NUMB, (int) (x.numb != y.numb)});
-		break;
-		case 8:
-			push(stack, (val) {NUMB, (int) (x.numb < y.numb)});
-		break;
-		case 9:
-			push(stack, (val) {NUMB, (int) (x.numb <= y.numb)});
-		break;
-		case 10:
-			push(stack, (val) {NUMB, (int) (x.numb > y.numb)});
-		break;
-		case 11:
-			push(stack, (val) {NUMB, (int) (x.numb >= y.numb)});
-		break;
+		case 0: return x + y;
+		case 1: return x - y;
+		case 2: return x * y;
+		case 3: return x / y;
+		case 4: return x % y;
+		case 6: return x == y;
+		case 7: return x != y;
+		case 8: return x < y;
+		case 9: return x <= y;
+		case 10: return x > y;
+		case 11: return x >= y;
 		default:
 		// this should be an unreachable state
-		runtime_error("execute_A_function: bad func_i");
+		runtime_error("a_apply: bad func_i");
+		return 0;
 	}
 }
 
-void execute_S_function(int func_i, v_list* stack) {
+void execute_S_function(glass_env* env, int func_i, v_list* stack) {
 	// execute a function of class S, with func_i indexing into the canonical function ordering
 	// std_S_funcs[] = {"l", "i", "si", "a", "d", "e", "ns", "sn", NULL};
+	// results are new strings on the collected heap, operands are never modified
 	val x, y, z;
-	// TODO this is all leaky and will need a garbage collector to fix properly
 	switch (func_i) {
 		case 0:
 		{
 			// string length
 			x = pop(stack);
-			if (x.type != STNG) runtime_error("string length operand must be string");
-			push(stack, (val) {NUMB, .numb=(int) strlen(x.stng)});
+			if (val_tag(x) != STNG) runtime_error("string length operand must be string");
+			push(stack, numb_val((int) strlen(val_stng(x))));
 		}
 		break;
 		case 1:
@@ -191,11 +237,8 @@ void execute_S_function(int func_i, v_list* stack) {
 			// index into string, push single-character string
 			y = pop(stack);
 			x = pop(stack);
-			if ((x.type != STNG) || (y.type != NUMB)) runtime_error("string index operands must be string and number");
-			char* res = (char*) malloc(2 * sizeof (char));
-			res[0] = x.stng[y.numb];
-			res[1] = '\0';
-			push(stack, (val) {STNG, .stng=(char*) res});
+			if ((val_tag(x) != STNG) || (val_tag(y) != NUMB)) runtime_error("string index operands must be string and number");
+			push(stack, stng_val(env->gc->chars[(unsigned char) val_stng(x)[val_numb(y)]]));
 		}
 		break;
 		case 2:
@@ -204,12 +247,11 @@ void execute_S_function(int func_i, v_list* stack) {
 			z = pop(stack);
 			y = pop(stack);
 			x = pop(stack);
-			if ((x.type != STNG) || (y.type != NUMB) || (z.type != STNG)) runtime_error("character replace operands must be string, number, string");
-			if (strlen(x.stng) <= y.numb) runtime_error("character replace index overshoot");
-			char* res = (char*) malloc(strlen(x.stng) * sizeof (char));
-			strcpy(res, x.stng);
-			res[y.numb] = z.stng[0];
-			push(stack, (val) {STNG, .stng=(char*) res});
+			if ((val_tag(x) != STNG) || (val_tag(y) != NUMB) || (val_tag(z) != STNG)) runtime_error("character replace operands must be string, number, string");
+			if (strlen(val_stng(x)) <= val_numb(y)) runtime_error("character replace index overshoot");
+			char* res = gc_copy_string(env, val_stng(x));
+			res[val_numb(y)] = val_stng(z)[0];
+			push(stack, stng_val(res));
 		}
 		break;
 		case 3:
@@ -217,12 +259,18 @@ void execute_S_function(int func_i, v_list* stack) {
 			// concatenate strings
 			y = pop(stack);
 			x = pop(stack);
-			if ((x.type != STNG) || (y.type != STNG)) runtime_error("string concat operands must be string and string");
-			char* res = (char*) malloc((strlen(x.stng) + strlen(y.stng) + 1) * sizeof (char));
-			strcpy(res, x.stng);
-			strcat(res, y.stng);
-			// strcat should write an appropriate null-terminator
-			push(stack, (val) {STNG, .stng=(char*) res});
+			if ((val_tag(x) != STNG) || (val_tag(y) != STNG)) runtime_error("string concat operands must be string and string");
+			size_t len_x = strlen(val_stng(x));
+			size_t len_y = strlen(val_stng(y));
+			// appending an empty string gives back the same (immutable) string
+			if (!len_y) push(stack, x);
+			else if (!len_x) push(stack, y);
+			else {
+				char* res = gc_new_string(env, len_x + len_y);
+				memcpy(res, val_stng(x), len_x);
+				memcpy(res + len_x, val_stng(y), len_y);
+				push(stack, stng_val(res));
+			}
 		}
 		break;
 		case 4:
@@ -230,16 +278,26 @@ void execute_S_function(int func_i, v_list* stack) {
 			// divide string x at y
 			y = pop(stack);
 			x = pop(stack);
-			if ((x.type != STNG) || (y.type != NUMB)) runtime_error("string split must be string and number");
-			int total_len = strlen(x.stng);
-			int len_a = y.numb;
-			int len_b = total_len - y.numb;
-			char* res_a = (char*) malloc((len_a + 2) * sizeof (char));
-			char* res_b = (char*) malloc((len_b + 2) * sizeof (char));
-			strncpy(res_a, x.stng, y.numb);
-			strcpy(res_b, x.stng + y.numb); // copy everything after the split
-			push(stack, (val) {STNG, .stng=(char*) res_a});
-			push(stack, (val) {STNG, .stng=(char*) res_b});
+			if ((val_tag(x) != STNG) || (val_tag(y) != NUMB)) runtime_error("string split must be string and number");
+			int total_len = strlen(val_stng(x));
+			if ((val_numb(y) < 0) || (val_numb(y) > total_len)) runtime_error("string split index out of range");
+			int len_a = val_numb(y);
+			int len_b = total_len - val_numb(y);
+			// an empty side is the static empty string (chars[0]), the other side is x itself
+			char* res_a = val_stng(x);
+			char* res_b = val_stng(x);
+			if (!len_a) res_a = env->gc->chars[0];
+			else if (len_b) {
+				res_a = gc_new_string(env, len_a);
+				memcpy(res_a, val_stng(x), len_a);
+			}
+			if (!len_b) res_b = env->gc->chars[0];
+			else if (len_a) {
+				res_b = gc_new_string(env, len_b);
+				memcpy(res_b, val_stng(x) + len_a, len_b); // everything after the split
+			}
+			push(stack, stng_val(res_a));
+			push(stack, stng_val(res_b));
 		}
 		break;
 		case 5:
@@ -247,30 +305,27 @@ void execute_S_function(int func_i, v_list* stack) {
 			// string equality
 			y = pop(stack);
 			x = pop(stack);
-			if ((x.type != STNG) || (y.type != STNG)) runtime_error("string equality operands must be string and string");
-			if (!strcmp(x.stng, y.stng)) push(stack, (val) {NUMB, (int) 1});
-			else push(stack, (val) {NUMB, .numb=(int) 0});
+			if ((val_tag(x) != STNG) || (val_tag(y) != STNG)) runtime_error("string equality operands must be string and string");
+			if (!strcmp(val_stng(x), val_stng(y))) push(stack, numb_val(1));
+			else push(stack, numb_val(0));
 		}
 		break;
 		case 6:
 		{
 			// number to character
 			x = pop(stack);
-			if (x.type != NUMB) runtime_error("number to character operand must be number");
-			if((x.numb < 0)||(x.numb > 255)) runtime_error("0 < x < 256 for number to character");
-			char* res = (char*) malloc(2 * sizeof(char));
-			res[0] = (char) x.numb;
-			res[1] = '\0';
-			push(stack, (val) {STNG, .stng=(char*) res});
+			if (val_tag(x) != NUMB) runtime_error("number to character operand must be number");
+			if((val_numb(x) < 0)||(val_numb(x) > 255)) runtime_error("0 < x < 256 for number to character");
+			push(stack, stng_val(env->gc->chars[val_numb(x)]));
 		}
 		break;
 		case 7:
 		{
 			// character to number
 			x = pop(stack);
-			if (x.type != STNG) runtime_error("character to number operand must be number");
+			if (val_tag(x) != STNG) runtime_error("character to number operand must be number");
 
-			push(stack, (val) {NUMB, .numb=(int) x.stng[0]});
+			push(stack, numb_val((int) val_stng(x)[0]));
 		}
 		break;
 		default:
@@ -284,23 +339,71 @@ void execute_O_function(glass_env* env, int func_i, v_list* stack) {
 	val x = pop(stack);
 	switch (func_i) {
 		case 0:
-			if (x.type == NAME) {
-				printf("%s\n", env->names[x.name]);
+			if ((val_tag(x) == NAME) && (val_name(x) < 0)) {
+				out_write(env->out, "V", 1);
+				out_int(env->out, var_slot(val_name(x)));
+				out_write(env->out, "\n", 1);
 			}
-			else if (x.type == STNG) {
-				printf("%s", x.stng);
+			else if (val_tag(x) == NAME) {
+				out_string(env->out, env->names[val_name(x)]);
+				out_write(env->out, "\n", 1);
+			}
+			else if (val_tag(x) == STNG) {
+				out_string(env->out, val_stng(x));
 			}
 			else runtime_error("output operand must be string or name");
 		break;
 		case 1:
-			if (x.type != NUMB) runtime_error("output number operand must be number");
-			printf("%d\n", x.numb);
+			if (val_tag(x) != NUMB) runtime_error("output number operand must be number");
+			out_int(env->out, val_numb(x));
+			out_write(env->out, "\n", 1);
 		break;
 		default:
 		runtime_error("execute_O_function: bad func_i");
 	}
 }
 
+void execute_V_function(glass_env* env, frame_t* fr, int func_i, v_list* stack) {
+	// execute a function of class V, with func_i indexing into the canonical function ordering
+	// {"n", "d", NULL};
+	switch (func_i) {
+		case 0:
+			push(stack, var_new(env));
+		break;
+		case 1:
+		{
+			val x = pop(stack);
+			if (val_tag(x) != NAME) runtime_error("delete name operand must be name");
+			if (val_name(x) >= 0) {
+				// a name from the program text just loses its value
+				*get_name_target(env, fr, x) = no_val();
+			}
+			else if (!var_delete(env, x)) runtime_error("generated name deleted twice");
+		}
+		break;
+		default:
+		runtime_error("execute_V_function: bad func_i");
+	}
+}
+
+void execute_I_function(glass_env* env, int func_i, v_list* stack) {
+	// execute a function of class I, with func_i indexing into the canonical function ordering
+	// {"l", "c", "e", NULL};
+	switch (func_i) {
+		case 0:
+			push(stack, stng_val(in_line(env)));
+		break;
+		case 1:
+			push(stack, stng_val(in_char(env)));
+		break;
+		case 2:
+			push(stack, numb_val(in_end(env)));
+		break;
+		default:
+		runtime_error("execute_I_function: bad func_i");
+	}
+}
+
 void execute_std_function(glass_env* env, func_t func, v_list* stack) {
 	// order of standard functions: (from parser.h:)
 	// 1: "A", "S", "V", "O", "I"
@@ -311,293 +414,588 @@ void execute_std_function(glass_env* env, func_t func, v_list* stack) {
 	//char* std_I_funcs[] = {"l", "c", "e", NULL};
 
 	// i sincerely apologize for the appearance of this function.
+	if (env->prof) env->prof->std_calls[func.class_i][func.func_i]++;
+	if (TRACING(env)) trace_put(env, TRACE_STD, STD_CALL_JUMP(func.class_i, func.func_i));
 	switch (func.class_i) {
 		case 0:
 			execute_A_function(func.func_i, stack);
 		break;
 		case 1:
-			execute_S_function(func.func_i, stack);
+			execute_S_function(env, func.func_i, stack);
 		break;
 		case 2:
-			runtime_error("V class not yet supported");
+			execute_V_function(env, env->frame, func.func_i, stack);
 		break;
 		case 3:
 			execute_O_function(env, func.func_i, stack);
 		break;
 		case 4:
-			runtime_error("I class not yet supported");
+			execute_I_function(env, func.func_i, stack);
 		break;
 		default:
 		runtime_error("execute_std_function: bad class input");
 	}
 }
 
+object_t* new_object(glass_env* env, int class_i) {
+	// allocate memory for an object with all its fields unset, the constructor isn't run
+	if (class_i < 0) runtime_error("init_object: bad class index");
+	// objects only have room for the fields their class's functions use
+	int n_fields = env->shapes[class_i].n_fields;
+	object_t* res = (object_t*) gc_alloc(env, GC_OBJT, sizeof (object_t) + n_fields * sizeof (val));
+	res->class_i = class_i;
+	res->extra = NULL;
+	for (int i = 0; i < n_fields; i++) res->vars[i] = no_val();
+	if (TRACING(env)) trace_put(env, TRACE_NEW, class_i);
+	return res;
+}
+
 object_t* init_object(glass_env* env, int class_i, v_list* stack) {
 	// allocate memory for an object, run its initializer if it exists, return a pointer
-	object_t* res = (object_t*) malloc(sizeof (object_t));
-	res->class_i = class_i;
+	object_t* res = new_object(env, class_i);
 
-	// a little backwards but this is how the other lookup function goes
-	// TODO probably fix this
+	// constructors are resolved per class by compile_env
+	int f_i = env->c_ctor[class_i];
+	if (f_i >= 0) {
+		execute_function(env, (func_t) {class_i, f_i, res}, stack);
+	}
+
+	return res;
+}
+
+int ic_find_func(glass_env* env, ic_t* ic, int class_i, int f_name) {
+	// index of function f_name in class class_i, through the inline cache of a . site
+	for (int i = 0; i < ic->n; i++) {
+		if ((ic->key[i] == class_i) && (ic->name[i] == f_name)) return ic->res[i];
+	}
+	int func_i = get_func_idx(*env, env->c_lookup[class_i], f_name);
+	if (func_i < 0) runtime_error("no such function in the object's class");
+	if (ic->n < IC_WAYS) {
+		ic->key[ic->n] = class_i;
+		ic->name[ic->n] = f_name;
+		ic->res[ic->n] = func_i;
+		ic->n++;
+	}
+	return func_i;
+}
+
+int ic_find_class(glass_env* env, ic_t* ic, int c_name) {
+	// index of the class named c_name, through the inline cache of a ! site
+	for (int i = 0; i < ic->n; i++) {
+		if (ic->key[i] == c_name) return ic->res[i];
+	}
+	int class_i = get_class_idx(*env, c_name);
 	if (class_i < 0) runtime_error("init_object: bad class index");
-	int class_name_i = env->c_lookup[class_i];
-	if (class_name_i < 0) runtime_error("init_object: bad class name");
-	int func_name_i = find_name(env->names, "c__");
-	if (func_name_i >= 0) {
-		// find the constructor and run it (if the class has one)
-		int f_i = get_func_idx(*env, class_name_i, func_name_i);
-		if (f_i >= 0) {
-#ifdef DEBUG
-			printf("running constructor\n");
-#endif
-			execute_function(env, (func_t) {class_i, f_i, res}, stack);
-		}
+	if (ic->n < IC_WAYS) {
+		ic->key[ic->n] = c_name;
+		ic->res[ic->n] = class_i;
+		ic->n++;
 	}
+	return class_i;
+}
 
+val* frame_alloc(glass_env* env, int n) {
+	// bump-allocate n uninitialized slots on the frame stack
+	frame_chunk* ch = env->frame_top;
+	if (!ch || (ch->used + n > ch->cap)) {
+		// start a new chunk, preferably the spare one left behind by frame_free
+		frame_chunk* spare = env->frame_spare;
+		if (spare && (spare->cap >= n)) {
+			env->frame_spare = NULL;
+		}
+		else {
+			int cap = (n > FRAME_CHUNK) ? n : FRAME_CHUNK;
+			spare = (frame_chunk*) malloc(sizeof (frame_chunk) + cap * sizeof (val));
+			if (!spare) runtime_error("could not malloc frame chunk in frame_alloc");
+			spare->cap = cap;
+		}
+		spare->used = 0;
+		spare->prev = ch;
+		env->frame_top = ch = spare;
+	}
+	val* res = ch->slots + ch->used;
+	ch->used += n;
 	return res;
 }
 
-val* get_name_target(glass_env* env, val* obj_vals, val* locals, val n) {
+void frame_free(glass_env* env, int n) {
+	// pop the n slots allocated last
+	frame_chunk* ch = env->frame_top;
+	ch->used -= n;
+	if (!ch->used && ch->prev) {
+		// keep one empty chunk around so recursion across a chunk boundary doesn't thrash malloc
+		env->frame_top = ch->prev;
+		free(env->frame_spare);
+		env->frame_spare = ch;
+	}
+}
+
+frame_t* frame_push(glass_env* env, object_t* obj, int start, instr_t* ret, int memo, v_list* stack) {
+	// push a frame for the function whose OP_ENTER is at start, running on obj
+	// the frame record takes the first FRAME_HDR_SLOTS slots, the locals follow (all NO_VAL)
+	// for a memoized call (see memo.h) copies of the arguments on stack come after the locals
+	instr_t* enter = env->code + start;
+	int n_saved = memo ? env->f_info[start].n_args : 0;
+	val* slots = frame_alloc(env, FRAME_HDR_SLOTS + enter->arg + n_saved);
+	frame_t* fr = (frame_t*) slots;
+	*fr = (frame_t) {obj, slots + FRAME_HDR_SLOTS, env->local_names + enter->jump, enter->arg, start, memo, env->frame, ret, NULL};
+	for (int i = 0; i < enter->arg; i++) fr->locals[i] = no_val();
+	for (int i = 0; i < n_saved; i++) fr->locals[enter->arg + i] = stack->vs[stack->last_i + 1 - n_saved + i];
+	env->frame = fr;
+	if (env->prof) prof_enter(env, start);
+	if (TRACING(env)) trace_put(env, TRACE_CALL, start);
+	return fr;
+}
+
+void frame_pop(glass_env* env) {
+	// drop the innermost frame
+	frame_t* fr = env->frame;
+	if (env->prof) prof_exit(env);
+	if (TRACING(env)) trace_put(env, TRACE_RETURN, fr->start);
+	env->frame = fr->prev;
+	frame_free(env, FRAME_HDR_SLOTS + fr->n_locals + (fr->memo ? env->f_info[fr->start].n_args : 0));
+}
+
+int name_slot(int* names, int n, int name) {
+	// index of name in the sorted layout names of length n (binary search), -1 if absent
+	int lo = 0;
+	int hi = n - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (names[mid] == name) return mid;
+		if (names[mid] < name) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return -1;
+}
+
+int frame_slot(frame_t* fr, int name) {
+	// slot of a function-scope name in the current frame, -1 if it only lives in fr->extra
+	// frames only have room for the local names that appear in the function's body
+	return name_slot(fr->names, fr->n_locals, name);
+}
+
+val* extra_target(glass_env* env, extra_vars** extra, int name) {
+	// the value of name in the table *extra, which gets an unset entry for a name it hasn't seen
+	// the table is allocated (or moved to a bigger one) here, and only grows
+	extra_vars* x = *extra;
+	if (x) {
+		for (int i = 0; i < x->n; i++) {
+			if (x->vars[i].name == name) return &x->vars[i].v;
+		}
+	}
+	if (!x || (x->n == x->cap)) {
+		int cap = x ? 2 * x->cap : EXTRA_INIT;
+		extra_vars* grown = (extra_vars*) gc_alloc(env, GC_EXTRA, sizeof (extra_vars) + cap * sizeof (extra_var));
+		grown->n = x ? x->n : 0;
+		grown->cap = cap;
+		if (x) memcpy(grown->vars, x->vars, x->n * sizeof (extra_var));
+		*extra = x = grown;
+	}
+	x->vars[x->n] = (extra_var) {name, no_val()};
+	return &x->vars[x->n++].v;
+}
+
+int field_slot(glass_env* env, object_t* obj, int name) {
+	// slot of an object-scope name in obj, -1 if it only lives in obj->extra
+	// objects only have room for the object names that appear in their class's functions
+	shape_t* shape = env->shapes + obj->class_i;
+	return name_slot(shape->names, shape->n_fields, name);
+}
+
+val* get_name_target(glass_env* env, frame_t* fr, val n) {
 	// given a name n, determine scope and return a pointer to the appropriate val to reference
 	// TODO: this fails when looking up an object name? 
-	if (n.type != NAME) runtime_error("get_name_target: name must be name");
+	if (val_tag(n) != NAME) runtime_error("get_name_target: name must be name");
 	val* res;
-	switch (env->scopes[n.name]) {
+	if (val_name(n) < 0) {
+		// made by V.n
+		res = var_target(env, n);
+		if (!res) runtime_error("generated name used after V.d deleted it");
+		return res;
+	}
+	switch (env->scopes[val_name(n)]) {
 		case GLOBAL_SCOPE:
-		res = env->global_vars + n.name;
+		res = env->global_vars + val_name(n);
 		break;
 		case OBJECT_SCOPE:
-		res = obj_vals + n.name;
+		{
+			int i = field_slot(env, fr->obj, val_name(n));
+			res = (i >= 0) ? fr->obj->vars + i : extra_target(env, &fr->obj->extra, val_name(n));
+		}
 		break;
 		case FUNCTION_SCOPE:
-		res = locals + n.name;
+		{
+			int i = frame_slot(fr, val_name(n));
+			res = (i >= 0) ? fr->locals + i : extra_target(env, &fr->extra, val_name(n));
+		}
 		break;
 		default:
 		runtime_error("bad scope on attempted = assignment");
 		return NULL;
 	}
-#ifdef DEBUG
-	printf("get_name_target request: %s scope %s\n", 
-		env->names[n.name],
-		(char*[]) {"NO_SCOPE", "GLOBAL_SCOPE", "OBJECT_SCOPE", "FUNCTION_SCOPE"}[env->scopes[n.name]]);
-	val ref = *res;
-	if (ref.type == NO_VAL) printf("warning: no_val referenced (fine as assignment target)\n");
-#endif
 	return res;
 }
 
-int execute_token(glass_env* env, object_t* obj, v_list* stack, val* lcl_vars, int t_i) {
-	// execute the t_i token of env. returns 1 if function should return on execution of the token
-	// do not pass / tokens - these should be handled in execute_function
-#ifdef DEBUG
-	print_loc(env, t_i);
-#endif
-	token_t t = env->tokens[t_i];
-	switch (t.type) {
-		case NAME_IDX:
-			push(stack, (val) {NAME, t.data});
-		break;
-		case STNG_IDX:
-			push(stack, (val) {STNG, .stng = env->strings[t.data]});
-		break;
-		case STCK_IDX:
-			if (stack->last_i < t.data) runtime_error("duplicate call overshoots stack");
-			// slightly counterintuitive, but the 0th element of the stack is at last_i
-			push(stack, stack->vs[stack->last_i - t.data]);
-		break;
-		case NUMBER:
-			push(stack, (val) {NUMB, t.data});
-		break;
-		case ASCII:
-			// it's a generic command - lots to do here ...
-			switch (t.data) {
-				case ',':
-					pop(stack);
-				break;
-				case '^':
-					return 1;
-				break;
-				case '=':
-				{
-					// assign a value to a name
-					val v = pop(stack);
-					val n = pop(stack);
-#ifdef DEBUG
-					printf("assigning to %s: ", env->names[n.name]);
-					print_val(n);
-					print_stack(stack);
-#endif
-					*get_name_target(env, obj->vars, lcl_vars, n) = v;
-				}
-				break;
-				case '!':
-				{
-					// initialize an object, assign to variable
-					val c = pop(stack);
-					val n = pop(stack);
-					if ((n.type != NAME) || (c.type != NAME)) runtime_error("both ! operands must be names");
-					val new_obj = (val) {OBJT, .objt = init_object(env, get_class_idx(*env, c.name), stack)};
-					*get_name_target(env, obj->vars, lcl_vars, n) = new_obj;
-				}
-				break;
-				case '.':
-				{
-					// pop an object name and a function name, push the function
-					val f = pop(stack);
-					val o = pop(stack);
-					if ((o.type != NAME) || (f.type != NAME)) runtime_error("both . operands must be names");
-					val obj_var = *get_name_target(env, obj->vars, lcl_vars, o);
-					if (obj_var.type != OBJT) {
-						print_val(o);
-						print_val(obj_var);
-						runtime_error_verbose(env, stack, t_i, "first . operand must be name of object variable");
-					}
-					// resolve the various mappings and push the function. TODO this is horribly clunky
-					int class_i = obj_var.objt->class_i;
-					int c_name_i = env->c_lookup[class_i];
-					int func_i = get_func_idx(*env, c_name_i, f.name);
-					func_t new_func = (func_t) {class_i, func_i, obj_var.objt};
-					push(stack, (val) {FUNC, .func = new_func});
-				}
-				break;
-				case '?':
-				{
-					// pop a function and run it
-					val f = pop(stack);
-					if (f.type != FUNC) runtime_error("operand of ? must be a function");
-#ifdef DEBUG
-					printf("running a new function!\n");
-					print_func(env, f.func);
-					print_stack(stack);
-#endif
-					func_t func = f.func;
-					// down the rabbit hole we go
-					execute_function(env, func, stack);
-				}
-				break;
-				case '*':
-				{
-					// pop a name, push a (scope-dependent) value
-					val n = pop(stack);
-#ifdef DEBUG
-					printf("Retrieving value of %s\n", env->names[n.name]);
-#endif
-					val res = *get_name_target(env, obj->vars, lcl_vars, n);
-#ifdef DEBUG
-					printf("    got ");
-					print_val(res);
-#endif
-					// check that res has an assigned value
-					if (res.type == NO_VAL) runtime_error("variable undefined in the current scope");
-					push(stack, res);
-				}
-				break;
-				case '$':
-				{
-					// pop a name, assign the current object to it
-					val n = pop(stack);
-					val o = (val) {OBJT, .objt = obj};
-					*get_name_target(env, obj->vars, lcl_vars, n) = o;
-				}
-				break;
-				default:
-				runtime_error("execute_token: bad ascii token");
-			}
-		break;
-		default:
-		runtime_error("execute_token: bad token");
+void exec_assign(glass_env* env, v_list* stack, frame_t* fr) {
+	// = : assign a value to a name
+	val v = pop(stack);
+	val n = pop(stack);
+	*get_name_target(env, fr, n) = v;
+}
+
+object_t* exec_new(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins) {
+	// ! : create an object and assign it to a variable
+	// the caller runs the constructor (env->c_ctor) afterwards, the object is reachable by then
+	val c = pop_proven(stack, ins->proven);
+	val n = pop_proven(stack, ins->proven);
+	if (!(ins->proven & PROVEN_TYPES) && ((val_tag(n) != NAME) || (val_tag(c) != NAME))) {
+		runtime_error("both ! operands must be names");
 	}
-	return 0;
+	int class_i = ic_find_class(env, env->ics + ins->arg, val_name(c));
+	object_t* obj = new_object(env, class_i);
+	*get_name_target(env, fr, n) = objt_val(obj);
+	return obj;
 }
 
-void execute_function(glass_env* env, func_t func, v_list* stack) {
-	// execute the function specified by func
-	// handle loops internally
-	object_t* obj = func.obj;
+func_t resolve_bind(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins) {
+	// . : pop an object name and a function name, return the bound function
+	val f = pop_proven(stack, ins->proven);
+	val o = pop_proven(stack, ins->proven);
+	if (!(ins->proven & PROVEN_TYPES) && ((val_tag(o) != NAME) || (val_tag(f) != NAME))) {
+		runtime_error("both . operands must be names");
+	}
+	val obj_var = *get_name_target(env, fr, o);
+	if (val_tag(obj_var) != OBJT) {
+		if (!trap_live) {
+			// goes with the state dump of runtime_error_verbose, after the program's output
+			if (env->out) out_flush(env->out);
+			print_val(o);
+			print_val(obj_var);
+		}
+		runtime_error_verbose(env, stack, ins->tok, "first . operand must be name of object variable");
+	}
+	int class_i = val_objt(obj_var)->class_i;
+	int func_i = ic_find_func(env, env->ics + ins->arg, class_i, val_name(f));
+	return (func_t) {class_i, func_i, val_objt(obj_var)};
+}
+
+void exec_bind(glass_env* env, v_list* stack, frame_t* fr, instr_t* ins) {
+	// . : push the bound function
+	push(stack, func_val(resolve_bind(env, stack, fr, ins)));
+}
 
-	// array of indices of / token of loops
-	// loop_begins[0] is always the location of the current loop
-	// note a valid loop will never begin at 0, because tokens[0] is { always
-	int loop_begins[MAX_LOOP_DEPTH] = {0};
+void exec_call(glass_env* env, v_list* stack) {
+	// ? : pop a function and run it
+	val f = pop(stack);
+	if (val_tag(f) != FUNC) runtime_error("operand of ? must be a function");
+	// down the rabbit hole we go
+	execute_function(env, val_func(f), stack);
+}
+
+void exec_load(glass_env* env, v_list* stack, frame_t* fr) {
+	// * : pop a name, push a (scope-dependent) value
+	val n = pop(stack);
+	val res = *get_name_target(env, fr, n);
+	// check that res has an assigned value
+	if (val_tag(res) == NO_VAL) runtime_error("variable undefined in the current scope");
+	push(stack, res);
+}
 
+void exec_self(glass_env* env, v_list* stack, frame_t* fr) {
+	// $ : pop a name, assign the current object to it
+	val n = pop(stack);
+	*get_name_target(env, fr, n) = objt_val(fr->obj);
+}
+
+int loop_condition(glass_env* env, frame_t* fr, int name, int proven) {
+	// value of the condition name at the head of a / loop
+	// loop heads are safe points for the collector
+	gc_poll(env);
+	val condition = *get_name_target(env, fr, name_val(name));
+	if (!(proven & PROVEN_TYPES) && (val_tag(condition) != NUMB)) runtime_error("for now, only numbers supported as loop conditions");
+	return val_numb(condition);
+}
+
+int fused_arith(glass_env* env, frame_t* fr, instr_t* ins, int a_func, int imm, int* res) {
+	// the number (y)* <k> (o)f.? or (y)* (z)* (o)f.? starting at ins would leave, for the fused
+	// instructions (see peephole.h). returns 0, having changed nothing, when the sequence has to
+	// run as it is: o doesn't hold the A object or an operand isn't a number
+	val y = *get_name_target(env, fr, name_val(ins[0].arg));
+	val z = imm ? numb_val(ins[2].arg) : *get_name_target(env, fr, name_val(ins[2].arg));
+	val o = *get_name_target(env, fr, name_val(ins[imm ? 3 : 4].arg));
+	if ((val_tag(y) != NUMB) || (val_tag(z) != NUMB)) return 0;
+	if ((val_tag(o) != OBJT) || (val_objt(o)->class_i != 0)) return 0;
+	*res = a_apply(a_func, val_numb(y), val_numb(z));
+	return 1;
+}
 
-	if (func.class_i < 5) {
+void execute_function(glass_env* env, func_t func, v_list* stack) {
+	// execute the function specified by func
+	// user functions run their bytecode (see compiler.h) through a threaded dispatch loop
+	// calls between user functions and constructors push a frame on the frame stack and carry on
+	// in the same loop, so Glass recursion doesn't use the C stack. A tail call replaces the
+	// caller's frame. This returns once the frame pushed here (ret NULL) returns
+	if (func.class_i < STD_LIBS) {
 		// the class is one of the standard classes
 		execute_std_function(env, func, stack);
+		return;
 	}
 
-	else {
-		val* locals = (val*) malloc(MAX_NAMES * sizeof (val));
-		for (int i = 0; i < MAX_NAMES; i++) locals[i] = (val) {NO_VAL, 0};
-
-		int t_i = env->f_locs[func.class_i][func.func_i];
-		token_t cur_token;
-
-		//print_tokens(env->tokens + t_i);
-
-		cur_token = env->tokens[t_i];
-		// main loop
-		while (!is_func_end(cur_token)) {
-			// handle things
-			if ((cur_token.type == ASCII) && (cur_token.data == '/')) {
-				// check if this is the first encounter with this loop
-				// if so, update loop_begins
-				if (loop_begins[0] != t_i) {
-					// this is the first encounter of this loop begin
-					// shuffle the loop begins down
-					for (int i = MAX_LOOP_DEPTH - 1; i >= 1; i--) {
-						loop_begins[i] = loop_begins[i - 1];
-					}
-					loop_begins[0] = t_i;
-				}
-				// handle rest of the loop logic
-				// check the value of the following name
-				t_i++;
-				cur_token = env->tokens[t_i];
-				if (cur_token.type != NAME_IDX) runtime_error("/ must be followed by name");
-				val condition = *get_name_target(env, func.obj->vars, locals, (val) {NAME, cur_token.data});
-				if (condition.type != NUMB) runtime_error("for now, only numbers supported as loop conditions");
-				if (condition.numb) {
-					t_i++;
-				}
-				else {
-					// jump to after the loop
-					cur_token = env->tokens[t_i];
-					while(!is_loop_end(cur_token)) {
-						t_i++;
-						cur_token = env->tokens[t_i];
-					}
-					t_i++;
-					// shuffle loop_begins over on exit of the loop
-					for (int i = 0; loop_begins[i] && (i < (MAX_LOOP_DEPTH - 1)); i++) {
-						loop_begins[i] = loop_begins[i + 1];
-					}
-				}
-			}
+	instr_t* code = env->code;
+	frame_t* fr = frame_push(env, func.obj, env->f_code[func.class_i][func.func_i], NULL, 0, stack);
+	instr_t* pc = code + fr->start;
+	void* entry = NULL; // machine code to continue in, see jit_enter
+
+#ifdef THREADED_DISPATCH
+	// one label per op_code, in enum order
+	static void* dispatch[N_OPS] = {
+		&&L_OP_NAME, &&L_OP_NUMB, &&L_OP_STNG, &&L_OP_DUP, &&L_OP_POP, &&L_OP_RET, &&L_OP_ASSIGN,
+		&&L_OP_NEW, &&L_OP_BIND, &&L_OP_CALL, &&L_OP_LOAD, &&L_OP_SELF, &&L_OP_LOOP, &&L_OP_ENDLOOP,
+		&&L_OP_END, &&L_OP_ENTER, &&L_OP_ARITH_IMM, &&L_OP_ARITH_VAR, &&L_OP_UPDATE_IMM,
+		&&L_OP_UPDATE_VAR, &&L_OP_BRANCH_IMM, &&L_OP_BRANCH_VAR, &&L_OP_CALL_STD};
+	// the same with every fused instruction run as the OP_NAME it replaced
+	static void* unfused_dispatch[N_OPS] = {
+		&&L_OP_NAME, &&L_OP_NUMB, &&L_OP_STNG, &&L_OP_DUP, &&L_OP_POP, &&L_OP_RET, &&L_OP_ASSIGN,
+		&&L_OP_NEW, &&L_OP_BIND, &&L_OP_CALL, &&L_OP_LOAD, &&L_OP_SELF, &&L_OP_LOOP, &&L_OP_ENDLOOP,
+		&&L_OP_END, &&L_OP_ENTER, [OP_FIRST_FUSED ... N_OPS - 1] = &&L_OP_NAME};
+	static void* prof_dispatch[N_OPS] = {[0 ... N_OPS - 1] = &&L_PROFILE};
+	void** table = env->prof ? prof_dispatch : env->peephole ? dispatch : unfused_dispatch;
+#else
+	int fuse = env->peephole && !env->prof;
+#endif
 
-			else if ((cur_token.type == ASCII) && (cur_token.data == '\\')) {
-				// end of loop
-				// hop back to the first /, let the next iteration take over the rest
-				t_i = loop_begins[0];
-			}
+	DISPATCH_START();
+
+	OP(OP_NAME)
+	unfused:
+		push(stack, name_val(pc->arg));
+		pc++;
+		NEXT();
+
+	OP(OP_ARITH_IMM)
+	OP(OP_ARITH_VAR)
+	{
+		// fused (y)* <k> (o)f.? and (y)* (z)* (o)f.? (see peephole.h)
+		int imm = (pc->op == OP_ARITH_IMM);
+		int res;
+		if (!fused_arith(env, fr, pc, pc->jump, imm, &res)) goto unfused;
+		if (TRACING(env)) trace_put(env, TRACE_STD, STD_CALL_JUMP(0, pc->jump));
+		push(stack, numb_val(res));
+		pc += imm ? 7 : 8;
+		NEXT();
+	}
 
-			else {
-				// standard token
-				//print_tok(cur_token);
-				int should_return = execute_token(env, func.obj, stack, locals, t_i);
-				if (should_return) {
-					free(locals);
-					return;
-				}
-
-				// just increment to next token on a standard operation
-				t_i++;
+	OP(OP_UPDATE_IMM)
+	OP(OP_UPDATE_VAR)
+	OP(OP_BRANCH_IMM)
+	OP(OP_BRANCH_VAR)
+	{
+		// fused (x) (y)* <k> (o)f.? = and (x) (y)* (z)* (o)f.? =, the BRANCH ones followed by the
+		// \ of the loop on x
+		int imm = (pc->op == OP_UPDATE_IMM) || (pc->op == OP_BRANCH_IMM);
+		int branch = (pc->op >= OP_BRANCH_IMM);
+		int res;
+		if (!fused_arith(env, fr, pc + 1, pc->jump, imm, &res)) goto unfused;
+		if (TRACING(env)) trace_put(env, TRACE_STD, STD_CALL_JUMP(0, pc->jump));
+		*get_name_target(env, fr, name_val(pc->arg)) = numb_val(res);
+		pc += imm ? 9 : 10;
+		// with the JIT the \ has to run, it is where hot loops switch to machine code
+		if (!branch || env->jit) NEXT();
+		// pc is at the \, run its loop head (see OP_LOOP) from here
+		instr_t* head = code + pc->jump;
+		if (TRACING(env)) {
+			env->trace->looping = 1;
+			trace_loop(env, head - code, res);
+		}
+		gc_poll(env);
+		if (res) pc = head + 1;
+		else pc = code + head->jump;
+		NEXT();
+	}
+
+	OP(OP_CALL_STD)
+	{
+		// (o)f.? with o known to hold an object of a standard class (see devirtualize_env)
+		val o = *get_name_target(env, fr, name_val(pc->arg));
+		if (val_tag(o) != OBJT) goto unfused; // not set yet, let . report it
+		int class_i = STD_CALL_CLASS(pc->jump);
+		if (!class_i) {
+			// the other classes go through execute_std_function, which records the call
+			if (TRACING(env)) trace_put(env, TRACE_STD, pc->jump);
+			if (pc[3].proven & PROVEN_ARGS) a_proven(STD_CALL_FUNC(pc->jump), stack);
+			else execute_A_function(STD_CALL_FUNC(pc->jump), stack);
+		}
+		else execute_std_function(env, (func_t) {class_i, STD_CALL_FUNC(pc->jump), val_objt(o)}, stack);
+		pc += 4;
+		NEXT();
+	}
+
+	OP(OP_NUMB)
+		push(stack, numb_val(pc->arg));
+		pc++;
+		NEXT();
+
+	OP(OP_STNG)
+		push(stack, stng_val(env->gc->literals[pc->arg]));
+		pc++;
+		NEXT();
+
+	OP(OP_DUP)
+		if (!(pc->proven & PROVEN_DEPTH) && (stack->last_i < pc->arg)) runtime_error("duplicate call overshoots stack");
+		// slightly counterintuitive, but the 0th element of the stack is at last_i
+		push(stack, stack->vs[stack->last_i - pc->arg]);
+		pc++;
+		NEXT();
+
+	OP(OP_POP)
+		pop_proven(stack, pc->proven);
+		pc++;
+		NEXT();
+
+	OP(OP_ASSIGN)
+		if (pc->proven & PROVEN_DEPTH) {
+			// both operands are there (see verify.h)
+			stack->last_i -= 2;
+			*get_name_target(env, fr, stack->vs[stack->last_i + 1]) = stack->vs[stack->last_i + 2];
+		}
+		else exec_assign(env, stack, fr);
+		pc++;
+		NEXT();
+
+	OP(OP_NEW)
+	{
+		object_t* obj = exec_new(env, stack, fr, pc);
+		int ctor = env->c_ctor[obj->class_i];
+		pc++;
+		if ((ctor >= 0) && (obj->class_i >= STD_LIBS)) {
+			fr = frame_push(env, obj, env->f_code[obj->class_i][ctor], pc, 0, stack);
+			pc = code + fr->start;
+		}
+		NEXT();
+	}
+
+	OP(OP_BIND)
+		exec_bind(env, stack, fr, pc);
+		pc++;
+		NEXT();
+
+	OP(OP_CALL)
+	{
+		// ? : pop a function and run it
+		val f = pop_proven(stack, pc->proven);
+		if (!(pc->proven & PROVEN_TYPES) && (val_tag(f) != FUNC)) runtime_error("operand of ? must be a function");
+		func_t callee = val_func(f);
+		if (callee.class_i < STD_LIBS) {
+			execute_std_function(env, callee, stack);
+			pc++;
+			NEXT();
+		}
+		int start = env->f_code[callee.class_i][callee.func_i];
+		int memo = 0;
+		if (env->memo && memo_usable(env, start, stack)) {
+			// a pure function seen with these arguments before: just take the results
+			if (memo_lookup(env, start, stack)) {
+				pc++;
+				NEXT();
 			}
-			cur_token = env->tokens[t_i];
+			memo = 1;
+		}
+		instr_t* ret = pc + 1;
+		if (pc->arg && !fr->memo) {
+			// tail call: return straight to our caller, our frame is no longer needed
+			// (unless its results still have to go into the memo table)
+			ret = fr->ret;
+			frame_pop(env);
+		}
+		// down the rabbit hole we go
+		fr = frame_push(env, callee.obj, start, ret, memo, stack);
+		pc = code + fr->start;
+		NEXT();
+	}
+
+	OP(OP_LOAD)
+		if (pc->proven & PROVEN_DEPTH) {
+			// the name is there (see verify.h), its value takes its place
+			val* top = stack->vs + stack->last_i;
+			val res = *get_name_target(env, fr, *top);
+			if (val_tag(res) == NO_VAL) runtime_error("variable undefined in the current scope");
+			*top = res;
 		}
-		// function ends naturally
-		free(locals);
+		else exec_load(env, stack, fr);
+		pc++;
+		NEXT();
+
+	OP(OP_SELF)
+		exec_self(env, stack, fr);
+		pc++;
+		NEXT();
+
+	OP(OP_LOOP)
+	{
+		// check the loop condition name, fall through into the body or jump past the loop
+		int taken = loop_condition(env, fr, pc->arg, pc->proven);
+		if (TRACING(env)) trace_loop(env, pc - code, taken);
+		if (taken) pc++;
+		else pc = code + pc->jump;
+		NEXT();
 	}
+
+	OP(OP_ENDLOOP)
+		// hop back to the loop head, which re-checks the condition
+		pc = code + pc->jump;
+		if (TRACING(env)) env->trace->looping = 1;
+		if (env->jit) {
+			// a hot loop can switch to machine code mid-function, the state is shared
+			entry = jit_loop_entry(env, fr->start, pc - code);
+			if (entry) goto jit_enter;
+		}
+		NEXT();
+
+	OP(OP_ENTER)
+		// first instruction of every function, its frame has just been pushed
+		// with the frame linked in, function entry is a safe point for the collector
+		gc_poll(env);
+		if (env->jit) {
+			// run the machine code version if the function is (or just became) hot
+			entry = jit_function_entry(env, fr->start);
+			if (entry) goto jit_enter;
+		}
+		pc++;
+		NEXT();
+
+#ifdef THREADED_DISPATCH
+	L_PROFILE:
+		// profiles count every instruction as compiled, so fused ones aren't run
+		env->prof->counts[pc - code]++;
+		goto *unfused_dispatch[pc->op];
+#endif
+
+	jit_enter:
+	{
+		// machine code runs until the function returns or has a call for us to make
+		int resume = jit_run(env, entry, stack, fr);
+		if (resume < 0) goto function_return;
+		pc = code + resume;
+		NEXT();
+	}
+
+	OP(OP_RET)
+	OP(OP_END)
+	function_return:
+		if (fr->memo) memo_store(env, fr, stack);
+		pc = fr->ret;
+		frame_pop(env);
+		if (!pc) return;
+		fr = env->frame;
+		if (env->jit && env->jit->entry[pc - code]) {
+			// the caller was running machine code when it made the call
+			entry = env->jit->entry[pc - code];
+			goto jit_enter;
+		}
+		NEXT();
+
+	DISPATCH_END();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libglass.h"
+
+// test of libglass.a behind make test
+// parses and runs small programs on one vm, with output and input going through callbacks, and
+// checks every status, message and output along the way: errors come back as codes, and a vm keeps
+// working after a run that failed. Prints the first check that fails and exits 1
+
+#define OUT_SIZE 256
+
+typedef struct out_t out_t;
+typedef struct in_t in_t;
+
+struct out_t {
+	char text[OUT_SIZE];
+	size_t len;
+};
+
+struct in_t {
+	const char* text;
+	size_t pos;
+};
+
+void write_out(void* user, const char* s, size_t len) {
+	out_t* out = (out_t*) user;
+	if (out->len + len >= OUT_SIZE) len = OUT_SIZE - 1 - out->len;
+	memcpy(out->text + out->len, s, len);
+	out->len += len;
+	out->text[out->len] = '\0';
+}
+
+long read_in(void* user, char* buff, size_t len) {
+	in_t* in = (in_t*) user;
+	size_t left = strlen(in->text + in->pos);
+	if (len > left) len = left;
+	memcpy(buff, in->text + in->pos, len);
+	in->pos += len;
+	return (long) len;
+}
+
+void check(int ok, const char* what) {
+	if (ok) return;
+	fprintf(stderr, "FAIL libglass: %s\n", what);
+	exit(1);
+}
+
+int main() {
+	// prints, then pops from an empty stack
+	const char* failing = "{M[m(_o)O!\"before\"(_o)o.?,]}";
+	// echoes a line of its input
+	const char* echo = "{M[m(_i)I!(_o)O!(_i)l.?(_o)o.?]}";
+	out_t out = {"", 0};
+	in_t in = {"hello\nrest\n", 0};
+
+	glass_vm* vm = glass_new(0);
+	check(vm != NULL, "glass_new");
+	glass_set_output(vm, write_out, &out);
+	glass_set_input(vm, read_in, &in);
+	check(glass_run(vm) == GLASS_USAGE_ERROR, "run without a program is a usage error");
+
+	check(glass_parse(vm, "{M[m", 4) == GLASS_PARSE_ERROR, "unterminated program is a parse error");
+	check(glass_error_message(vm)[0] != '\0', "parse error has a message");
+
+	check(glass_parse(vm, failing, strlen(failing)) == GLASS_OK, "parse of the failing program");
+	for (int run = 0; run < 2; run++) {
+		// the second run starts over after the first one's error
+		out.len = 0;
+		check(glass_run(vm) == GLASS_RUNTIME_ERROR, "failing program returns a runtime error");
+		check(strstr(glass_error_message(vm), "cannot pop from empty stack") != NULL, "runtime error message");
+		check(!strcmp(out.text, "before"), "output before the error reaches the callback");
+	}
+
+	check(glass_parse(vm, echo, strlen(echo)) == GLASS_OK, "parse of the echo program on the same vm");
+	out.len = 0;
+	check(glass_run(vm) == GLASS_OK, "echo program runs");
+	check(glass_error_message(vm)[0] == '\0', "no message after a run that succeeded");
+	check(!strcmp(out.text, "hello\n"), "input comes from the callback");
+
+	glass_free(vm);
+	printf("libglass tests passed\n");
+	return 0;
+}
@@ -0,0 +1,376 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "glassdefs.h"
+
+// runtime event tracing (glass --trace, or GLASS_TRACE=events in the environment)
+// the runtime records what the program does into a ring buffer of small binary events: calls and
+// returns of user functions, objects made, loops entered and left, standard library calls, garbage
+// collections and the error that ends the run. An event is three stores into the ring, and with
+// tracing off each recording site costs a test of env->trace.
+// when the run ends in a runtime error the ring is saved as it is to a trace file (glass.trace, or
+// GLASS_TRACE_FILE), along with the names, functions and loops its events refer to, and glass
+// --decode-trace reads it back and prints the last events as text, indented by call depth. Fused instructions record the events
+// of the instructions they stand for, so a trace is the same with or without them. Machine code
+// records nothing, so glass runs a traced program without the JIT
+
+#define TRACE_EVENTS (1 << 16) // default size of the ring
+#define TRACE_FILE "glass.trace"
+#define TRACE_MAGIC "GLTRACE2"
+
+#define TRACING(env) __builtin_expect((env)->trace != NULL, 0) // at each recording site
+
+enum trace_kind {TRACE_NONE=0, TRACE_CALL, TRACE_RETURN, TRACE_NEW, TRACE_LOOP, TRACE_LOOP_EXIT,
+	TRACE_STD, TRACE_ERROR, TRACE_GC, N_TRACE_KINDS};
+
+struct trace_event {
+	uint16_t kind;
+	uint16_t depth; // calls deep, saturates
+	int32_t  arg;   // OP_ENTER index for calls and returns, class for TRACE_NEW, OP_LOOP index for
+	                // loops, STD_CALL_JUMP for standard calls, OP_ENTER of the failing function for errors,
+	                // bytes freed (saturating) for collections
+};
+
+struct trace_ring {
+	trace_event* events;
+	unsigned int mask;   // size of events - 1, the size being a power of two
+	unsigned long n;     // events recorded so far, the last mask + 1 of them are in events
+	int          depth;
+	int          looping; // the loop head about to run was reached from its \, see trace_loop
+	char*        path;    // where trace_save writes
+};
+
+typedef struct trace_file trace_file;
+
+// the tables of a trace file, read back by trace_decode
+struct trace_file {
+	char**    names;
+	int       n_names;
+	int       n_classes;
+	int32_t*  class_name;   // name of each class
+	int32_t*  n_funcs;      // n_funcs[c] is the number of functions of class c
+	int32_t** func_name;    // func_name[c][f] is the name of the fth function of class c
+	int32_t*  funcs;        // OP_ENTER index, class and function of each user function, sorted
+	int       n_user_funcs;
+	int32_t*  loops;        // index, OP_ENTER of its function and name of each OP_LOOP, sorted
+	int       n_loops;
+	char*     error;        // message of the error that ended the run
+};
+
+static __thread glass_env* trace_live = NULL; // the traced env, for errors (which don't get one)
+
+void trace_error(char* error_text);
+
+void trace_init(glass_env* env, int size, char* path);
+void trace_free(glass_env* env);
+static inline void trace_put(glass_env* env, int kind, int arg);
+void trace_loop(glass_env* env, int at, int taken);
+void trace_fail(char* error_text);
+void trace_read(FILE* f, void* p, size_t size);
+void trace_write_text(FILE* f, char* text);
+char* trace_read_text(FILE* f);
+int trace_find(int32_t* rows, int n, int32_t key);
+int trace_cmp_rows(const void* a, const void* b);
+char* trace_name(trace_file* tf, int32_t n);
+char* trace_func_name(trace_file* tf, int32_t c, int32_t fi);
+void trace_print(trace_file* tf, trace_event* e, FILE* out);
+void trace_save(glass_env* env, char* error_text);
+void trace_decode(char* path, int last, FILE* out);
+
+void trace_error(char* error_text) {
+	trap_error("Error in trace.h: ", error_text);
+	fprintf(stderr, "Error in trace.h: %s\n", error_text);
+	exit(1);
+}
+
+void trace_init(glass_env* env, int size, char* path) {
+	// start tracing env into a ring of size events (rounded up to a power of two, 0 for TRACE_EVENTS)
+	// the trace file goes to path, NULL for TRACE_FILE
+	trace_ring* t = (trace_ring*) malloc(sizeof (trace_ring));
+	if (!t) trace_error("could not malloc trace ring");
+	unsigned int cap = 2;
+	while ((int) cap < (size ? size : TRACE_EVENTS)) cap *= 2;
+	t->events = (trace_event*) calloc(cap, sizeof (trace_event));
+	if (!t->events) trace_error("could not malloc trace events");
+	t->mask = cap - 1;
+	t->n = 0;
+	t->depth = 0;
+	t->looping = 0;
+	t->path = path ? path : TRACE_FILE;
+	env->trace = t;
+	trace_live = env;
+}
+
+void trace_free(glass_env* env) {
+	if (!env->trace) return;
+	free(env->trace->events);
+	free(env->trace);
+	env->trace = NULL;
+	if (trace_live == env) trace_live = NULL;
+}
+
+static inline void trace_put(glass_env* env, int kind, int arg) {
+	trace_ring* t = env->trace;
+	if (kind == TRACE_RETURN) t->depth--;
+	trace_event* e = t->events + (t->n++ & t->mask);
+	e->kind = (uint16_t) kind;
+	e->depth = (t->depth < 0) ? 0 : (t->depth > 0xffff) ? 0xffff : (uint16_t) t->depth;
+	e->arg = arg;
+	if (kind == TRACE_CALL) t->depth++;
+}
+
+void trace_loop(glass_env* env, int at, int taken) {
+	// the loop head at index at ran, taken if it went into the body
+	// entering and leaving the loop are events, the iterations in between aren't
+	trace_ring* t = env->trace;
+	if (!t->looping) trace_put(env, TRACE_LOOP, at);
+	if (!taken) trace_put(env, TRACE_LOOP_EXIT, at);
+	t->looping = 0;
+}
+
+void trace_fail(char* error_text) {
+	// a runtime error is about to end the process: record it and save the trace
+	glass_env* env = trace_live;
+	if (!env || !env->trace) return;
+	trace_ring* t = env->trace;
+	trace_put(env, TRACE_ERROR, env->frame ? env->frame->start : -1);
+	trace_save(env, error_text);
+	fprintf(stderr, "the last %lu events are in %s, see glass --decode-trace\n",
+		(t->n > t->mask) ? (unsigned long) t->mask + 1 : t->n, t->path);
+}
+
+void trace_read(FILE* f, void* p, size_t size) {
+	if (fread(p, 1, size, f) != size) trace_error("trace file cut short");
+}
+
+void trace_write_text(FILE* f, char* text) {
+	// its length (4 bytes), then the text
+	uint32_t len = (uint32_t) strlen(text);
+	fwrite(&len, sizeof len, 1, f);
+	fwrite(text, 1, len, f);
+}
+
+char* trace_read_text(FILE* f) {
+	uint32_t len;
+	trace_read(f, &len, sizeof len);
+	char* text = (char*) malloc((size_t) len + 1);
+	if (!text) trace_error("could not malloc in trace_decode");
+	trace_read(f, text, len);
+	text[len] = '\0';
+	return text;
+}
+
+int trace_find(int32_t* rows, int n, int32_t key) {
+	// the row of key in n rows of three numbers sorted by their first, -1 if it isn't there
+	int lo = 0;
+	int hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (rows[3 * mid] == key) return mid;
+		if (rows[3 * mid] < key) lo = mid + 1;
+		else hi = mid;
+	}
+	return -1;
+}
+
+int trace_cmp_rows(const void* a, const void* b) {
+	int32_t x = *(const int32_t*) a;
+	int32_t y = *(const int32_t*) b;
+	return (x > y) - (x < y);
+}
+
+char* trace_name(trace_file* tf, int32_t n) {
+	return ((n >= 0) && (n < tf->n_names)) ? tf->names[n] : "?";
+}
+
+char* trace_func_name(trace_file* tf, int32_t c, int32_t fi) {
+	if ((c < 0) || (c >= tf->n_classes) || (fi < 0) || (fi >= tf->n_funcs[c])) return "?";
+	return trace_name(tf, tf->func_name[c][fi]);
+}
+
+void trace_print(trace_file* tf, trace_event* e, FILE* out) {
+	// the text of event e
+	int32_t start = e->arg;
+	int32_t loop_name = -1;
+	if ((e->kind == TRACE_LOOP) || (e->kind == TRACE_LOOP_EXIT)) {
+		int r = trace_find(tf->loops, tf->n_loops, e->arg);
+		start = (r < 0) ? -1 : tf->loops[3 * r + 1];
+		loop_name = (r < 0) ? -1 : tf->loops[3 * r + 2];
+	}
+	char fn[256] = "?";
+	int r = (start < 0) ? -1 : trace_find(tf->funcs, tf->n_user_funcs, start);
+	if (r >= 0) {
+		int32_t c = tf->funcs[3 * r + 1];
+		snprintf(fn, sizeof fn, "%s.%s", trace_name(tf, tf->class_name[c]), trace_func_name(tf, c, tf->funcs[3 * r + 2]));
+	}
+	switch (e->kind) {
+		case TRACE_CALL:
+		fprintf(out, "call %s", fn);
+		return;
+		case TRACE_RETURN:
+		fprintf(out, "return from %s", fn);
+		return;
+		case TRACE_NEW:
+		fprintf(out, "new %s", ((e->arg >= 0) && (e->arg < tf->n_classes)) ? trace_name(tf, tf->class_name[e->arg]) : "?");
+		return;
+		case TRACE_LOOP:
+		fprintf(out, "loop /%s in %s", trace_name(tf, loop_name), fn);
+		return;
+		case TRACE_LOOP_EXIT:
+		fprintf(out, "end of loop /%s in %s", trace_name(tf, loop_name), fn);
+		return;
+		case TRACE_STD:
+		{
+			int32_t c = STD_CALL_CLASS(e->arg);
+			char* class_name = ((c >= 0) && (c < tf->n_classes)) ? trace_name(tf, tf->class_name[c]) : "?";
+			fprintf(out, "%s.%s", class_name, trace_func_name(tf, c, STD_CALL_FUNC(e->arg)));
+			return;
+		}
+		case TRACE_ERROR:
+		fprintf(out, "error in %s: %s", fn, tf->error);
+		return;
+		case TRACE_GC:
+		fprintf(out, "gc collection freed %d bytes", (int) e->arg);
+		return;
+	}
+	fprintf(out, "?");
+}
+
+void trace_save(glass_env* env, char* error_text) {
+	// write the ring to the trace file, oldest event first, and what trace_decode needs to name the
+	// events. The file is TRACE_MAGIC, the number of events recorded in all (8 bytes) and the number
+	// saved (4 bytes), the saved trace_events, then in 4 byte numbers: the names (each a text, see
+	// trace_write_text), per class its name and its functions' names and OP_ENTER indices (-1 for
+	// standard classes), and per OP_LOOP its index, its function's OP_ENTER and its name. Last comes
+	// the error message
+	trace_ring* t = env->trace;
+	FILE* f = fopen(t->path, "wb");
+	if (!f) {
+		fprintf(stderr, "could not write trace to %s\n", t->path);
+		return;
+	}
+	uint64_t total = t->n;
+	uint32_t count = (t->n > t->mask) ? t->mask + 1 : (uint32_t) t->n;
+	fwrite(TRACE_MAGIC, 1, 8, f);
+	fwrite(&total, sizeof total, 1, f);
+	fwrite(&count, sizeof count, 1, f);
+	// the saved events are one or two runs of the ring
+	uint32_t first = (uint32_t) ((t->n - count) & t->mask);
+	uint32_t run = (first + count > t->mask + 1) ? t->mask + 1 - first : count;
+	fwrite(t->events + first, sizeof (trace_event), run, f);
+	fwrite(t->events, sizeof (trace_event), count - run, f);
+
+	int32_t n = env->n_names;
+	fwrite(&n, sizeof n, 1, f);
+	for (int i = 0; i < env->n_names; i++) trace_write_text(f, env->names[i]);
+	n = env->n_classes;
+	fwrite(&n, sizeof n, 1, f);
+	for (int c = 0; c < env->n_classes; c++) {
+		int32_t head[2] = {env->c_lookup[c], env->n_funcs[c]};
+		fwrite(head, sizeof head, 1, f);
+		for (int fi = 0; fi < env->n_funcs[c]; fi++) {
+			int32_t func[2] = {env->f_lookup[c][fi], (c >= STD_LIBS) ? env->f_code[c][fi] : -1};
+			fwrite(func, sizeof func, 1, f);
+		}
+	}
+	n = 0;
+	for (int i = 0; i < env->n_code; i++) n += (env->code[i].op == OP_LOOP);
+	fwrite(&n, sizeof n, 1, f);
+	int32_t cur = -1;
+	for (int i = 0; i < env->n_code; i++) {
+		if (env->code[i].op == OP_ENTER) cur = i;
+		if (env->code[i].op != OP_LOOP) continue;
+		int32_t loop[3] = {i, cur, env->code[i].arg};
+		fwrite(loop, sizeof loop, 1, f);
+	}
+	trace_write_text(f, error_text ? error_text : "");
+	fclose(f);
+}
+
+void trace_decode(char* path, int last, FILE* out) {
+	// print the last events (all of them if last is 0) of the trace file at path
+	FILE* f = fopen(path, "rb");
+	if (!f) trace_error("could not open trace file");
+	char magic[8];
+	uint64_t total;
+	uint32_t count;
+	if ((fread(magic, 1, 8, f) != 8) || memcmp(magic, TRACE_MAGIC, 8)) trace_error("not a trace file");
+	trace_read(f, &total, sizeof total);
+	trace_read(f, &count, sizeof count);
+	trace_event* events = (trace_event*) malloc(((size_t) count + 1) * sizeof (trace_event));
+	if (!events) trace_error("could not malloc in trace_decode");
+	trace_read(f, events, (size_t) count * sizeof (trace_event));
+
+	trace_file tf;
+	int32_t n;
+	trace_read(f, &n, sizeof n);
+	tf.n_names = (n < 0) ? 0 : n;
+	tf.names = (char**) malloc(((size_t) tf.n_names + 1) * sizeof (char*));
+	if (!tf.names) trace_error("could not malloc in trace_decode");
+	for (int i = 0; i < tf.n_names; i++) tf.names[i] = trace_read_text(f);
+	trace_read(f, &n, sizeof n);
+	tf.n_classes = (n < 0) ? 0 : n;
+	tf.class_name = (int32_t*) malloc(((size_t) tf.n_classes + 1) * sizeof (int32_t));
+	tf.n_funcs = (int32_t*) malloc(((size_t) tf.n_classes + 1) * sizeof (int32_t));
+	tf.func_name = (int32_t**) malloc(((size_t) tf.n_classes + 1) * sizeof (int32_t*));
+	if (!tf.class_name || !tf.n_funcs || !tf.func_name) trace_error("could not malloc in trace_decode");
+	int funcs_cap = 16;
+	tf.funcs = (int32_t*) malloc(3 * funcs_cap * sizeof (int32_t));
+	tf.n_user_funcs = 0;
+	if (!tf.funcs) trace_error("could not malloc in trace_decode");
+	for (int c = 0; c < tf.n_classes; c++) {
+		int32_t head[2];
+		trace_read(f, head, sizeof head);
+		tf.class_name[c] = head[0];
+		tf.n_funcs[c] = (head[1] < 0) ? 0 : head[1];
+		tf.func_name[c] = (int32_t*) malloc(((size_t) tf.n_funcs[c] + 1) * sizeof (int32_t));
+		if (!tf.func_name[c]) trace_error("could not malloc in trace_decode");
+		for (int fi = 0; fi < tf.n_funcs[c]; fi++) {
+			int32_t func[2];
+			trace_read(f, func, sizeof func);
+			tf.func_name[c][fi] = func[0];
+			if (func[1] < 0) continue;
+			if (tf.n_user_funcs == funcs_cap) {
+				funcs_cap *= 2;
+				tf.funcs = (int32_t*) realloc(tf.funcs, 3 * funcs_cap * sizeof (int32_t));
+				if (!tf.funcs) trace_error("could not realloc in trace_decode");
+			}
+			int32_t* row = tf.funcs + 3 * tf.n_user_funcs++;
+			row[0] = func[1];
+			row[1] = c;
+			row[2] = fi;
+		}
+	}
+	qsort(tf.funcs, tf.n_user_funcs, 3 * sizeof (int32_t), trace_cmp_rows);
+	trace_read(f, &n, sizeof n);
+	tf.n_loops = (n < 0) ? 0 : n;
+	tf.loops = (int32_t*) malloc((3 * (size_t) tf.n_loops + 1) * sizeof (int32_t));
+	if (!tf.loops) trace_error("could not malloc in trace_decode");
+	trace_read(f, tf.loops, 3 * (size_t) tf.n_loops * sizeof (int32_t));
+	tf.error = trace_read_text(f);
+	fclose(f);
+
+	uint32_t skip = ((last > 0) && ((uint32_t) last < count)) ? count - last : 0;
+	fprintf(out, "%llu events recorded, the last %u:\n", (unsigned long long) total, count - skip);
+	for (uint32_t i = skip; i < count; i++) {
+		fprintf(out, "%10llu  %*s", (unsigned long long) (total - count + i), 2 * (events[i].depth % 40), "");
+		trace_print(&tf, events + i, out);
+		fprintf(out, "\n");
+	}
+
+	for (int i = 0; i < tf.n_names; i++) free(tf.names[i]);
+	for (int c = 0; c < tf.n_classes; c++) free(tf.func_name[c]);
+	free(tf.names);
+	free(tf.class_name);
+	free(tf.n_funcs);
+	free(tf.func_name);
+	free(tf.funcs);
+	free(tf.loops);
+	free(tf.error);
+	free(events);
+}
+
+#endif
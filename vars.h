@@ -0,0 +1,135 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+
+// names made at run time by the V class
+// V.n hands out a generated name: a NAME val with a negative index, which get_name_target resolves
+// to a slot of env->vars instead of going through the names table. Slots freed by V.d go on a free
+// list and are handed out again first, so both are O(1) and a program making and deleting names in
+// a loop stays the same size. Each slot has a generation, bumped when it's freed and kept in the
+// val between its tag and its index, so a deleted name used afterwards is an error rather than an
+// alias of whoever got the slot. A slot whose generation has run out (after 2^29 reuses) is
+// retired instead of freed, so a name never comes back.
+// generated names are global and print as V<slot>
+
+#define VARS_INIT 64
+#define VAR_SLOT_BITS 24 // the index of a generated name is its slot with the sign bit set
+#define VAR_SLOT_MASK ((1 << VAR_SLOT_BITS) - 1)
+#define VAR_GEN_SHIFT VAL_TAG_BITS // the generation takes the 29 bits below the index
+#define VAR_GEN_MAX ((1 << (32 - VAL_TAG_BITS)) - 1)
+#define VAR_RETIRED -1 // generation of a slot that is never handed out again
+
+struct var_pool {
+	val* vals;  // vals[s] is the value of the name in slot s, NO_VAL while s is free
+	int* gens;  // gens[s] is the generation of slot s, VAR_RETIRED once it has had them all
+	int* next;  // next[s] is the free slot after s, while s is free
+	int  n;     // slots handed out so far, in use or free
+	int  cap;
+	int  free;  // first free slot, -1 if none
+};
+
+void vars_error(char* error_text);
+
+int var_slot(int name);
+val var_val(int slot, int gen);
+val var_new(glass_env* env);
+val* var_target(glass_env* env, val name);
+int var_delete(glass_env* env, val name);
+void vars_free(glass_env* env);
+
+void vars_error(char* error_text) {
+	trap_error("Error in vars.h: ", error_text);
+	fprintf(stderr, "Error in vars.h: %s\n", error_text);
+	exit(1);
+}
+
+int var_slot(int name) {
+	return name & VAR_SLOT_MASK;
+}
+
+val var_val(int slot, int gen) {
+	// the generated name of slot in generation gen
+	val v = name_val((int) (0x80000000u | (unsigned int) slot));
+	v.bits |= (uint64_t) gen << VAR_GEN_SHIFT;
+	return v;
+}
+
+val var_new(glass_env* env) {
+	// a fresh generated name, recycling a deleted one's slot if there is one
+	var_pool* vars = env->vars;
+	if (!vars) {
+		vars = (var_pool*) malloc(sizeof (var_pool));
+		if (!vars) vars_error("could not malloc var pool");
+		vars->vals = NULL;
+		vars->gens = NULL;
+		vars->next = NULL;
+		vars->n = 0;
+		vars->cap = 0;
+		vars->free = -1;
+		env->vars = vars;
+	}
+
+	int s = vars->free;
+	if (s >= 0) {
+		vars->free = vars->next[s];
+	}
+	else {
+		if (vars->n > VAR_SLOT_MASK) vars_error("out of generated names (in use, or retired after 2^29 reuses)");
+		if (vars->n >= vars->cap) {
+			int need = (vars->n < VARS_INIT) ? VARS_INIT : vars->n + 1;
+			int cap = vars->cap;
+			vars->vals = (val*) grow_table(vars->vals, &cap, need, sizeof (val));
+			cap = vars->cap;
+			vars->gens = (int*) grow_table(vars->gens, &cap, need, sizeof (int));
+			cap = vars->cap;
+			vars->next = (int*) grow_table(vars->next, &cap, need, sizeof (int));
+			vars->cap = cap;
+		}
+		s = vars->n++;
+		vars->gens[s] = 0;
+	}
+	vars->vals[s] = no_val();
+	return var_val(s, vars->gens[s]);
+}
+
+val* var_target(glass_env* env, val name) {
+	// the value of generated name name, NULL if V.d deleted it
+	var_pool* vars = env->vars;
+	int s = var_slot(val_name(name));
+	if (!vars || (s >= vars->n)) vars_error("var_target: bad generated name");
+	if ((vars->gens[s] == VAR_RETIRED) || (var_val(s, vars->gens[s]).bits != name.bits)) return NULL;
+	return vars->vals + s;
+}
+
+int var_delete(glass_env* env, val name) {
+	// free the slot of generated name name for the next V.n, returns 0 if it was already deleted
+	var_pool* vars = env->vars;
+	val* v = var_target(env, name);
+	if (!v) return 0;
+	*v = no_val();
+	int s = var_slot(val_name(name));
+	if (vars->gens[s] == VAR_GEN_MAX) {
+		// another generation would wrap around to names deleted long ago
+		vars->gens[s] = VAR_RETIRED;
+		return 1;
+	}
+	vars->gens[s]++;
+	vars->next[s] = vars->free;
+	vars->free = s;
+	return 1;
+}
+
+void vars_free(glass_env* env) {
+	var_pool* vars = env->vars;
+	if (!vars) return;
+	free(vars->vals);
+	free(vars->gens);
+	free(vars->next);
+	free(vars);
+	env->vars = NULL;
+}
+
+#endif
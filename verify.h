@@ -0,0 +1,486 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "glassdefs.h"
+#include "analysis.h"
+
+// static verification of the compiled bytecode, run at the end of compile_env
+// each user function is run through an abstract interpreter that knows, before every instruction,
+// which values the function has put on the stack and not taken off again, the types they can have
+// and what each local name can hold. A loop is run until the state at its head stops changing.
+// global and object names hold whatever any store in the program puts into them, so the functions
+// are gone through in rounds until those settle too.
+// each instruction then gets the runtime checks that can't fail set in its proven field (PROVEN_*,
+// see glassdefs.h), and the interpreter skips them. The values the caller left below the
+// function's own are unknown, so pops reaching into them stay checked.
+// a program whose first function (M's constructor, or M.m if there is none) has an error it can't
+// get past before making any output, looping, or calling anything but A and S must fail, and is
+// rejected here instead of being run
+
+#define VERIFY_STACK 32 // values tracked per stack, deeper ones are forgotten
+
+// the kinds of value an abstract value can be
+#define VT_NUMB  1
+#define VT_NAME  2
+#define VT_STNG  4
+#define VT_OBJT  8
+#define VT_FUNC  16
+#define VT_UNSET 32 // only for local names: no value (yet)
+#define VT_ANY   (VT_NUMB | VT_NAME | VT_STNG | VT_OBJT | VT_FUNC)
+
+#define VT_UNKNOWN -1   // a and b below: not one known name, class or function
+#define VT_GENERATED -2 // a of a VT_NAME: some name made by V.n
+
+typedef struct vtype vtype;
+typedef struct vstate vstate;
+typedef struct verifier verifier;
+
+struct vtype {
+	int types; // VT_* bits, 0 for no value seen yet
+	int a;     // the name (VT_NAME), class (VT_OBJT) or class of the function (VT_FUNC)
+	int b;     // the function index (VT_FUNC)
+};
+
+struct vstate {
+	int    n;      // values of the function known to be on the stack, st[n - 1] on top
+	vtype  st[VERIFY_STACK];
+	vtype* locals; // by frame slot
+};
+
+struct verifier {
+	glass_env* env;
+	vtype*     names;   // names[n] is everything stored into global or object name n
+	vtype      gen;     // everything stored into names made by V.n
+	vtype      wild;    // everything stored through a name that isn't known
+	int*       slot;    // slot[n] is the frame slot of local name n in the function being verified
+	int        any_ctor; // some class has a constructor, so an unknown ! may run one
+	int        changed; // names, gen or wild grew in this round
+};
+
+void verify_error(char* error_text);
+
+vtype vt(int types, int a, int b);
+vtype vt_join(vtype x, vtype y);
+int vt_same(vtype x, vtype y);
+int vt_never(vtype v, int types);
+int vstate_join(vstate* into, vstate* from, int n_locals);
+void vstate_copy(vstate* into, vstate* from, int n_locals);
+void vs_push(vstate* s, vtype v);
+vtype vs_pop(vstate* s, int* ok);
+void vs_forget(vstate* s, int n_locals, int unset);
+void verify_grow(verifier* v, vtype* into, vtype x);
+void verify_store(verifier* v, vstate* s, int n_locals, vtype n, vtype x);
+vtype verify_load(verifier* v, vstate* s, vtype n);
+int verify_std(verifier* v, vstate* s, int n_locals, int class_i, int func_i, int* args_ok, char** fail);
+int verify_function(verifier* v, int class_i, int func_i, char* failed);
+void verify_env(glass_env* env);
+
+void verify_error(char* error_text) {
+	trap_error("Error in verify.h: ", error_text);
+	fprintf(stderr, "Error in verify.h: %s\n", error_text);
+	exit(1);
+}
+
+vtype vt(int types, int a, int b) {
+	return (vtype) {types, a, b};
+}
+
+vtype vt_join(vtype x, vtype y) {
+	// a value that is x or y
+	if (!x.types) return y;
+	if (!y.types) return x;
+	return (vtype) {x.types | y.types, (x.a == y.a) ? x.a : VT_UNKNOWN, (x.b == y.b) ? x.b : VT_UNKNOWN};
+}
+
+int vt_same(vtype x, vtype y) {
+	return (x.types == y.types) && (x.a == y.a) && (x.b == y.b);
+}
+
+int vt_never(vtype v, int types) {
+	// v is known and is never any of types: a check for them is sure to fail
+	return v.types && !(v.types & types);
+}
+
+int vstate_join(vstate* into, vstate* from, int n_locals) {
+	// make into cover from as well (stacks line up at the top), returns whether it changed
+	int changed = 0;
+	int n = (from->n < into->n) ? from->n : into->n;
+	if (n < into->n) {
+		memmove(into->st, into->st + into->n - n, n * sizeof (vtype));
+		into->n = n;
+		changed = 1;
+	}
+	for (int k = 1; k <= n; k++) {
+		vtype j = vt_join(into->st[n - k], from->st[from->n - k]);
+		if (!vt_same(j, into->st[n - k])) changed = 1;
+		into->st[n - k] = j;
+	}
+	for (int k = 0; k < n_locals; k++) {
+		vtype j = vt_join(into->locals[k], from->locals[k]);
+		if (!vt_same(j, into->locals[k])) changed = 1;
+		into->locals[k] = j;
+	}
+	return changed;
+}
+
+void vstate_copy(vstate* into, vstate* from, int n_locals) {
+	into->n = from->n;
+	memcpy(into->st, from->st, from->n * sizeof (vtype));
+	memcpy(into->locals, from->locals, n_locals * sizeof (vtype));
+}
+
+void vs_push(vstate* s, vtype v) {
+	if (s->n == VERIFY_STACK) {
+		memmove(s->st, s->st + 1, (VERIFY_STACK - 1) * sizeof (vtype));
+		s->n--;
+	}
+	s->st[s->n++] = v;
+}
+
+vtype vs_pop(vstate* s, int* ok) {
+	// the value on top, *ok cleared if it may not be there
+	if (s->n) return s->st[--s->n];
+	*ok = 0;
+	return vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN);
+}
+
+void vs_forget(vstate* s, int n_locals, int unset) {
+	// after a call that could have done anything to the stack (and, with unset, been a V.d on a
+	// local name)
+	s->n = 0;
+	if (unset) for (int k = 0; k < n_locals; k++) s->locals[k].types |= VT_UNSET;
+}
+
+void verify_grow(verifier* v, vtype* into, vtype x) {
+	// a store into a name tracked for the whole program
+	vtype j = vt_join(*into, x);
+	if (!vt_same(j, *into)) v->changed = 1;
+	*into = j;
+}
+
+void verify_store(verifier* v, vstate* s, int n_locals, vtype n, vtype x) {
+	// x is stored into the name n (=, ! and $)
+	glass_env* env = v->env;
+	x.types &= ~VT_UNSET;
+	if (!(n.types & VT_NAME)) return; // fails
+	if ((n.types == VT_NAME) && (n.a >= 0)) {
+		if (env->scopes[n.a] != FUNCTION_SCOPE) verify_grow(v, v->names + n.a, x);
+		else if (v->slot[n.a] >= 0) s->locals[v->slot[n.a]] = x;
+	}
+	else if ((n.types == VT_NAME) && (n.a == VT_GENERATED)) verify_grow(v, &v->gen, x);
+	else {
+		// could be any name, this function's locals too
+		verify_grow(v, &v->wild, x);
+		for (int k = 0; k < n_locals; k++) s->locals[k] = vt_join(s->locals[k], x);
+	}
+}
+
+vtype verify_load(verifier* v, vstate* s, vtype n) {
+	// what the name n holds (* and .), VT_UNSET included for local names
+	vtype any = vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN);
+	if (n.types != VT_NAME) return any;
+	vtype res = any;
+	if (n.a >= 0) {
+		if (v->env->scopes[n.a] != FUNCTION_SCOPE) res = vt_join(v->names[n.a], v->wild);
+		else if (v->slot[n.a] >= 0) res = s->locals[v->slot[n.a]];
+	}
+	else if (n.a == VT_GENERATED) res = vt_join(v->gen, v->wild);
+	return res.types ? res : any;
+}
+
+int verify_std(verifier* v, vstate* s, int n_locals, int class_i, int func_i, int* args_ok, char** fail) {
+	// the standard function func_i of class_i is called, returns whether it's A or S (which always
+	// come back and can't make output)
+	// orders as in init_env: A {a s m d mod f e ne lt le gt ge}, S {l i si a d e ns sn}, V {n d},
+	// O {o on}, I {l c e}
+	static const int s_results[][2] = {{VT_NUMB, 0}, {VT_STNG, 0}, {VT_STNG, 0}, {VT_STNG, 0},
+		{VT_STNG, VT_STNG}, {VT_NUMB, 0}, {VT_STNG, 0}, {VT_NUMB, 0}};
+	vtype x;
+	int ok = 1;
+	int n_args, n_results;
+	if (std_effect(class_i, func_i, &n_args, &n_results)) {
+		int numbers = 1;
+		for (int k = 0; k < n_args; k++) {
+			// y is popped before x is, and x is checked before y
+			x = vs_pop(s, &ok);
+			if (x.types != VT_NUMB) numbers = 0;
+			if (!ok) *fail = "cannot pop from empty stack";
+			else if (!class_i && vt_never(x, VT_NUMB)) *fail = "arithmetic operands must be numbers";
+		}
+		if (!class_i) {
+			*args_ok = ok && numbers;
+			vs_push(s, vt(VT_NUMB, VT_UNKNOWN, VT_UNKNOWN));
+		}
+		else for (int k = 0; k < n_results; k++) vs_push(s, vt(s_results[func_i][k], VT_UNKNOWN, VT_UNKNOWN));
+		return 1;
+	}
+	switch (class_i) {
+		case 2:
+			if (func_i == 0) vs_push(s, vt(VT_NAME, VT_GENERATED, VT_UNKNOWN));
+			else {
+				// V.d takes the value of a name
+				x = vs_pop(s, &ok);
+				if ((x.types == VT_NAME) && (x.a >= 0)) {
+					if ((v->env->scopes[x.a] == FUNCTION_SCOPE) && (v->slot[x.a] >= 0)) s->locals[v->slot[x.a]].types |= VT_UNSET;
+				}
+				else if ((x.types != VT_NAME) || (x.a != VT_GENERATED)) vs_forget(s, n_locals, 1);
+			}
+		break;
+		case 3:
+			vs_pop(s, &ok);
+		break;
+		case 4:
+			vs_push(s, vt((func_i == 2) ? VT_NUMB : VT_STNG, VT_UNKNOWN, VT_UNKNOWN));
+		break;
+	}
+	return 0;
+}
+
+int verify_function(verifier* v, int class_i, int func_i, char* failed) {
+	// one abstract run over function func_i of class class_i, setting the proven field of its code
+	// with failed, the function is the first one the program runs and its stack starts out empty:
+	// returns 1 with the message in failed (TRAP_MESSAGE_SIZE) if an error is sure to happen
+	// before anything else could
+	glass_env* env = v->env;
+	int start = env->f_code[class_i][func_i];
+	instr_t* code = env->code;
+	int end = start;
+	while (code[end].op != OP_END) end++;
+
+	int n_locals = code[start].arg;
+	int* local_names = env->local_names + code[start].jump;
+	for (int k = 0; k < n_locals; k++) v->slot[local_names[k]] = k;
+
+	// the current state and one per enclosing loop, at its head
+	vstate* states = (vstate*) malloc((MAX_LOOP_DEPTH + 1) * sizeof (vstate));
+	vtype* locals = (vtype*) malloc(((MAX_LOOP_DEPTH + 1) * n_locals + 1) * sizeof (vtype));
+	if (!states || !locals) verify_error("could not malloc states in verify_function");
+	for (int l = 0; l <= MAX_LOOP_DEPTH; l++) states[l].locals = locals + l * n_locals;
+	vstate* s = states + MAX_LOOP_DEPTH;
+	s->n = 0;
+	for (int k = 0; k < n_locals; k++) s->locals[k] = vt(VT_UNSET, VT_UNKNOWN, VT_UNKNOWN);
+
+	int loop_at[MAX_LOOP_DEPTH];
+	int loop_dead[MAX_LOOP_DEPTH];
+	int n_loops = 0;
+	int dead = 0; // after a ^, until the end of the enclosing loop
+	int certain = (failed != NULL); // every instruction so far runs, and the stack is all the function's
+	int res = 0;
+
+	int i = start + 1;
+	while (i <= end) {
+		instr_t* ins = code + i;
+		// code after a ^ is unreachable until its loop ends
+		if (dead && (ins->op != OP_LOOP) && (ins->op != OP_ENDLOOP) && (ins->op != OP_END)) {
+			i++;
+			continue;
+		}
+		int reached = certain; // an error of this instruction is sure to happen
+		int depth_ok = 1;
+		int types_ok = 0;
+		int args_ok = 0;
+		char* fail = NULL;
+		vtype x, y;
+		int next = i + 1;
+		switch (base_op(ins->op)) {
+			case OP_NAME: vs_push(s, vt(VT_NAME, ins->arg, VT_UNKNOWN)); break;
+			case OP_NUMB: vs_push(s, vt(VT_NUMB, VT_UNKNOWN, VT_UNKNOWN)); break;
+			case OP_STNG: vs_push(s, vt(VT_STNG, VT_UNKNOWN, VT_UNKNOWN)); break;
+			case OP_DUP:
+				if (s->n > ins->arg) x = s->st[s->n - 1 - ins->arg];
+				else {
+					depth_ok = 0;
+					fail = "duplicate call overshoots stack";
+					x = vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN);
+				}
+				vs_push(s, x);
+			break;
+			case OP_POP: vs_pop(s, &depth_ok); break;
+			case OP_ASSIGN:
+				x = vs_pop(s, &depth_ok);
+				y = vs_pop(s, &depth_ok);
+				if (vt_never(y, VT_NAME)) fail = "get_name_target: name must be name";
+				verify_store(v, s, n_locals, y, x);
+			break;
+			case OP_SELF:
+				y = vs_pop(s, &depth_ok);
+				if (vt_never(y, VT_NAME)) fail = "get_name_target: name must be name";
+				verify_store(v, s, n_locals, y, vt(VT_OBJT, class_i, VT_UNKNOWN));
+			break;
+			case OP_LOAD:
+				y = vs_pop(s, &depth_ok);
+				x = verify_load(v, s, y);
+				if (vt_never(y, VT_NAME)) fail = "get_name_target: name must be name";
+				else if (x.types == VT_UNSET) fail = "variable undefined in the current scope";
+				x.types &= ~VT_UNSET;
+				vs_push(s, x.types ? x : vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN));
+			break;
+			case OP_NEW:
+			{
+				x = vs_pop(s, &depth_ok);
+				y = vs_pop(s, &depth_ok);
+				types_ok = (x.types == VT_NAME) && (y.types == VT_NAME);
+				if (vt_never(x, VT_NAME) || vt_never(y, VT_NAME)) fail = "both ! operands must be names";
+				int c = ((x.types == VT_NAME) && (x.a >= 0)) ? get_class_idx(*env, x.a) : VT_UNKNOWN;
+				if ((x.types == VT_NAME) && (x.a >= 0) && (c < 0)) fail = "init_object: bad class index";
+				verify_store(v, s, n_locals, y, vt(VT_OBJT, (c >= 0) ? c : VT_UNKNOWN, VT_UNKNOWN));
+				// the constructor runs like a call
+				if ((c >= STD_LIBS) && (env->c_ctor[c] >= 0)) {
+					func_info* fi = env->f_info + env->f_code[c][env->c_ctor[c]];
+					if (!fi->known) vs_forget(s, n_locals, 0);
+					else {
+						int ok = 1; // the constructor's own pops are checked as it runs
+						for (int k = 0; k < fi->n_args; k++) vs_pop(s, &ok);
+						for (int k = 0; k < fi->n_results; k++) vs_push(s, vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN));
+					}
+					certain = 0;
+				}
+				else if ((c < 0) && v->any_ctor) {
+					vs_forget(s, n_locals, 0);
+					certain = 0;
+				}
+			}
+			break;
+			case OP_BIND:
+			{
+				x = vs_pop(s, &depth_ok);
+				y = vs_pop(s, &depth_ok);
+				types_ok = (x.types == VT_NAME) && (y.types == VT_NAME);
+				if (vt_never(x, VT_NAME) || vt_never(y, VT_NAME)) fail = "both . operands must be names";
+				vtype f = vt(VT_FUNC, VT_UNKNOWN, VT_UNKNOWN);
+				if ((i - 2 > start) && (code[i - 2].op == OP_CALL_STD)) {
+					// (o)f.? on an o only ever holding this standard object, see devirtualize_env
+					f = vt(VT_FUNC, STD_CALL_CLASS(code[i - 2].jump), STD_CALL_FUNC(code[i - 2].jump));
+				}
+				else if (types_ok && (x.a >= 0)) {
+					vtype o = verify_load(v, s, y);
+					int c = ((o.types & ~VT_UNSET) == VT_OBJT) ? o.a : VT_UNKNOWN;
+					int fn = (c >= 0) ? get_func_idx(*env, env->c_lookup[c], x.a) : -1;
+					if (fn >= 0) f = vt(VT_FUNC, c, fn);
+					else if ((c >= 0) && (o.types == VT_OBJT)) fail = "no such function in the object's class";
+				}
+				vs_push(s, f);
+			}
+			break;
+			case OP_CALL:
+			{
+				x = vs_pop(s, &depth_ok);
+				types_ok = (x.types == VT_FUNC);
+				if (vt_never(x, VT_FUNC)) fail = "operand of ? must be a function";
+				int c = (types_ok && (x.b >= 0)) ? x.a : VT_UNKNOWN;
+				int known = 0;
+				if (c < 0) vs_forget(s, n_locals, 1);
+				else if (c < STD_LIBS) known = verify_std(v, s, n_locals, c, x.b, &args_ok, &fail);
+				else {
+					func_info* fi = env->f_info + env->f_code[c][x.b];
+					if (!fi->known) vs_forget(s, n_locals, 0);
+					else {
+						int ok = 1;
+						for (int k = 0; k < fi->n_args; k++) vs_pop(s, &ok);
+						for (int k = 0; k < fi->n_results; k++) vs_push(s, vt(VT_ANY, VT_UNKNOWN, VT_UNKNOWN));
+					}
+				}
+				if (!known) certain = 0;
+			}
+			break;
+			case OP_LOOP:
+				if (!dead) {
+					// the condition is read straight from the name, so only a set local can be proven
+					int k = (env->scopes[ins->arg] == FUNCTION_SCOPE) ? v->slot[ins->arg] : -1;
+					if (k >= 0) {
+						types_ok = (s->locals[k].types == VT_NUMB);
+						if (vt_never(s->locals[k], VT_NUMB)) fail = "for now, only numbers supported as loop conditions";
+					}
+				}
+				if (!n_loops || (loop_at[n_loops - 1] != i)) {
+					// first time in from above, not back from the \ .
+					if (n_loops >= MAX_LOOP_DEPTH) verify_error("MAX_LOOP_DEPTH exceeded");
+					vstate_copy(states + n_loops, s, n_locals);
+					loop_at[n_loops] = i;
+					loop_dead[n_loops] = dead;
+					n_loops++;
+				}
+			break;
+			case OP_ENDLOOP:
+				n_loops--;
+				if (!dead && vstate_join(states + n_loops, s, n_locals)) {
+					// the head has more to cover, run the body again from there
+					vstate_copy(s, states + n_loops, n_locals);
+					next = loop_at[n_loops];
+					n_loops++;
+					break;
+				}
+				// leaving through the head
+				vstate_copy(s, states + n_loops, n_locals);
+				dead = loop_dead[n_loops];
+			break;
+			case OP_RET:
+			case OP_END:
+				dead = 1;
+			break;
+			default:
+			verify_error("bad op in verify_function");
+		}
+
+		// a pop from the empty stack comes before anything the instruction checks
+		if (!depth_ok && (base_op(ins->op) != OP_DUP)) fail = "cannot pop from empty stack";
+		if (reached && fail) {
+			snprintf(failed, TRAP_MESSAGE_SIZE, "the program always fails with \"%s\" (%s.%s, token %d)", fail,
+				env->names[env->c_lookup[class_i]], env->names[env->f_lookup[class_i][func_i]], ins->tok);
+			res = 1;
+			break;
+		}
+		if ((base_op(ins->op) == OP_LOOP) || (base_op(ins->op) == OP_RET) || (s->n == VERIFY_STACK)) certain = 0;
+		ins->proven = (depth_ok ? PROVEN_DEPTH : 0) | (types_ok ? PROVEN_TYPES : 0) | (args_ok ? PROVEN_ARGS : 0);
+		i = next;
+	}
+
+	for (int k = 0; k < n_locals; k++) v->slot[local_names[k]] = -1;
+	free(states);
+	free(locals);
+	return res;
+}
+
+void verify_env(glass_env* env) {
+	// verify every user function, see above. Needs the stack effects from analyze_env
+	analyze_env(env);
+	verifier v;
+	v.env = env;
+	v.names = (vtype*) calloc(env->n_names + 1, sizeof (vtype));
+	v.slot = (int*) malloc((env->n_names + 1) * sizeof (int));
+	if (!v.names || !v.slot) verify_error("could not malloc in verify_env");
+	for (int n = 0; n < env->n_names; n++) v.slot[n] = -1;
+	v.gen = vt(0, VT_UNKNOWN, VT_UNKNOWN);
+	v.wild = vt(0, VT_UNKNOWN, VT_UNKNOWN);
+	v.any_ctor = any_ctor(env);
+
+	// rounds until no store adds anything, the last one has seen everything
+	do {
+		v.changed = 0;
+		for (int c = STD_LIBS; c < env->n_classes; c++) {
+			for (int f = 0; f < env->n_funcs[c]; f++) {
+				if (env->f_code[c][f] >= 0) verify_function(&v, c, f, NULL);
+			}
+		}
+	} while (v.changed);
+
+	// the program starts with M's constructor (if it has one) on an empty stack, then M.m
+	int m_class = find_name(env, "M");
+	int m_func = find_name(env, "m");
+	int main_idx = (m_class >= 0) ? get_class_idx(*env, m_class) : -1;
+	char failed[TRAP_MESSAGE_SIZE];
+	int fails = 0;
+	if (main_idx >= STD_LIBS) {
+		int first = env->c_ctor[main_idx];
+		if ((first < 0) && (m_func >= 0)) first = get_func_idx(*env, m_class, m_func);
+		if ((first >= 0) && (env->f_code[main_idx][first] >= 0)) fails = verify_function(&v, main_idx, first, failed);
+	}
+
+	free(v.names);
+	free(v.slot);
+	if (fails) verify_error(failed);
+}
+
+#endif